@@ -0,0 +1,104 @@
+#pragma once
+#ifndef AABB_H
+#define AABB_H
+
+#include "rendyUtils.h"
+#include <algorithm>
+#include <utility>
+
+/*
+	An axis-aligned bounding box, stored as one Interval per axis. Every Surface can
+	report one, and the BVH uses them to skip whole groups of objects that a ray
+	can't possibly hit.
+*/
+class AABB {
+	public:
+		Interval x, y, z;
+
+		// The default box is empty, so expanding it by anything gives that thing's bounds
+		AABB() {}
+		AABB(const Interval& _x, const Interval& _y, const Interval& _z) : x(_x), y(_y), z(_z) {}
+
+		// The box with the two points as opposite corners, in any order
+		AABB(const Vec3& a, const Vec3& b)
+			: x((std::min)(a.x(), b.x()), (std::max)(a.x(), b.x())),
+			  y((std::min)(a.y(), b.y()), (std::max)(a.y(), b.y())),
+			  z((std::min)(a.z(), b.z()), (std::max)(a.z(), b.z())) {}
+
+		// The smallest box that encloses both boxes
+		AABB(const AABB& a, const AABB& b) : x(a.x, b.x), y(a.y, b.y), z(a.z, b.z) {}
+
+		const Interval& axis(int n) const {
+			if (n == 1) return y;
+			if (n == 2) return z;
+			return x;
+		}
+
+		void expand(const AABB& box) { *this = AABB(*this, box); }
+		void expand(const Vec3& point) { *this = AABB(*this, AABB(point, point)); }
+
+		bool empty() const { return x.min > x.max || y.min > y.max || z.min > z.max; }
+
+		Vec3 centroid() const {
+			return Vec3((x.min + x.max) * 0.5f, (y.min + y.max) * 0.5f, (z.min + z.max) * 0.5f);
+		}
+
+		// Index of the axis along which the box is longest
+		int longestAxis() const {
+			if (x.size() > y.size()) {
+				return x.size() > z.size() ? 0 : 2;
+			}
+			return y.size() > z.size() ? 1 : 2;
+		}
+
+		/*
+			The surface area drives the surface area heuristic (SAH): the chance that a
+			random ray passing through a parent box also passes through a child box is
+			the ratio of their surface areas.
+		*/
+		float surfaceArea() const {
+			if (empty()) {
+				return 0;
+			}
+			float dx = x.size(), dy = y.size(), dz = z.size();
+			return 2.0f * (dx * dy + dy * dz + dz * dx);
+		}
+
+		/*
+			The slab test: on each axis the ray is inside the box between the two
+			distances where it crosses the box's planes on that axis. The ray hits the
+			box if those three ranges (and rayT) overlap.
+
+			invDirection is 1 / ray direction per component, computed once per ray so
+			the test is only multiplies, min and max. On a hit, tEntry is the distance
+			at which the ray enters the box, used to visit nearer children first.
+
+			See: https://raytracing.github.io/books/RayTracingTheNextWeek.html#boundingvolumehierarchies
+		*/
+		bool hit(const Vec3& origin, const Vec3& invDirection, float tMin, float tMax, float& tEntry) const {
+			for (int n = 0; n < 3; n++) {
+				const Interval& slab = axis(n);
+				float t0 = (slab.min - origin[n]) * invDirection[n];
+				float t1 = (slab.max - origin[n]) * invDirection[n];
+				if (invDirection[n] < 0) {
+					std::swap(t0, t1);
+				}
+				tMin = t0 > tMin ? t0 : tMin;
+				tMax = t1 < tMax ? t1 : tMax;
+				if (tMax < tMin) {
+					return false;
+				}
+			}
+			tEntry = tMin;
+			return true;
+		}
+
+		bool hit(const Ray& r, Interval rayT) const {
+			Vec3 direction = r.direction();
+			Vec3 invDirection(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+			float tEntry;
+			return hit(r.origin(), invDirection, rayT.min, rayT.max, tEntry);
+		}
+};
+
+#endif
@@ -0,0 +1,153 @@
+#pragma once
+#ifndef ACCUMULATIONBUFFER_H
+#define ACCUMULATIONBUFFER_H
+
+#include "framebuffer.h"
+#include "threadPool.h"
+#include "toneMapper.h"
+#include "vec3.h"
+#include <algorithm>
+#include <vector>
+
+/*
+	A float buffer that holds the running sum of every sample traced for each pixel,
+	along with how many samples that is. It lets an image be refined over several
+	passes: each pass adds more samples, and resolve turns the sums into the averaged
+	image at any point in between.
+
+	The samples are linear light, with no gamma applied and nothing clamped, so the
+	averages are the HDR image, which can be written out as is (see writePFM) or tone
+	mapped into the framebuffer.
+*/
+class AccumulationBuffer {
+	public:
+		AccumulationBuffer() : _width(0), _height(0), _sampleCount(0) {}
+		AccumulationBuffer(int width, int height) { resize(width, height); }
+
+		// Resize the buffer and throw away all accumulated samples
+		void resize(int width, int height) {
+			_width = width;
+			_height = height;
+			_sum.assign(static_cast<size_t>(width) * height * 3, 0.0f);
+			_sampleCount = 0;
+		}
+
+		// Throw away all accumulated samples
+		void clear() { resize(_width, _height); }
+
+		// Getters
+		const int width() const { return _width; }
+		const int height() const { return _height; }
+		const int sampleCount() const { return _sampleCount; }
+
+		Vec3 sum(int i, int j) const {
+			const float* pixel = &_sum[index(i, j)];
+			return Vec3(pixel[0], pixel[1], pixel[2]);
+		}
+
+		// The average of the samples accumulated for a pixel
+		Vec3 average(int i, int j) const { return _sampleCount > 0 ? sum(i, j) * (1.0f / _sampleCount) : Vec3(0, 0, 0); }
+
+		/*
+			The averages interpolated bilinearly at a point of the image, measured in
+			pixels with (0.5, 0.5) at the center of the top left one. Points past the
+			centers of the edge pixels take the edge's colors.
+		*/
+		Vec3 average(float x, float y) const {
+			const float fx = (std::min)((std::max)(x - 0.5f, 0.0f), static_cast<float>(_width - 1));
+			const float fy = (std::min)((std::max)(y - 0.5f, 0.0f), static_cast<float>(_height - 1));
+			const int i = static_cast<int>(fx);
+			const int j = static_cast<int>(fy);
+			const int i1 = (std::min)(i + 1, _width - 1);
+			const int j1 = (std::min)(j + 1, _height - 1);
+			const float s = fx - i;
+			const float t = fy - j;
+			const Vec3 top = sum(i, j) * (1.0f - s) + sum(i1, j) * s;
+			const Vec3 bottom = sum(i, j1) * (1.0f - s) + sum(i1, j1) * s;
+			return (top * (1.0f - t) + bottom * t) * (1.0f / _sampleCount);
+		}
+
+		// Add the sum of some samples to a pixel. Each pixel is only ever touched by one thread.
+		void add(int i, int j, const Vec3& samples) {
+			float* pixel = &_sum[index(i, j)];
+			pixel[0] += samples.x();
+			pixel[1] += samples.y();
+			pixel[2] += samples.z();
+		}
+
+		// Record that every pixel received count more samples
+		void addSamples(int count) { _sampleCount += count; }
+
+		// Tone map the average of the accumulated samples into the framebuffer
+		void resolve(Framebuffer& framebuffer, const ToneMapper& toneMapper) const {
+			if (framebuffer.width() != _width || framebuffer.height() != _height) {
+				framebuffer.resize(_width, _height);
+			}
+			if (_sampleCount == 0) {
+				return;
+			}
+
+			const float scale = 1.0f / _sampleCount;
+			for (int j = 0; j < _height; j++) {
+				for (int i = 0; i < _width; i++) {
+					framebuffer.pixel(i, j, toneMapper.pack(sum(i, j) * scale));
+				}
+			}
+		}
+
+		/*
+			Tone map the averages into a framebuffer of width x height pixels, stretching
+			the image to fit. A low resolution preview is blown up to the size of the
+			window this way, with its pixels blended rather than shown as blocks. The rows
+			are spread over the thread pool, since there are as many as in a full frame.
+		*/
+		void resolve(Framebuffer& framebuffer, const ToneMapper& toneMapper, int width, int height, ThreadPool& pool) const {
+			if (framebuffer.width() != width || framebuffer.height() != height) {
+				framebuffer.resize(width, height);
+			}
+			if (_sampleCount == 0) {
+				return;
+			}
+
+			// Every column blends the same two columns of the buffer on every row, so those are worked out once
+			struct Tap {
+				int low;
+				int high;
+				float blend;
+			};
+			auto taps = [](int count, int size) {
+				std::vector<Tap> taps(count);
+				const float scale = static_cast<float>(size) / count;
+				for (int n = 0; n < count; n++) {
+					const float position = (std::min)((std::max)((n + 0.5f) * scale - 0.5f, 0.0f), static_cast<float>(size - 1));
+					taps[n].low = static_cast<int>(position);
+					taps[n].high = (std::min)(taps[n].low + 1, size - 1);
+					taps[n].blend = position - taps[n].low;
+				}
+				return taps;
+			};
+			const std::vector<Tap> columns = taps(width, _width);
+			const std::vector<Tap> rows = taps(height, _height);
+
+			const float scale = 1.0f / _sampleCount;
+			pool.parallelFor(height, [&](int j, int) {
+				const Tap& row = rows[j];
+				for (int i = 0; i < width; i++) {
+					const Tap& column = columns[i];
+					const Vec3 top = sum(column.low, row.low) * (1.0f - column.blend) + sum(column.high, row.low) * column.blend;
+					const Vec3 bottom = sum(column.low, row.high) * (1.0f - column.blend) + sum(column.high, row.high) * column.blend;
+					framebuffer.pixel(i, j, toneMapper.pack((top * (1.0f - row.blend) + bottom * row.blend) * scale));
+				}
+			});
+		}
+
+	private:
+		int _width;
+		int _height;
+		int _sampleCount;
+		std::vector<float> _sum;
+
+		size_t index(int i, int j) const { return (static_cast<size_t>(j) * _width + i) * 3; }
+};
+
+#endif
@@ -0,0 +1,124 @@
+#pragma once
+#ifndef ADAPTIVESAMPLING_H
+#define ADAPTIVESAMPLING_H
+
+#include "framebuffer.h"
+#include "vec3.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*
+	Running statistics of the samples taken for one pixel.
+
+	Besides the sum of the samples, it tracks the mean and variance of the
+	luminance they are shown with, in 8-bit levels, with Welford's method, which
+	updates both one sample at a time without keeping the samples around. From
+	those we get the standard error of the pixel's mean: roughly how far the
+	averaged color is likely to be from the converged one. Once that is small
+	enough, more samples would not visibly change the pixel.
+
+	See: https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Welford's_online_algorithm
+*/
+class SampleStats {
+	public:
+		SampleStats() : _count(0), _mean(0), _m2(0) {}
+
+		// Add a sample's linear color, and the levels it would show up as in the image
+		void add(const Vec3& sample, const Vec3& shown) {
+			_sum += sample;
+			_count++;
+			// Rec. 709 luminance weights, so the estimate follows how bright the noise looks
+			float luminance = 0.2126f * shown.x() + 0.7152f * shown.y() + 0.0722f * shown.z();
+			float delta = luminance - _mean;
+			_mean += delta / _count;
+			_m2 += delta * (luminance - _mean);
+		}
+
+		// Getters
+		const int count() const { return _count; }
+		const Vec3 sum() const { return _sum; }
+
+		// The sample variance of the luminance, zero until there are two samples
+		float variance() const { return _count > 1 ? _m2 / (_count - 1) : 0.0f; }
+
+		// The standard error of the mean luminance, in 8-bit levels
+		float standardError() const { return _count > 0 ? std::sqrt(variance() / _count) : 0.0f; }
+
+	private:
+		Vec3 _sum;
+		int _count;
+		float _mean;
+		float _m2;
+};
+
+/*
+	The number of samples each pixel took during an adaptive render, which can be
+	turned into a heatmap to see where the sampling budget went.
+*/
+class SampleMap {
+	public:
+		SampleMap() : _width(0), _height(0) {}
+
+		void resize(int width, int height) {
+			_width = width;
+			_height = height;
+			_counts.assign(static_cast<size_t>(width) * height, 0);
+		}
+
+		// Getters
+		const int width() const { return _width; }
+		const int height() const { return _height; }
+		int count(int i, int j) const { return _counts[static_cast<size_t>(j) * _width + i]; }
+
+		void count(int i, int j, int samples) { _counts[static_cast<size_t>(j) * _width + i] = samples; }
+
+		long long total() const {
+			long long total = 0;
+			for (int samples : _counts) {
+				total += samples;
+			}
+			return total;
+		}
+
+		double average() const { return _counts.empty() ? 0.0 : static_cast<double>(total()) / _counts.size(); }
+
+		/*
+			Draw the sample counts into the framebuffer, from black for no samples through
+			blue, green and yellow up to red for maxSamples.
+		*/
+		void heatmap(Framebuffer& framebuffer, int maxSamples) const {
+			static const float ramp[5][3] = {
+				{ 0, 0, 0 },
+				{ 0, 0, 255 },
+				{ 0, 255, 0 },
+				{ 255, 255, 0 },
+				{ 255, 0, 0 }
+			};
+
+			framebuffer.resize(_width, _height);
+			for (int j = 0; j < _height; j++) {
+				for (int i = 0; i < _width; i++) {
+					float position = (std::min)(static_cast<float>(count(i, j)) / (std::max)(maxSamples, 1), 1.0f) * 4;
+					int step = (std::min)(static_cast<int>(position), 3);
+					float blend = position - step;
+					const float* low = ramp[step];
+					const float* high = ramp[step + 1];
+					framebuffer.setPixel(
+						i,
+						j,
+						low[0] + (high[0] - low[0]) * blend,
+						low[1] + (high[1] - low[1]) * blend,
+						low[2] + (high[2] - low[2]) * blend
+					);
+				}
+			}
+		}
+
+	private:
+		int _width;
+		int _height;
+		std::vector<int> _counts;
+};
+
+#endif
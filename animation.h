@@ -0,0 +1,85 @@
+#pragma once
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "rendyUtils.h"
+#include "flatScene.h"
+#include "primitives.h"
+#include "scenes.h"
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/*
+	A simple animation of the scattered-spheres scene for rendering sequences: every
+	sphere smaller than maxRadius (by default the scattered ones, not the centre
+	sphere or the ground) bounces up and down while circling the spot it started on,
+	keeping to the curve of the ground. The motion of each sphere (how high it
+	bounces, how wide it circles and how quickly) is picked at random from seed, and
+	apply works out where everything is at any time, so frames can be rendered in
+	any order.
+
+	Moving the spheres leaves the scene's BVH out of date; call FlatScene::refit
+	after apply.
+*/
+class BouncingSpheres {
+	public:
+		/*
+			Capture the spheres at their starting positions. FlatScene::build renumbers the
+			primitives, so this must come after the build; refit keeps the handles valid.
+		*/
+		BouncingSpheres(const FlatScene& scene, uint32_t seed, float maxRadius = 0.5f) {
+			Rng rng(seed);
+			for (size_t primitive = 0; primitive < scene.size(); primitive++) {
+				const PrimitiveHandle handle = scene.handle(primitive);
+				if (handle.type != FlatScene::Primitives::typeOf<SphereData>() || scene.sphere(handle).radius >= maxRadius) {
+					continue;
+				}
+				const SphereData& sphere = scene.sphere(handle);
+				Motion motion;
+				motion.handle = handle;
+				motion.start = sphere.center;
+				motion.radius = sphere.radius;
+				motion.height = sphere.radius * (1.0f + 2.0f * rng.nextFloat());
+				motion.bouncePeriod = 0.5f + rng.nextFloat();
+				motion.bouncePhase = rng.nextFloat();
+				motion.circle = 4.0f * sphere.radius * rng.nextFloat();
+				motion.circlePeriod = 2.0f + 2.0f * rng.nextFloat();
+				motion.circlePhase = 2.0f * pi * rng.nextFloat();
+				_motions.push_back(motion);
+			}
+		}
+
+		// Move every sphere to where it is time seconds into the animation
+		void apply(FlatScene& scene, float time) const {
+			for (const Motion& motion : _motions) {
+				const float angle = motion.circlePhase + 2.0f * pi * time / motion.circlePeriod;
+				const float x = motion.start.x() + motion.circle * (std::cos(angle) - std::cos(motion.circlePhase));
+				const float z = motion.start.z() + motion.circle * (std::sin(angle) - std::sin(motion.circlePhase));
+				const float bounce = std::fabs(std::sin(pi * (time / motion.bouncePeriod + motion.bouncePhase)));
+				scene.moveSphere(motion.handle, Vec3(x, groundHeight(x, z) + motion.radius + motion.height * bounce, z));
+			}
+		}
+
+		// Getters
+		const size_t size() const { return _motions.size(); }
+
+	private:
+		struct Motion {
+			PrimitiveHandle handle;
+			Vec3 start;
+			float radius;
+			// How high above the ground the sphere bounces, and how often
+			float height;
+			float bouncePeriod;
+			float bouncePhase;
+			// The radius of the circle the sphere moves around, and how long one lap takes
+			float circle;
+			float circlePeriod;
+			float circlePhase;
+		};
+
+		std::vector<Motion> _motions;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+	A monotonic (bump) allocator for data that all lives and dies together, like
+	the primitives of a scene.
+
+	Memory is handed out from large blocks by moving a pointer forward, so an
+	allocation costs a few instructions instead of a trip through the heap, and
+	objects allocated one after another sit next to each other in memory. Nothing is
+	freed on its own: releasing the arena frees every block at once. If the final
+	size is reserved up front, that is a single block and a single free.
+
+	Objects made with create whose destructors do something are destroyed when the
+	arena is released. Plain data is never touched again.
+*/
+class Arena {
+	public:
+		Arena(size_t blockSize = 64 * 1024) : _blockSize(blockSize), _blocks(nullptr), _cursor(nullptr), _end(nullptr), _destructors(nullptr), _used(0), _reserved(0) {}
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		~Arena() { release(); }
+
+		// Allocate uninitialized memory
+		void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+			char* start = align(_cursor, alignment);
+			if (_cursor == nullptr || start + bytes > _end) {
+				addBlock(bytes + alignment);
+				start = align(_cursor, alignment);
+			}
+			_cursor = start + bytes;
+			_used += bytes;
+			return start;
+		}
+
+		// Allocate space for count objects of type T, without constructing them
+		template <typename T>
+		T* allocateArray(size_t count) {
+			return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		}
+
+		// Construct an object in the arena. It is destroyed when the arena is released.
+		template <typename T, typename... Args>
+		T* create(Args&&... args) {
+			T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+			if (!std::is_trivially_destructible<T>::value) {
+				// The list of destructors to run lives in the arena too
+				Destructor* destructor = new (allocate(sizeof(Destructor), alignof(Destructor))) Destructor;
+				destructor->object = object;
+				destructor->destroy = [](void* pointer) { static_cast<T*>(pointer)->~T(); };
+				destructor->next = _destructors;
+				_destructors = destructor;
+			}
+			return object;
+		}
+
+		/*
+			Make sure the next bytes of allocations fit in the current block, so a scene whose
+			size is known up front ends up in one block
+		*/
+		void reserve(size_t bytes) {
+			if (_cursor == nullptr || static_cast<size_t>(_end - _cursor) < bytes) {
+				addBlock(bytes);
+			}
+		}
+
+		// Destroy every object made with create and free every block
+		void release() {
+			for (Destructor* destructor = _destructors; destructor != nullptr; destructor = destructor->next) {
+				destructor->destroy(destructor->object);
+			}
+			_destructors = nullptr;
+
+			while (_blocks != nullptr) {
+				Block* next = _blocks->next;
+				std::free(_blocks);
+				_blocks = next;
+			}
+			_cursor = nullptr;
+			_end = nullptr;
+			_used = 0;
+			_reserved = 0;
+		}
+
+		// Getters
+		const size_t bytesUsed() const { return _used; }
+		const size_t bytesReserved() const { return _reserved; }
+
+	private:
+		struct Block {
+			Block* next;
+		};
+
+		struct Destructor {
+			void* object;
+			void (*destroy)(void*);
+			Destructor* next;
+		};
+
+		size_t _blockSize;
+		Block* _blocks;
+		char* _cursor;
+		char* _end;
+		Destructor* _destructors;
+		size_t _used;
+		size_t _reserved;
+
+		static char* align(char* pointer, size_t alignment) {
+			uintptr_t address = reinterpret_cast<uintptr_t>(pointer);
+			return reinterpret_cast<char*>((address + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1));
+		}
+
+		/*
+			Start a new block with room for at least bytes. Blocks double in size as the
+			arena grows, so a scene built one primitive at a time needs few of them.
+		*/
+		void addBlock(size_t bytes) {
+			size_t size = (std::max)(bytes, _blockSize) + sizeof(Block) + alignof(std::max_align_t);
+			Block* block = static_cast<Block*>(std::malloc(size));
+			if (block == nullptr) {
+				throw std::bad_alloc();
+			}
+			block->next = _blocks;
+			_blocks = block;
+			_cursor = reinterpret_cast<char*>(block) + sizeof(Block);
+			_end = reinterpret_cast<char*>(block) + size;
+			_reserved += size;
+			_blockSize = (std::min)(_blockSize * 2, static_cast<size_t>(64) << 20);
+		}
+};
+
+/*
+	A growable array whose storage comes from an Arena. Growing allocates a bigger
+	array in the arena and copies the elements over; the old storage is only given
+	back when the arena is released, so reserve the final size when it is known.
+	Elements must be trivially copyable, since they are moved with memcpy.
+*/
+template <typename T>
+class ArenaArray {
+	static_assert(std::is_trivially_copyable<T>::value, "ArenaArray elements are copied with memcpy");
+
+	public:
+		ArenaArray() : _arena(nullptr), _data(nullptr), _size(0), _capacity(0) {}
+		explicit ArenaArray(Arena& arena) : _arena(&arena), _data(nullptr), _size(0), _capacity(0) {}
+
+		void reserve(size_t capacity) {
+			if (capacity <= _capacity) {
+				return;
+			}
+			T* data = _arena->allocateArray<T>(capacity);
+			if (_size > 0) {
+				std::memcpy(static_cast<void*>(data), _data, _size * sizeof(T));
+			}
+			_data = data;
+			_capacity = capacity;
+		}
+
+		void push_back(const T& value) {
+			if (_size == _capacity) {
+				reserve((std::max)(static_cast<size_t>(16), _capacity * 2));
+			}
+			new (&_data[_size++]) T(value);
+		}
+
+		// Forget the elements, keeping the storage
+		void clear() { _size = 0; }
+
+		// Getters
+		const size_t size() const { return _size; }
+		const bool empty() const { return _size == 0; }
+		T* data() { return _data; }
+		const T* data() const { return _data; }
+		T& operator[](size_t i) { return _data[i]; }
+		const T& operator[](size_t i) const { return _data[i]; }
+		const T* begin() const { return _data; }
+		const T* end() const { return _data + _size; }
+
+	private:
+		Arena* _arena;
+		T* _data;
+		size_t _size;
+		size_t _capacity;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+	A small benchmark harness for rendyBench.
+
+	Each benchmark is a function that runs the operation being measured a given
+	number of times. The harness keeps raising that number until one run takes
+	at least minTime seconds, so the clock's resolution doesn't matter, then repeats
+	the run a few times and keeps the fastest one, which is the one least disturbed
+	by the rest of the machine.
+
+	Results are printed as a table as they come in and can be written out as JSON,
+	so runs can be compared against each other over time to catch regressions.
+*/
+
+// Keep the compiler from optimizing away a value the benchmark computes but never uses
+template <typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void* sink;
+	sink = &value;
+#endif
+}
+
+struct BenchmarkResult {
+	// What was measured, for example "sphere_intersect"
+	std::string name;
+	// The problem size, for example the number of objects in the scene, or zero if there is none
+	long long size = 0;
+	// Number of operations in the fastest run, and how long it took
+	long long operations = 0;
+	double seconds = 0;
+	// Rays traced per operation, zero if the benchmark doesn't trace rays
+	double raysPerOperation = 0;
+
+	double nsPerOperation() const { return operations > 0 ? seconds * 1e9 / operations : 0.0; }
+	double megaRaysPerSecond() const { return seconds > 0 ? raysPerOperation * operations / seconds * 1e-6 : 0.0; }
+};
+
+class BenchmarkRunner {
+	public:
+		BenchmarkRunner(double minTime = 0.2, int repetitions = 3, const std::string& filter = "", std::FILE* table = stdout)
+			: _minTime(minTime), _repetitions(repetitions), _filter(filter), _table(table) {}
+
+		// Whether the filter lets the benchmark run, so expensive setup can be skipped too
+		bool enabled(const std::string& name) const { return _filter.empty() || name.find(_filter) != std::string::npos; }
+
+		/*
+			Time body(operations), which must perform the operation that many times.
+			raysPerOperation is how many rays one operation traces, if any. Benchmarks
+			whose name doesn't contain the filter are skipped.
+		*/
+		template <typename Body>
+		void run(const std::string& name, long long size, double raysPerOperation, Body&& body) {
+			if (!enabled(name)) {
+				return;
+			}
+
+			// Warm up the caches and find how many operations fill minTime
+			long long operations = 1;
+			while (true) {
+				double seconds = time(body, operations);
+				if (seconds >= _minTime || operations >= (1LL << 40)) {
+					break;
+				}
+				// Jump most of the way there when the run was long enough to measure
+				long long estimate = seconds > 1e-4 ? static_cast<long long>(operations * _minTime / seconds * 1.1) : 0;
+				operations = (std::max)(operations * 2, estimate);
+			}
+
+			BenchmarkResult result;
+			result.name = name;
+			result.size = size;
+			result.operations = operations;
+			result.raysPerOperation = raysPerOperation;
+			result.seconds = time(body, operations);
+			for (int repetition = 1; repetition < _repetitions; repetition++) {
+				result.seconds = (std::min)(result.seconds, time(body, operations));
+			}
+
+			_results.push_back(result);
+			print(result);
+		}
+
+		// Getters
+		const std::vector<BenchmarkResult>& results() const { return _results; }
+
+		// Write every result as JSON, along with a description of the machine that ran them
+		bool writeJson(std::FILE* file, const std::string& context) const {
+			std::fprintf(file, "{\n  \"context\": %s,\n  \"benchmarks\": [\n", context.c_str());
+			for (size_t n = 0; n < _results.size(); n++) {
+				const BenchmarkResult& result = _results[n];
+				std::fprintf(
+					file,
+					"    {\"name\": \"%s\", \"size\": %lld, \"operations\": %lld, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"mrays_per_second\": %.3f}%s\n",
+					result.name.c_str(),
+					result.size,
+					result.operations,
+					result.seconds,
+					result.nsPerOperation(),
+					result.megaRaysPerSecond(),
+					n + 1 < _results.size() ? "," : ""
+				);
+			}
+			std::fprintf(file, "  ]\n}\n");
+			return std::ferror(file) == 0;
+		}
+
+	private:
+		double _minTime;
+		int _repetitions;
+		std::string _filter;
+		std::FILE* _table;
+		std::vector<BenchmarkResult> _results;
+
+		template <typename Body>
+		static double time(Body& body, long long operations) {
+			auto start = std::chrono::steady_clock::now();
+			body(operations);
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+
+		void print(const BenchmarkResult& result) const {
+			if (result.raysPerOperation > 0) {
+				std::fprintf(_table, "%-32s %10lld %16.1f ns/op %10.2f Mrays/s\n", result.name.c_str(), result.size, result.nsPerOperation(), result.megaRaysPerSecond());
+			} else {
+				std::fprintf(_table, "%-32s %10lld %16.1f ns/op\n", result.name.c_str(), result.size, result.nsPerOperation());
+			}
+			std::fflush(_table);
+		}
+};
+
+#endif
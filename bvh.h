@@ -0,0 +1,562 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include "rendyUtils.h"
+#include "renderStats.h"
+#include "aabb.h"
+#include "rayPacket.h"
+#include "surface.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <future>
+#include <thread>
+#include <vector>
+
+/*
+	A node of a bounding volume hierarchy. Nodes are stored in one flat array, and the
+	two children of an interior node are always stored next to each other, so a node
+	only needs the index of its left child.
+*/
+struct BVHNode {
+	AABB bounds;
+	// For a leaf, the first entry in the primitive index list. For an interior node,
+	// the index of the left child; the right child is at offset + 1.
+	int offset;
+	// Number of primitives in a leaf, zero for an interior node
+	int count;
+};
+
+/*
+	A bounding volume hierarchy over any set of primitives that can report an AABB.
+
+	The tree only knows about primitive indices, so the same builder and traversal
+	serve the scene-level BVH over Surfaces as well as anything else that needs one.
+	The caller supplies a callback that intersects a single primitive during traversal.
+
+	The tree is built top down with the binned surface area heuristic (SAH): at each
+	node the primitive centroids are dropped into a fixed number of bins per axis, and
+	the split between bins that minimises the expected cost of tracing a ray through
+	the two children is chosen. Large subtrees are built on separate threads.
+
+	See: https://www.pbr-book.org/3ed-2018/Primitives_and_Intersection_Acceleration/Bounding_Volume_Hierarchies
+	and: Wald, "On fast Construction of SAH-based Bounding Volume Hierarchies" (2007)
+*/
+class BVHTree {
+	public:
+		static const int binCount = 16;
+		static const int maxLeafSize = 8;
+		static const int stackSize = 128;
+		// Subtrees with fewer primitives than this are never handed to another thread
+		static const int parallelThreshold = 4096;
+
+		BVHTree() {}
+		BVHTree(const BVHTree& other) : _nodes(other._nodes), _primitives(other._primitives) {}
+		BVHTree(BVHTree&& other) noexcept : _nodes(std::move(other._nodes)), _primitives(std::move(other._primitives)) {}
+		BVHTree& operator=(const BVHTree& other) {
+			_nodes = other._nodes;
+			_primitives = other._primitives;
+			return *this;
+		}
+		BVHTree& operator=(BVHTree&& other) noexcept {
+			_nodes = std::move(other._nodes);
+			_primitives = std::move(other._primitives);
+			return *this;
+		}
+
+		/*
+			Build the tree over the primitives whose bounds are given. buildThreads is the
+			number of threads to build with, zero or less means one per hardware thread.
+		*/
+		void build(const std::vector<AABB>& primitiveBounds, int buildThreads = 0) {
+			const int count = static_cast<int>(primitiveBounds.size());
+			_nodes.clear();
+			_primitives.clear();
+			if (count == 0) {
+				return;
+			}
+
+			/*
+				The builder partitions copies of the primitives' bounds and centroids in place,
+				rather than a list of indices into them, so that every pass over a node's
+				primitives reads memory in order. On scenes with millions of primitives,
+				chasing indices into the original arrays made the build wait on cache misses.
+			*/
+			std::vector<BuildPrimitive> primitives(count);
+			for (int i = 0; i < count; i++) {
+				primitives[i].bounds = primitiveBounds[i];
+				primitives[i].centroid = primitiveBounds[i].centroid();
+				primitives[i].index = i;
+			}
+
+			// A binary tree with at least one primitive per leaf has at most 2n - 1 nodes
+			_nodes.resize(2 * static_cast<size_t>(count) - 1);
+			_nodeCount = 1;
+
+			if (buildThreads <= 0) {
+				buildThreads = (std::max)(1u, std::thread::hardware_concurrency());
+			}
+			int spawnDepth = 0;
+			while ((1 << spawnDepth) < buildThreads) {
+				spawnDepth++;
+			}
+
+			buildNode(0, 0, count, 0, spawnDepth, primitives);
+			// Leaves hold up to maxLeafSize primitives, so most of the room for 2n - 1 nodes goes unused
+			_nodes.resize(_nodeCount);
+			_nodes.shrink_to_fit();
+
+			_primitives.resize(count);
+			for (int i = 0; i < count; i++) {
+				_primitives[i] = primitives[i].index;
+			}
+		}
+
+		/*
+			Find the closest primitive hit by the ray inside rayT.
+
+			intersectPrimitive(int primitive, Interval rayT, float& t) must test a single
+			primitive against the ray within rayT, and on a hit store the distance in t and
+			return true. It is only ever called with intervals that end at the closest hit
+			found so far, so each hit it reports is closer than the last.
+		*/
+		template <typename IntersectPrimitive>
+		bool traverse(const Ray& r, Interval rayT, IntersectPrimitive&& intersectPrimitive) const {
+			return traverseLeaves(r, rayT, [&](int begin, int end, Interval leafT, float& t) {
+				bool hit = false;
+				for (int i = begin; i < end; i++) {
+					float primitiveT;
+					if (intersectPrimitive(_primitives[i], Interval(leafT.min, hit ? t : leafT.max), primitiveT)) {
+						hit = true;
+						t = primitiveT;
+					}
+				}
+				return hit;
+			});
+		}
+
+		/*
+			Like traverse, but hands over a whole leaf at a time, for callers that store their
+			primitives in the tree's order and can test a leaf's primitives together.
+
+			intersectLeaf(int begin, int end, Interval rayT, float& t) must find the closest
+			hit within rayT among the primitives at positions [begin, end) of primitives(),
+			and on a hit store its distance in t and return true.
+		*/
+		template <typename IntersectLeaf>
+		bool traverseLeaves(const Ray& r, Interval rayT, IntersectLeaf&& intersectLeaf) const {
+			if (_nodes.empty()) {
+				return false;
+			}
+
+			const Vec3 origin = r.origin();
+			const Vec3 direction = r.direction();
+			const Vec3 invDirection(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+
+			float closest = rayT.max;
+			bool hitAnything = false;
+			float tEntry;
+			if (!_nodes[0].bounds.hit(origin, invDirection, rayT.min, closest, tEntry)) {
+				return false;
+			}
+
+			// Nodes still to visit, with the distance at which the ray enters them
+			int stack[stackSize];
+			float stackEntry[stackSize];
+			int stackTop = 0;
+			int node = 0;
+
+			while (true) {
+				const BVHNode& current = _nodes[node];
+				RENDY_STAT(bvhNodeVisits);
+				if (current.count > 0) {
+					float t;
+					if (intersectLeaf(current.offset, current.offset + current.count, Interval(rayT.min, closest), t)) {
+						hitAnything = true;
+						closest = t;
+					}
+				} else {
+					// Visit the nearer child first so the far one is more likely to be culled
+					int left = current.offset;
+					int right = current.offset + 1;
+					float tLeft, tRight;
+					bool hitLeft = _nodes[left].bounds.hit(origin, invDirection, rayT.min, closest, tLeft);
+					bool hitRight = _nodes[right].bounds.hit(origin, invDirection, rayT.min, closest, tRight);
+
+					if (hitLeft && hitRight) {
+						if (tRight < tLeft) {
+							std::swap(left, right);
+							std::swap(tLeft, tRight);
+						}
+						stack[stackTop] = right;
+						stackEntry[stackTop] = tRight;
+						stackTop++;
+						node = left;
+						continue;
+					} else if (hitLeft) {
+						node = left;
+						continue;
+					} else if (hitRight) {
+						node = right;
+						continue;
+					}
+				}
+
+				// Pop the next node, skipping any that start beyond the closest hit
+				bool found = false;
+				while (stackTop > 0) {
+					stackTop--;
+					if (stackEntry[stackTop] <= closest) {
+						node = stack[stackTop];
+						found = true;
+						break;
+					}
+				}
+				if (!found) {
+					break;
+				}
+			}
+
+			return hitAnything;
+		}
+
+		/*
+			Traverse the tree with a whole packet of rays. A node is visited once for all
+			lanes whose rays pass through it, and the lanes that missed it are masked off
+			for its subtree.
+
+			closest[l] starts as the end of lane l's interval and is narrowed as hits are
+			found. intersectPrimitive(int primitive, uint32_t laneMask, float* closest) must
+			test the primitive against the lanes in laneMask, each within
+			(packet.tMin[l], closest[l]), and lower closest[l] for every lane it hits.
+		*/
+		template <typename IntersectPrimitive>
+		void traversePacket(const RayPacket& packet, float* closest, IntersectPrimitive&& intersectPrimitive) const {
+			if (_nodes.empty()) {
+				return;
+			}
+
+			float tEntry;
+			uint32_t rootMask = packet.hitBox(_nodes[0].bounds, packet.activeMask, closest, tEntry);
+			if (!rootMask) {
+				return;
+			}
+
+			int stack[stackSize];
+			uint32_t stackMask[stackSize];
+			int stackTop = 0;
+			int node = 0;
+			uint32_t mask = rootMask;
+
+			while (true) {
+				const BVHNode& current = _nodes[node];
+				RENDY_STAT(bvhNodeVisits);
+				if (current.count > 0) {
+					for (int i = current.offset; i < current.offset + current.count; i++) {
+						intersectPrimitive(_primitives[i], mask, closest);
+					}
+				} else {
+					int left = current.offset;
+					int right = current.offset + 1;
+					float tLeft, tRight;
+					uint32_t leftMask = packet.hitBox(_nodes[left].bounds, mask, closest, tLeft);
+					uint32_t rightMask = packet.hitBox(_nodes[right].bounds, mask, closest, tRight);
+
+					if (leftMask && rightMask) {
+						// Go into the child that the packet reaches first
+						if (tRight < tLeft) {
+							std::swap(left, right);
+							std::swap(leftMask, rightMask);
+						}
+						stack[stackTop] = right;
+						stackMask[stackTop] = rightMask;
+						stackTop++;
+						node = left;
+						mask = leftMask;
+						continue;
+					} else if (leftMask) {
+						node = left;
+						mask = leftMask;
+						continue;
+					} else if (rightMask) {
+						node = right;
+						mask = rightMask;
+						continue;
+					}
+				}
+
+				if (stackTop == 0) {
+					break;
+				}
+				stackTop--;
+				node = stack[stackTop];
+				mask = stackMask[stackTop];
+			}
+		}
+
+		/*
+			Once the caller has reordered its own primitives to match primitives(), make the
+			tree refer to them by their new positions, so primitives()[i] is i.
+		*/
+		void renumberPrimitives() {
+			for (size_t i = 0; i < _primitives.size(); i++) {
+				_primitives[i] = static_cast<int>(i);
+			}
+		}
+
+		/*
+			Fit the tree to primitives that have moved, keeping its shape. primitiveBounds
+			holds the new bounds of every primitive, indexed as for build. A leaf takes the
+			union of its primitives' bounds and an interior node the union of its children's,
+			and the build always places a node's children after it, so one pass backwards
+			over the nodes updates everything bottom-up.
+
+			This is far quicker than building again, but the splits were chosen for where
+			the primitives were, so the tree gets slower the further they move.
+		*/
+		void refit(const std::vector<AABB>& primitiveBounds) {
+			for (int node = static_cast<int>(_nodes.size()) - 1; node >= 0; node--) {
+				BVHNode& current = _nodes[node];
+				if (current.count > 0) {
+					AABB bounds;
+					for (int i = current.offset; i < current.offset + current.count; i++) {
+						bounds.expand(primitiveBounds[_primitives[i]]);
+					}
+					current.bounds = bounds;
+				} else {
+					current.bounds = AABB(_nodes[current.offset].bounds, _nodes[current.offset + 1].bounds);
+				}
+			}
+		}
+
+		// Getters
+		const std::vector<BVHNode>& nodes() const { return _nodes; }
+		const std::vector<int>& primitives() const { return _primitives; }
+		AABB bounds() const { return _nodes.empty() ? AABB() : _nodes[0].bounds; }
+
+	private:
+		std::vector<BVHNode> _nodes;
+		std::vector<int> _primitives;
+		std::atomic<int> _nodeCount{ 0 };
+
+		struct BuildPrimitive {
+			AABB bounds;
+			Vec3 centroid;
+			int index;
+		};
+
+		struct Bin {
+			AABB bounds;
+			int count = 0;
+		};
+
+		void buildNode(
+			int node,
+			int begin,
+			int end,
+			int depth,
+			int spawnDepth,
+			std::vector<BuildPrimitive>& primitives
+		) {
+			AABB bounds, centroidBounds;
+			for (int i = begin; i < end; i++) {
+				bounds.expand(primitives[i].bounds);
+				centroidBounds.expand(primitives[i].centroid);
+			}
+			_nodes[node].bounds = bounds;
+
+			const int count = end - begin;
+			if (count == 1) {
+				makeLeaf(node, begin, count);
+				return;
+			}
+
+			// Drop every primitive into its bin on all three axes in a single pass over them
+			Bin bins[3][binCount];
+			float scales[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const float size = centroidBounds.axis(axis).size();
+				scales[axis] = size > 0 ? binCount / size : 0.0f;
+			}
+			for (int i = begin; i < end; i++) {
+				const BuildPrimitive& primitive = primitives[i];
+				for (int axis = 0; axis < 3; axis++) {
+					Bin& bin = bins[axis][binIndex(primitive.centroid[axis], centroidBounds.axis(axis).min, scales[axis])];
+					bin.count++;
+					bin.bounds.expand(primitive.bounds);
+				}
+			}
+
+			// Find the cheapest split between bins across all three axes
+			float bestCost = infinity;
+			int bestAxis = -1;
+			int bestSplit = 0;
+			for (int axis = 0; axis < 3; axis++) {
+				if (scales[axis] == 0) {
+					continue;
+				}
+
+				// Sweep from the right to get the cost of everything right of each split...
+				float rightArea[binCount];
+				int rightCount[binCount];
+				AABB rightBounds;
+				int rightSum = 0;
+				for (int bin = binCount - 1; bin > 0; bin--) {
+					rightBounds.expand(bins[axis][bin].bounds);
+					rightSum += bins[axis][bin].count;
+					rightArea[bin] = rightBounds.surfaceArea();
+					rightCount[bin] = rightSum;
+				}
+
+				// ...then sweep from the left and combine. Split s puts bins [0, s) on the left.
+				AABB leftBounds;
+				int leftSum = 0;
+				for (int split = 1; split < binCount; split++) {
+					leftBounds.expand(bins[axis][split - 1].bounds);
+					leftSum += bins[axis][split - 1].count;
+					if (leftSum == 0 || rightCount[split] == 0) {
+						continue;
+					}
+					float cost = leftBounds.surfaceArea() * leftSum + rightArea[split] * rightCount[split];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = split;
+					}
+				}
+			}
+
+			/*
+				A ray that reaches this node costs one traversal step plus the expected number
+				of primitive tests in each child, weighted by the chance of entering that child.
+				Make a leaf instead when testing every primitive here would be cheaper.
+			*/
+			const float area = bounds.surfaceArea();
+			const float splitCost = area > 0 ? 1.0f + bestCost / area : infinity;
+			if (bestAxis < 0 || splitCost >= count) {
+				if (count <= maxLeafSize) {
+					makeLeaf(node, begin, count);
+					return;
+				}
+			}
+
+			int middle;
+			if (bestAxis >= 0 && depth < stackSize / 2) {
+				const Interval& extent = centroidBounds.axis(bestAxis);
+				const float scale = binCount / extent.size();
+				BuildPrimitive* split = std::partition(primitives.data() + begin, primitives.data() + end, [&](const BuildPrimitive& primitive) {
+					return binIndex(primitive.centroid[bestAxis], extent.min, scale) < bestSplit;
+				});
+				middle = static_cast<int>(split - primitives.data());
+			} else {
+				middle = begin;
+			}
+
+			// If binning couldn't separate the primitives, or the tree is getting too deep to
+			// traverse, fall back to splitting the primitives in half along the longest axis
+			if (middle == begin || middle == end) {
+				const int axis = centroidBounds.longestAxis();
+				middle = begin + count / 2;
+				std::nth_element(primitives.data() + begin, primitives.data() + middle, primitives.data() + end, [&](const BuildPrimitive& a, const BuildPrimitive& b) {
+					return a.centroid[axis] < b.centroid[axis];
+				});
+			}
+
+			const int children = _nodeCount.fetch_add(2);
+			_nodes[node].offset = children;
+			_nodes[node].count = 0;
+
+			if (spawnDepth > 0 && count >= parallelThreshold) {
+				auto left = std::async(std::launch::async, [&, children, begin, middle, depth, spawnDepth] {
+					buildNode(children, begin, middle, depth + 1, spawnDepth - 1, primitives);
+				});
+				buildNode(children + 1, middle, end, depth + 1, spawnDepth - 1, primitives);
+				left.get();
+			} else {
+				buildNode(children, begin, middle, depth + 1, 0, primitives);
+				buildNode(children + 1, middle, end, depth + 1, 0, primitives);
+			}
+		}
+
+		void makeLeaf(int node, int begin, int count) {
+			_nodes[node].offset = begin;
+			_nodes[node].count = count;
+		}
+
+		static int binIndex(float centroid, float min, float scale) {
+			int bin = static_cast<int>((centroid - min) * scale);
+			return bin < 0 ? 0 : (bin >= binCount ? binCount - 1 : bin);
+		}
+};
+
+/*
+	A Surface that holds other surfaces in a BVH, so a ray only tests the objects
+	whose bounding boxes it passes through instead of every object in the scene.
+*/
+class BVH : public Surface {
+	public:
+		BVH() {}
+
+		BVH(const SurfaceList& list, int buildThreads = 0) : _objects(list.objects) {
+			std::vector<AABB> bounds;
+			bounds.reserve(_objects.size());
+			for (const auto& object : _objects) {
+				bounds.push_back(object->boundingBox());
+			}
+			_tree.build(bounds, buildThreads);
+		}
+
+		// The objects' hits are passed on as they are, for the objects to finish
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			return _tree.traverse(r, rayT, [&](int primitive, Interval interval, float& t) {
+				if (_objects[primitive]->closestHit(r, interval, hit)) {
+					t = hit.t;
+					return true;
+				}
+				return false;
+			});
+		}
+
+		void hitAttributes(const Ray&, const Hit&, Intersection&) const override {
+			assert(false && "BVH passes its objects' hits on");
+			std::abort();
+		}
+
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			float closest[RayPacket::size];
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				closest[lane] = packet.tMax[lane];
+			}
+
+			// Each primitive sees only the lanes that reached its leaf, each cut off at its closest hit so far
+			RayPacket narrowed = packet;
+			_tree.traversePacket(packet, closest, [&](int primitive, uint32_t laneMask, float* laneClosest) {
+				narrowed.activeMask = laneMask;
+				for (int lane = 0; lane < RayPacket::size; lane++) {
+					narrowed.tMax[lane] = laneClosest[lane];
+				}
+				uint32_t before = hits.hitMask;
+				hits.hitMask = 0;
+				_objects[primitive]->closestHitPacket(narrowed, hits);
+				for (int lane = 0; lane < RayPacket::size; lane++) {
+					if (hits.hit(lane)) {
+						laneClosest[lane] = hits.closest[lane].t;
+					}
+				}
+				hits.hitMask |= before;
+			});
+		}
+
+		AABB boundingBox() const override { return _tree.bounds(); }
+
+		const BVHTree& tree() const { return _tree; }
+
+	private:
+		std::vector<std::shared_ptr<Surface>> _objects;
+		BVHTree _tree;
+};
+
+#endif
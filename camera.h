@@ -3,10 +3,77 @@
 #define CAMERA_H
 
 #include "rendyUtils.h"
+#include "accumulationBuffer.h"
+#include "adaptiveSampling.h"
+#include "featureBuffer.h"
+#include "framebuffer.h"
 #include "pixel.h"
+#include "sampler.h"
+#include "stopToken.h"
+#include "threadPool.h"
+#include "toneMapper.h"
 #include "viewport.h"
-#include <windows.h>
-#include <tchar.h>
+#include "wavefront.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
+/*
+	Settings that control how a frame is rendered
+*/
+struct RenderSettings {
+	// Number of anti-aliasing samples per pixel
+	int aliasSamples = 10;
+	// Maximum number of bounces per ray
+	int maxDepth = 10;
+	// Bounces before Russian roulette may end a path early, negative to always trace to maxDepth
+	int rouletteDepth = 3;
+	// Width and height in pixels of the tiles handed to the thread pool
+	int tileSize = 32;
+	// Number of render threads, zero or less means one per hardware thread
+	int threadCount = 0;
+	// Seed mixed into every random number so different frames can use different noise
+	uint32_t seed = 0;
+	// Trace the camera rays of each 4x4 block of pixels together as a RayPacket
+	bool packetTracing = true;
+	// Trace the paths of each tile a bounce at a time, all together, instead of one after
+	// another (see wavefront.h)
+	bool wavefront = false;
+	// Adaptive sampling stops a pixel once the standard error of its mean drops below
+	// this many 8-bit levels, zero gives every pixel exactly aliasSamples samples
+	float adaptiveThreshold = 0;
+	// With adaptive sampling, every pixel takes at least minSamples and at most maxSamples
+	int minSamples = 16;
+	int maxSamples = 128;
+	// Where the random numbers for the point in the pixel and the bounces come from (see sampler.h)
+	SamplerType sampler = SamplerType::Sobol;
+	// How the averaged linear light of a pixel becomes 8-bit levels (see toneMapper.h)
+	float exposure = 1.0f;
+	float gamma = 2.0f;
+};
+
+/*
+	A tile the render has finished, the pixels [x0, x1) x [y0, y1), and how far along
+	the render is: tilesDone of its tileCount tiles are finished, this one included
+*/
+struct TileProgress {
+	int x0, y0, x1, y1;
+	int tilesDone;
+	int tileCount;
+};
+
+/*
+	Lets whoever started a render stop it early and follow it tile by tile.
+
+	Every tile checks stop before it starts, and once a stop is requested the tiles
+	that haven't started are skipped, so the render returns as soon as the tiles already
+	being traced are done. tileDone is called for every finished tile, on the thread
+	that rendered it, so it must be safe to call from several threads at once.
+*/
+struct RenderControl {
+	StopToken stop;
+	std::function<void(const TileProgress&)> tileDone;
+};
 
 class Camera {
 	private:
@@ -35,63 +102,447 @@ class Camera {
 		const int imageHeight() const { return _viewport.imageHeight(); }
 		const Vec3 cameraCenter() const { return _cameraCenter; }
 
-		void render(
-			const int aliasSamples,
-			const int maxDepth,
-			Surface& sceneObjects,
-			HDC hdc
-		) {
-			for (int j = 0; j < _viewport.imageHeight(); j++) {
-				for (int i = 0; i < _viewport.imageWidth(); i++) {
-					/*
-						the center of the pixel is calculated by multiplying our deltas for x and y
-						by our offsets and adding to the center of the first pixel in the grid
-					*/
-					Vec3 pixelCenter = _viewport.firstPixelLocation() + (_viewport.pixelDeltaU() * i) + (_viewport.pixelDeltaV() * j);
+		/*
+			Render the scene into the framebuffer. The framebuffer is resized to match
+			the viewport, so the caller can reuse the same buffer across renders.
+
+			The image is split into square tiles of settings.tileSize pixels which are
+			rendered in parallel on the thread pool. Returns false if control stopped the
+			render, leaving the tiles it skipped out of the framebuffer.
+		*/
+		bool render(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			Framebuffer& framebuffer,
+			ThreadPool& pool,
+			const RenderControl& control = RenderControl()
+		) const {
+			framebuffer.resize(_viewport.imageWidth(), _viewport.imageHeight());
+			const ToneMapper toneMapper(settings.exposure, settings.gamma);
+
+			return forEachTile(settings, pool, control, [&](int x0, int y0, int x1, int y1) {
+				traceTile(settings, sceneObjects, x0, y0, x1, y1, 0, settings.aliasSamples, [&](int i, int j, const Vec3& sum) {
 					/*
-						our ray's direction is determined by subtracting our camera center, or eye
-						from the location of the pixel we are currently painting
+						Store the averaged color of the pixel in the framebuffer
 					*/
-					Vec3 rayDirection = pixelCenter - _cameraCenter;
+					Vec3 aaColor = antiAlias(settings.aliasSamples, sum);
+					framebuffer.pixel(i, j, toneMapper.pack(aaColor));
+				});
+			});
+		}
+
+		// Render with a thread pool that only lives for this frame
+		void render(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			Framebuffer& framebuffer
+		) const {
+			ThreadPool pool(settings.threadCount);
+			render(settings, sceneObjects, framebuffer, pool);
+		}
+
+		/*
+			Render the scene with adaptive sampling. Instead of settings.aliasSamples
+			samples everywhere, every pixel takes settings.minSamples samples and then keeps
+			sampling until the standard error of its mean is below settings.adaptiveThreshold,
+			or it reaches settings.maxSamples. Flat regions like the sky stop almost right away,
+			which leaves the budget for noisy regions like the soft shadows under the spheres.
+
+			sampleMap receives the number of samples each pixel took. Pixels stop sampling
+			at different times, so camera rays are traced one at a time rather than in packets.
+			Returns false if control stopped the render.
+		*/
+		bool renderAdaptive(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			Framebuffer& framebuffer,
+			SampleMap& sampleMap,
+			ThreadPool& pool,
+			const RenderControl& control = RenderControl()
+		) const {
+			framebuffer.resize(_viewport.imageWidth(), _viewport.imageHeight());
+			sampleMap.resize(_viewport.imageWidth(), _viewport.imageHeight());
+			const ToneMapper toneMapper(settings.exposure, settings.gamma);
+			// The variance needs at least two samples to mean anything
+			const int minSamples = (std::max)(settings.minSamples, 2);
+			const int maxSamples = (std::max)(settings.maxSamples, minSamples);
+
+			return forEachTile(settings, pool, control, [&](int x0, int y0, int x1, int y1) {
+				for (int j = y0; j < y1; j++) {
+					for (int i = x0; i < x1; i++) {
+						Vec3 pixelCenter = this->pixelCenter(i, j);
+						SampleStats stats;
+						for (int sample = 0; sample < maxSamples; sample++) {
+							startSample(settings, i, j, sample, maxSamples);
+							Ray r = getRay(pixelCenter);
+							Pixel pixel = Pixel(settings.maxDepth, settings.rouletteDepth, sceneObjects, r, i, j);
+							// The noise is measured in the levels the pixel will be shown with
+							stats.add(pixel.getColorVector(), toneMapper.levels(pixel.getColorVector()));
+							if (stats.count() >= minSamples && stats.standardError() < settings.adaptiveThreshold) {
+								break;
+							}
+						}
+
+						Vec3 aaColor = antiAlias(stats.count(), stats.sum());
+						framebuffer.pixel(i, j, toneMapper.pack(aaColor));
+						sampleMap.count(i, j, stats.count());
+					}
+				}
+			});
+		}
+
+		/*
+			Add sampleCount more samples to every pixel of the accumulation buffer, which is
+			resized (and cleared) if it doesn't match the viewport. Samples are numbered on
+			from the ones already accumulated, so refining an image a few samples at a time
+			gives exactly the image that rendering all the samples at once would.
+
+			If features is given, the normal and depth each camera ray hit are added to it
+			as well, for the denoiser. It is resized in the same way.
+
+			Returns false if control stopped the render. Only some of the pixels have the
+			new samples then, so the buffers are no use until they are cleared.
+		*/
+		bool accumulate(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			AccumulationBuffer& accumulation,
+			int sampleCount,
+			ThreadPool& pool,
+			FeatureBuffer* features = nullptr,
+			const RenderControl& control = RenderControl()
+		) const {
+			if (accumulation.width() != _viewport.imageWidth() || accumulation.height() != _viewport.imageHeight()) {
+				accumulation.resize(_viewport.imageWidth(), _viewport.imageHeight());
+			}
+			if (features && (features->width() != _viewport.imageWidth() || features->height() != _viewport.imageHeight())) {
+				features->resize(_viewport.imageWidth(), _viewport.imageHeight());
+			}
+
+			const int firstSample = accumulation.sampleCount();
+			const bool finished = forEachTile(settings, pool, control, [&](int x0, int y0, int x1, int y1) {
+				traceTile(settings, sceneObjects, x0, y0, x1, y1, firstSample, sampleCount, [&](int i, int j, const Vec3& sum) {
+					accumulation.add(i, j, sum);
+				}, features);
+			});
+			if (!finished) {
+				return false;
+			}
+			accumulation.addSamples(sampleCount);
+			if (features) {
+				features->addSamples(sampleCount);
+			}
+			return true;
+		}
+
+		/*
+			Run tileFunction(x0, y0, x1, y1) for every tile of the image on the thread pool,
+			skipping the tiles that would start after control asks to stop, and report each
+			one that finishes to control.tileDone. Returns true if every tile was run.
+		*/
+		template <typename TileFunction>
+		bool forEachTile(const RenderSettings& settings, ThreadPool& pool, const RenderControl& control, TileFunction&& tileFunction) const {
+			const int tileSize = (std::max)(settings.tileSize, 1);
+			const int tilesX = (_viewport.imageWidth() + tileSize - 1) / tileSize;
+			const int tilesY = (_viewport.imageHeight() + tileSize - 1) / tileSize;
+			const int tileCount = tilesX * tilesY;
+			std::atomic<int> tilesDone{ 0 };
+
+			pool.parallelFor(tileCount, [&](int tile, int) {
+				if (control.stop.stopRequested()) {
+					return;
+				}
+				TileProgress progress;
+				progress.x0 = (tile % tilesX) * tileSize;
+				progress.y0 = (tile / tilesX) * tileSize;
+				progress.x1 = (std::min)(progress.x0 + tileSize, _viewport.imageWidth());
+				progress.y1 = (std::min)(progress.y0 + tileSize, _viewport.imageHeight());
+				tileFunction(progress.x0, progress.y0, progress.x1, progress.y1);
+				progress.tilesDone = ++tilesDone;
+				progress.tileCount = tileCount;
+				if (control.tileDone) {
+					control.tileDone(progress);
+				}
+			});
+			return tilesDone == tileCount;
+		}
+
+		/*
+			Trace samples [firstSample, firstSample + sampleCount) of every pixel in
+			[x0, x1) x [y0, y1), and call store(i, j, sum) with the sum of each pixel's samples.
+			If features is given, every sample's camera ray is also added to it.
+		*/
+		template <typename Store>
+		void traceTile(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			int x0,
+			int y0,
+			int x1,
+			int y1,
+			int firstSample,
+			int sampleCount,
+			Store&& store,
+			FeatureBuffer* features = nullptr
+		) const {
+			if (settings.wavefront) {
+				traceTileWavefront(settings, sceneObjects, x0, y0, x1, y1, firstSample, sampleCount, store, features);
+				return;
+			}
+			if (settings.packetTracing) {
+				traceTilePackets(settings, sceneObjects, x0, y0, x1, y1, firstSample, sampleCount, store, features);
+				return;
+			}
+
+			for (int j = y0; j < y1; j++) {
+				for (int i = x0; i < x1; i++) {
+					Vec3 pixelCenter = this->pixelCenter(i, j);
 					/*
 						do our AA sampling passes
 					*/
 					Vec3 aaColor = Vec3(0, 0, 0);
-					for (int sample = 0; sample < aliasSamples; sample++) {
+					for (int sample = firstSample; sample < firstSample + sampleCount; sample++) {
+						/*
+						seed the random numbers for this sample so the result doesn't depend
+						on which thread renders the tile
+						*/
+						startSample(settings, i, j, sample, settings.aliasSamples);
 						/*
 						we create our ray with the origin being camera center, or eye, and the
-						direction being what we just calculated above
+						direction being towards a random point inside the pixel
 						*/
 						Ray r = getRay(pixelCenter);
-						Pixel pixel = Pixel(maxDepth, sceneObjects, r, i, j);
+						if (features) {
+							// Intersect the camera ray here so its hit can be recorded too
+							Intersection sect;
+							bool hit = sceneObjects.intersect(r, Interval(0.001, infinity), sect);
+							Pixel pixel = Pixel(settings.maxDepth, settings.rouletteDepth, sceneObjects, r, hit, sect, i, j);
+							features->add(i, j, r, hit, sect, pixel.getColorVector());
+							aaColor += pixel.getColorVector();
+							continue;
+						}
+						Pixel pixel = Pixel(settings.maxDepth, settings.rouletteDepth, sceneObjects, r, i, j);
 						aaColor += pixel.getColorVector();
 					}
-					aaColor = antiAlias(aliasSamples, aaColor);
-					/*
-						Perform the coloring calculation for the pixel in the Color constructor
-						and get the Window COLORREF using the getColorRef method
-					*/
-					COLORREF ref = RGB(aaColor.x(), aaColor.y(), aaColor.z());
-					/*
-						Set the color of the pixel in the window using the COLORREF
-					*/
-					SetPixel(hdc, i, j, ref);
+					store(i, j, aaColor);
 				}
 			}
 		}
 
+		/*
+			Trace the tile in blocks of RayPacket::width x RayPacket::width pixels. For each
+			sample, the camera rays of the whole block are intersected with the scene as one
+			packet, and then each pixel follows its own diffuse bounces with single rays,
+			since those scatter in all directions and no longer travel together.
+
+			Every pixel uses the same random numbers as in the single ray path, so both
+			paths render the same image.
+		*/
+		template <typename Store>
+		void traceTilePackets(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			int x0,
+			int y0,
+			int x1,
+			int y1,
+			int firstSample,
+			int sampleCount,
+			Store&& store,
+			FeatureBuffer* features = nullptr
+		) const {
+			const int width = RayPacket::width;
+			for (int blockY = y0; blockY < y1; blockY += width) {
+				for (int blockX = x0; blockX < x1; blockX += width) {
+					Vec3 aaColor[RayPacket::size];
+					for (int sample = firstSample; sample < firstSample + sampleCount; sample++) {
+						RayPacket packet;
+						Ray rays[RayPacket::size];
+						for (int lane = 0; lane < RayPacket::size; lane++) {
+							int i = blockX + lane % width;
+							int j = blockY + lane / width;
+							if (i < x1 && j < y1) {
+								startSample(settings, i, j, sample, settings.aliasSamples);
+								rays[lane] = getRay(pixelCenter(i, j));
+								packet.setRay(lane, rays[lane], Interval(0.001, infinity));
+							}
+						}
+						packet.prepare();
+
+						PacketIntersection hits;
+						sceneObjects.intersectPacket(packet, hits);
+
+						for (int lane = 0; lane < RayPacket::size; lane++) {
+							if (!packet.active(lane)) {
+								continue;
+							}
+							int i = blockX + lane % width;
+							int j = blockY + lane / width;
+							startSample(settings, i, j, sample, settings.aliasSamples);
+							Pixel pixel = Pixel(settings.maxDepth, settings.rouletteDepth, sceneObjects, rays[lane], hits.hit(lane), hits.sect[lane], i, j);
+							aaColor[lane] += pixel.getColorVector();
+							if (features) {
+								features->add(i, j, rays[lane], hits.hit(lane), hits.sect[lane], pixel.getColorVector());
+							}
+						}
+					}
+
+					for (int lane = 0; lane < RayPacket::size; lane++) {
+						int i = blockX + lane % width;
+						int j = blockY + lane / width;
+						if (i < x1 && j < y1) {
+							store(i, j, aaColor[lane]);
+						}
+					}
+				}
+			}
+		}
+
+		/*
+			Trace the tile as a wavefront (see wavefront.h): make the camera rays of all the
+			samples of the tile, then move all of their paths along one bounce at a time.
+			Each bounce is an extend stage, which finds what every path hits, and a shade
+			stage, which adds the sky to the paths that missed and scatters the rest, keeping
+			the ones that carry on. The paths are sorted by origin and direction before each
+			extend stage but the first, whose camera rays are in pixel order already.
+
+			Each path reselects its sample's random stream as it is shaded, so every sample
+			draws the same numbers as in the other paths, and the image is the same.
+		*/
+		template <typename Store>
+		void traceTileWavefront(
+			const RenderSettings& settings,
+			const Surface& sceneObjects,
+			int x0,
+			int y0,
+			int x1,
+			int y1,
+			int firstSample,
+			int sampleCount,
+			Store&& store,
+			FeatureBuffer* features = nullptr
+		) const {
+			Wavefront& wave = Wavefront::local();
+			const int width = x1 - x0;
+			const int pixels = width * (y1 - y0);
+			std::vector<Vec3> sums(pixels);
+
+			// Samples are made pixel by pixel, as many as fit in a wave at a time
+			int pixel = 0;
+			int sample = firstSample;
+			while (pixel < pixels && sampleCount > 0) {
+				wave.clear();
+				while (pixel < pixels && !wave.full()) {
+					const int i = x0 + pixel % width;
+					const int j = y0 + pixel / width;
+					startSample(settings, i, j, sample, settings.aliasSamples);
+					wave.addSample(pixel, sample, getRay(pixelCenter(i, j)));
+					if (++sample == firstSample + sampleCount) {
+						sample = firstSample;
+						pixel++;
+					}
+				}
+
+				for (int bounce = 0; bounce < settings.maxDepth && wave.pathCount() > 0; bounce++) {
+					if (bounce > 0) {
+						wave.sort();
+					}
+					// Like traceTilePackets, only the camera rays travel together closely enough for packets
+					wave.extend(sceneObjects, settings.packetTracing && bounce == 0);
+
+					size_t kept = 0;
+					for (size_t path = 0; path < wave.pathCount(); path++) {
+						const uint32_t slot = wave.slot(path);
+						Wavefront::Sample& traced = wave.sample(slot);
+						startSample(settings, x0 + traced.pixel % width, y0 + traced.pixel / width, traced.sample, settings.aliasSamples);
+						// Every bounce draws from its own random stream
+						Rng::local().bounce(settings.maxDepth - bounce);
+						if (bounce == 0) {
+							RENDY_STAT(primaryRays);
+						} else {
+							RENDY_STAT(bounceRays);
+						}
+
+						Ray r = wave.ray(path);
+						const Hit& hit = wave.hit(path);
+						Intersection sect;
+						if (hit.surface) {
+							hit.surface->hitAttributes(r, hit, sect);
+						}
+						if (bounce == 0 && features) {
+							traced.hit = hit.surface != nullptr;
+							traced.sect = sect;
+						}
+
+						Vec3 throughput = wave.throughput(path);
+						if (!hit.surface) {
+							RENDY_STAT(pathsToSky);
+							RENDY_STAT_DEPTH(bounce);
+							traced.radiance = throughput * Pixel::sky(r);
+						} else if (Pixel::scatter(bounce, settings.rouletteDepth, sect, r, throughput)) {
+							wave.setPath(kept++, r, throughput, slot);
+						}
+					}
+					wave.resize(kept);
+				}
+
+				// The paths still going ran out of bounces without reaching the sky
+				for (size_t path = 0; path < wave.pathCount(); path++) {
+					RENDY_STAT(pathsTruncated);
+					RENDY_STAT_DEPTH(settings.maxDepth);
+				}
+
+				for (uint32_t slot = 0; slot < wave.sampleCount(); slot++) {
+					const Wavefront::Sample& traced = wave.sample(slot);
+					sums[traced.pixel] += traced.radiance;
+					if (features) {
+						features->add(x0 + traced.pixel % width, y0 + traced.pixel / width, traced.ray, traced.hit, traced.sect, traced.radiance);
+					}
+				}
+			}
+
+			for (int tilePixel = 0; tilePixel < pixels; tilePixel++) {
+				store(x0 + tilePixel % width, y0 + tilePixel / width, sums[tilePixel]);
+			}
+		}
+
+		/*
+			Seed the random numbers and start the sampler for one sample of a pixel, out of
+			the sampleCount it is meant to get
+		*/
+		void startSample(const RenderSettings& settings, int i, int j, int sample, int sampleCount) const {
+			Rng::local().seed(static_cast<uint64_t>(j) * _viewport.imageWidth() + i, sample, settings.seed);
+			Sampler::local().start(settings.sampler, i, j, _viewport.imageWidth(), sample, sampleCount, settings.seed);
+		}
+
+		/*
+			the center of the pixel is calculated by multiplying our deltas for x and y
+			by our offsets and adding to the center of the first pixel in the grid
+		*/
+		Vec3 pixelCenter(int i, int j) const {
+			return _viewport.firstPixelLocation() + (_viewport.pixelDeltaU() * i) + (_viewport.pixelDeltaV() * j);
+		}
+
 		Ray getRay(Vec3 pixelCenter) const {
 			Vec3 pixelSample = getSampleSquare() + pixelCenter;
 			return Ray(_cameraCenter, pixelSample - _cameraCenter);
 		}
 
 		Vec3 getSampleSquare() const {
-			float px = -0.5 + random_float();
-			float py = -0.5 + random_float();
+			const Sampler& sampler = Sampler::local();
+			float px, py;
+			if (sampler.independent()) {
+				px = -0.5 + random_float();
+				py = -0.5 + random_float();
+			} else {
+				sampler.get2D(Sampler::pixelDimension, px, py);
+				px -= 0.5f;
+				py -= 0.5f;
+			}
 			return (_viewport.pixelDeltaU() * px) + (_viewport.pixelDeltaV() * py);
 		}
 
-		Vec3 antiAlias(int aliasSamples, Vec3 color) {
+		Vec3 antiAlias(int aliasSamples, Vec3 color) const {
 			return color * (1.0 / aliasSamples);
 		}
 };
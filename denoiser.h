@@ -0,0 +1,291 @@
+#pragma once
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include "rendyUtils.h"
+#include "accumulationBuffer.h"
+#include "featureBuffer.h"
+#include "framebuffer.h"
+#include "threadPool.h"
+#include "toneMapper.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+	Settings that control how hard the denoiser filters
+*/
+struct DenoiseSettings {
+	// Passes of the filter, each reaching twice as far as the one before
+	int iterations = 4;
+	// How many standard deviations of a pixel's noise a neighbour's luminance may differ by
+	float colorSigma = 8.0f;
+	// How quickly the weight falls as the angle between two normals opens, higher keeps creases sharper
+	float normalPower = 32.0f;
+	// How far a neighbour's depth may stray from the plane the pixel's depth slopes along
+	float depthSigma = 2.0f;
+};
+
+/*
+	Removes the noise of an image rendered with only a few samples per pixel, as a
+	post-process over the AccumulationBuffer and FeatureBuffer of the render.
+
+	It is the edge-avoiding a-trous wavelet filter. Every pass blurs each pixel with
+	a 5x5 B-spline kernel whose taps are spread 1, 2, 4, 8... pixels apart, so a few
+	passes of 25 taps each cover a wide area. Each tap is weighted down where it
+	crosses an edge the render's features show: a different normal, a depth off the
+	pixel's slope, or a luminance further from the pixel's than its noise explains.
+	The noise of each pixel is estimated from the variance of its samples' luminance,
+	and filtered along with the color, so the color weight loosens where the render is
+	noisy and tightens as the passes clean it up.
+
+	The colors are filtered as linear floats, with the taps summed as Vec3 SIMD
+	registers, and each pass runs the rows of the image in parallel on the thread
+	pool. Only the filtered image is tone mapped into the framebuffer, and it stays
+	available from color for writing out as HDR. The scratch buffers are kept between
+	frames.
+
+	See: Dammertz et al., "Edge-Avoiding A-Trous Wavelet Transform for fast Global
+	Illumination Filtering" (HPG 2010), and Schied et al., "Spatiotemporal
+	Variance-Guided Filtering" (HPG 2017) for the variance guided weights.
+*/
+class Denoiser {
+	public:
+		Denoiser() {}
+
+		// Filter the averaged colors of accumulation, guided by features, and tone map them into the framebuffer
+		void denoise(
+			const AccumulationBuffer& accumulation,
+			const FeatureBuffer& features,
+			Framebuffer& framebuffer,
+			const ToneMapper& toneMapper,
+			ThreadPool& pool,
+			const DenoiseSettings& settings = DenoiseSettings()
+		) {
+			const int width = accumulation.width();
+			const int height = accumulation.height();
+			if (framebuffer.width() != width || framebuffer.height() != height) {
+				framebuffer.resize(width, height);
+			}
+			if (accumulation.sampleCount() == 0 || features.width() != width || features.height() != height) {
+				// Nothing to guide the filter, so the averages are passed through unfiltered
+				_width = width;
+				_height = height;
+				_color.resize(static_cast<size_t>(width) * height);
+				for (int j = 0; j < height; j++) {
+					for (int i = 0; i < width; i++) {
+						_color[index(i, j)] = accumulation.average(i, j);
+					}
+				}
+				accumulation.resolve(framebuffer, toneMapper);
+				return;
+			}
+			prepare(accumulation, features, pool);
+
+			for (int iteration = 0; iteration < settings.iterations; iteration++) {
+				const int step = 1 << iteration;
+				pool.parallelFor(height, [&](int j, int) {
+					for (int i = 0; i < width; i++) {
+						filterPixel(i, j, step, settings);
+					}
+				});
+				_color.swap(_nextColor);
+				_variance.swap(_nextVariance);
+			}
+
+			for (int j = 0; j < height; j++) {
+				for (int i = 0; i < width; i++) {
+					framebuffer.pixel(i, j, toneMapper.pack(_color[index(i, j)]));
+				}
+			}
+		}
+
+		// Getters
+		const int width() const { return _width; }
+		const int height() const { return _height; }
+
+		// The linear color of a pixel of the last image denoised
+		const Vec3 color(int i, int j) const { return _color[index(i, j)]; }
+
+	private:
+		// What a pixel's neighbours are compared against, worked out once per frame
+		struct Guide {
+			Vec3 normal;
+			float depth;
+			// How much the depth changes from one pixel to the next, across and down
+			float depthSlopeX;
+			float depthSlopeY;
+		};
+
+		int _width = 0;
+		int _height = 0;
+		std::vector<Guide> _guides;
+		std::vector<Vec3> _color;
+		std::vector<Vec3> _nextColor;
+		// The variance of each pixel's averaged luminance, which shrinks with every pass
+		std::vector<float> _variance;
+		std::vector<float> _nextVariance;
+
+		size_t index(int i, int j) const { return static_cast<size_t>(j) * _width + i; }
+
+		static float luminance(const Vec3& color) {
+			return 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+		}
+
+		/*
+			e^x for x <= 0, to about 4 significant digits, which is plenty for a weight.
+			std::exp is a library call that takes most of the time of a tap. This splits
+			x / ln 2 into an integer part, which goes straight into the float's exponent
+			bits, and a fraction f whose 2^f a cubic fits well enough.
+
+			Weights below e^-20 are nothing next to the pixel's own, and are returned as
+			zero: squared for the variance, they would come out as denormals, which
+			are many times slower to add up.
+		*/
+		static float weightExp(float x) {
+			if (!(x > -20.0f)) {
+				return 0.0f;
+			}
+			const float y = x * 1.44269504f;
+			// Truncation rounds towards zero, so negative fractions need one more step down
+			int32_t whole = static_cast<int32_t>(y);
+			whole -= y < static_cast<float>(whole) ? 1 : 0;
+			const float f = y - static_cast<float>(whole);
+			const float fraction = 1.0f + f * (0.6951786f + f * (0.2261011f + f * 0.0781215f));
+			const uint32_t bits = static_cast<uint32_t>(whole + 127) << 23;
+			float scale;
+			std::memcpy(&scale, &bits, sizeof(scale));
+			return fraction * scale;
+		}
+
+		void prepare(const AccumulationBuffer& accumulation, const FeatureBuffer& features, ThreadPool& pool) {
+			_width = accumulation.width();
+			_height = accumulation.height();
+			const size_t pixels = static_cast<size_t>(_width) * _height;
+			_guides.resize(pixels);
+			_color.resize(pixels);
+			_nextColor.resize(pixels);
+			_variance.resize(pixels);
+			_nextVariance.resize(pixels);
+
+			const float colorScale = 1.0f / accumulation.sampleCount();
+			const float varianceScale = 1.0f / features.sampleCount();
+			pool.parallelFor(_height, [&](int j, int) {
+				for (int i = 0; i < _width; i++) {
+					Guide& guide = _guides[index(i, j)];
+					// Where a pixel's rays hit different surfaces the average normal is short, but it still points between them
+					const Vec3 normal = features.normal(i, j);
+					const float length = normal.length();
+					guide.normal = length > 0.0f ? normal / length : normal;
+					guide.depth = features.depth(i, j);
+					// The smaller of the differences on either side, so an edge next to the pixel doesn't count as a slope
+					guide.depthSlopeX = depthSlope(features, i, j, 1, 0);
+					guide.depthSlopeY = depthSlope(features, i, j, 0, 1);
+					_color[index(i, j)] = accumulation.sum(i, j) * colorScale;
+					// The variance of the mean of the samples, not of one sample
+					_nextVariance[index(i, j)] = features.variance(i, j) * varianceScale;
+				}
+			});
+
+			/*
+				A single pixel's variance is itself noisy, so it starts out blurred over its
+				neighbours. With only one sample there is no variance to blur, and the spread
+				of the luminance of the pixel and its neighbours stands in for it.
+			*/
+			const bool spatial = features.sampleCount() < 2;
+			pool.parallelFor(_height, [&](int j, int) {
+				for (int i = 0; i < _width; i++) {
+					float sum = 0.0f;
+					float squares = 0.0f;
+					float weights = 0.0f;
+					for (int dy = -1; dy <= 1; dy++) {
+						for (int dx = -1; dx <= 1; dx++) {
+							const int x = i + dx;
+							const int y = j + dy;
+							if (x < 0 || y < 0 || x >= _width || y >= _height) {
+								continue;
+							}
+							const float weight = (dx == 0 ? 2.0f : 1.0f) * (dy == 0 ? 2.0f : 1.0f);
+							if (spatial) {
+								const float neighbour = luminance(_color[index(x, y)]);
+								sum += weight * neighbour;
+								squares += weight * neighbour * neighbour;
+							} else {
+								sum += weight * _nextVariance[index(x, y)];
+							}
+							weights += weight;
+						}
+					}
+					const float mean = sum / weights;
+					_variance[index(i, j)] = spatial ? (std::max)(squares / weights - mean * mean, 0.0f) : mean;
+				}
+			});
+		}
+
+		float depthSlope(const FeatureBuffer& features, int i, int j, int dx, int dy) const {
+			const float depth = features.depth(i, j);
+			float slope = infinity;
+			if (i - dx >= 0 && j - dy >= 0) {
+				slope = std::fabs(depth - features.depth(i - dx, j - dy));
+			}
+			if (i + dx < _width && j + dy < _height) {
+				slope = (std::min)(slope, std::fabs(features.depth(i + dx, j + dy) - depth));
+			}
+			return slope == infinity ? 0.0f : slope;
+		}
+
+		// One pass of the filter over one pixel, reading _color and _variance and writing the next ones
+		void filterPixel(int i, int j, int step, const DenoiseSettings& settings) {
+			// The B3 spline, the kernel of the a-trous transform
+			static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+			const size_t center = index(i, j);
+			const Guide& guide = _guides[center];
+			const float centerLuminance = luminance(_color[center]);
+			const float colorScale = 1.0f / (settings.colorSigma * std::sqrt(_variance[center]) + 1e-4f);
+			const float depthScale = 1.0f / settings.depthSigma;
+
+			Vec3 sum;
+			float variance = 0.0f;
+			float weights = 0.0f;
+			for (int dy = -2; dy <= 2; dy++) {
+				const int y = j + dy * step;
+				if (y < 0 || y >= _height) {
+					continue;
+				}
+				for (int dx = -2; dx <= 2; dx++) {
+					const int x = i + dx * step;
+					if (x < 0 || x >= _width) {
+						continue;
+					}
+					const size_t tap = index(x, y);
+					const Guide& other = _guides[tap];
+
+					// How far the tap's depth is from the plane the pixel's depth slopes along
+					const float expectedChange = guide.depthSlopeX * std::abs(dx * step) + guide.depthSlopeY * std::abs(dy * step);
+					const float depthWeight = std::fabs(other.depth - guide.depth) / (expectedChange + 1e-3f * guide.depth);
+					// exp(-p (1 - cos)) falls off like cos^p near the pixel's own normal, and folds into the one exp
+					const float normalWeight = settings.normalPower * (1.0f - dot(guide.normal, other.normal));
+					const float colorWeight = std::fabs(luminance(_color[tap]) - centerLuminance) * colorScale;
+					const float weight = kernel[dx + 2] * kernel[dy + 2] * weightExp(-normalWeight - depthWeight * depthScale - colorWeight);
+
+					sum += _color[tap] * weight;
+					variance += weight * weight * _variance[tap];
+					weights += weight;
+				}
+			}
+
+			// The pixel's own tap always counts, but its weight can still underflow
+			if (weights > 0.0f) {
+				_nextColor[center] = sum / weights;
+				_nextVariance[center] = variance / (weights * weights);
+			} else {
+				_nextColor[center] = _color[center];
+				_nextVariance[center] = _variance[center];
+			}
+		}
+};
+
+#endif
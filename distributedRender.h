@@ -0,0 +1,408 @@
+#pragma once
+#ifndef DISTRIBUTEDRENDER_H
+#define DISTRIBUTEDRENDER_H
+
+#include "rendyUtils.h"
+#include "accumulationBuffer.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "surface.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+	Rendering one frame with several worker processes.
+
+	A coordinator starts the workers, each of which loads the same scene, and talks
+	to each one over a pair of pipes. It hands out the tiles of the image one at a
+	time: the worker reads the tile's corners from its input, traces every sample of
+	every pixel in it, and writes back the tile's per pixel sums of samples as
+	floats. The coordinator adds those into an AccumulationBuffer and only averages
+	them into 8-bit pixels once every tile is in. Samples are seeded by pixel and
+	sample number, so it doesn't matter which worker traces a tile: the image is
+	exactly the one a single process renders.
+
+	Replies are read without blocking, a piece at a time as they arrive, and every
+	busy worker has a deadline, so one that hangs can't hold up the others. A worker
+	gets replyTimeout, plus sampleTimeout for every sample of the tile, to start its
+	reply, and then replyTimeout at most between pieces of it. When a worker dies,
+	sends back anything but the whole tile it was asked for, or misses its deadline,
+	the coordinator drops it and puts its tile back at the front of the queue for the
+	others. The render only fails if every worker is lost.
+
+	Workers are started with fork and exec and the pipes are plain file descriptors,
+	so this is POSIX only.
+*/
+
+namespace distributed {
+	// A tile of the image, the pixels [x0, x1) x [y0, y1)
+	struct Tile {
+		int32_t x0, y0, x1, y1;
+	};
+
+	// The floats of a tile's reply: the red, green and blue sums of each pixel, row by row
+	inline size_t tileFloats(const Tile& tile) {
+		return static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * 3;
+	}
+
+	// Read exactly size bytes, returning false at the end of the input or on an error
+	inline bool readAll(int fd, void* data, size_t size) {
+		char* bytes = static_cast<char*>(data);
+		while (size > 0) {
+			ssize_t count = read(fd, bytes, size);
+			if (count < 0 && errno == EINTR) {
+				continue;
+			}
+			if (count <= 0) {
+				return false;
+			}
+			bytes += count;
+			size -= static_cast<size_t>(count);
+		}
+		return true;
+	}
+
+	/*
+		Read what has arrived, up to size bytes, from a non-blocking descriptor. Returns
+		the number of bytes read, 0 if nothing is waiting yet, or -1 at the end of the
+		input or on an error.
+	*/
+	inline ssize_t readSome(int fd, void* data, size_t size) {
+		while (true) {
+			ssize_t count = read(fd, data, size);
+			if (count < 0 && errno == EINTR) {
+				continue;
+			}
+			if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return 0;
+			}
+			return count > 0 ? count : -1;
+		}
+	}
+
+	inline bool writeAll(int fd, const void* data, size_t size) {
+		const char* bytes = static_cast<const char*>(data);
+		while (size > 0) {
+			ssize_t count = write(fd, bytes, size);
+			if (count < 0 && errno == EINTR) {
+				continue;
+			}
+			if (count <= 0) {
+				return false;
+			}
+			bytes += count;
+			size -= static_cast<size_t>(count);
+		}
+		return true;
+	}
+
+	// Keep a descriptor from leaking into the workers started after it
+	inline void closeOnExec(int fd) {
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	}
+
+	inline void setNonBlocking(int fd) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+/*
+	The worker's side: trace each tile requested on input and write its sums back on
+	output, until input is closed. Returns false if a request or a reply fails.
+
+	exitAfter, when not negative, makes the worker die without replying once it has
+	served that many tiles, to exercise the coordinator's recovery.
+*/
+inline bool serveTiles(const Camera& camera, const RenderSettings& settings, const Surface& world, int input, int output, int exitAfter = -1) {
+	distributed::Tile tile;
+	std::vector<float> sums;
+	int served = 0;
+	while (distributed::readAll(input, &tile, sizeof(tile))) {
+		if (served == exitAfter) {
+			_exit(1);
+		}
+		if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > camera.imageWidth() || tile.y1 > camera.imageHeight() || tile.x0 >= tile.x1 || tile.y0 >= tile.y1) {
+			return false;
+		}
+
+		sums.resize(distributed::tileFloats(tile));
+		const int tileWidth = tile.x1 - tile.x0;
+		camera.traceTile(settings, world, tile.x0, tile.y0, tile.x1, tile.y1, 0, settings.aliasSamples, [&](int i, int j, const Vec3& sum) {
+			float* pixel = &sums[(static_cast<size_t>(j - tile.y0) * tileWidth + (i - tile.x0)) * 3];
+			pixel[0] = sum.x();
+			pixel[1] = sum.y();
+			pixel[2] = sum.z();
+		});
+
+		if (!distributed::writeAll(output, &tile, sizeof(tile)) || !distributed::writeAll(output, sums.data(), sums.size() * sizeof(float))) {
+			return false;
+		}
+		served++;
+	}
+	return true;
+}
+
+class RenderCoordinator {
+	public:
+		// How long a worker may go without sending any of a reply before it is dropped
+		static constexpr std::chrono::milliseconds replyTimeout = std::chrono::seconds(10);
+		// The extra time a worker gets to trace each sample of its tile before it starts the reply
+		static constexpr std::chrono::microseconds sampleTimeout = std::chrono::microseconds(20);
+
+		RenderCoordinator() : _workersLost(0), _tilesReassigned(0) {}
+		RenderCoordinator(const RenderCoordinator&) = delete;
+		RenderCoordinator& operator=(const RenderCoordinator&) = delete;
+		~RenderCoordinator() { stopWorkers(); }
+
+		/*
+			Start a worker process running command, the program (looked up on the PATH)
+			and its arguments, with its standard input and output connected to the
+			coordinator. The program must call serveTiles on them.
+		*/
+		bool startWorker(const std::vector<std::string>& command) {
+			int toWorker[2];
+			int fromWorker[2];
+			if (pipe(toWorker) != 0) {
+				return false;
+			}
+			if (pipe(fromWorker) != 0) {
+				close(toWorker[0]);
+				close(toWorker[1]);
+				return false;
+			}
+			for (int fd : { toWorker[0], toWorker[1], fromWorker[0], fromWorker[1] }) {
+				distributed::closeOnExec(fd);
+			}
+
+			std::vector<char*> argv;
+			for (const std::string& argument : command) {
+				argv.push_back(const_cast<char*>(argument.c_str()));
+			}
+			argv.push_back(nullptr);
+
+			pid_t pid = fork();
+			if (pid == 0) {
+				// dup2 clears close-on-exec on the copies, so only these two survive the exec
+				dup2(toWorker[0], STDIN_FILENO);
+				dup2(fromWorker[1], STDOUT_FILENO);
+				execvp(argv[0], argv.data());
+				_exit(127);
+			}
+			close(toWorker[0]);
+			close(fromWorker[1]);
+			if (pid < 0) {
+				close(toWorker[1]);
+				close(fromWorker[0]);
+				return false;
+			}
+			distributed::setNonBlocking(fromWorker[0]);
+
+			Worker worker;
+			worker.pid = pid;
+			worker.input = toWorker[1];
+			worker.output = fromWorker[0];
+			worker.tile = -1;
+			worker.received = 0;
+			_workers.push_back(worker);
+			return true;
+		}
+
+		/*
+			Render the frame with the workers, which must have loaded the same scene with
+			the same camera and settings. Returns false with the reason in error if every
+			worker was lost before the last tile came back.
+		*/
+		bool render(const Camera& camera, const RenderSettings& settings, Framebuffer& framebuffer, std::string& error) {
+			// A worker that dies mid-request must show up as a failed write, not kill the coordinator
+			std::signal(SIGPIPE, SIG_IGN);
+
+			// The same tiles, in the same order, as Camera::forEachTile
+			const int width = camera.imageWidth();
+			const int height = camera.imageHeight();
+			const int tileSize = (std::max)(settings.tileSize, 1);
+			std::vector<distributed::Tile> tiles;
+			for (int y0 = 0; y0 < height; y0 += tileSize) {
+				for (int x0 = 0; x0 < width; x0 += tileSize) {
+					distributed::Tile tile;
+					tile.x0 = x0;
+					tile.y0 = y0;
+					tile.x1 = (std::min)(x0 + tileSize, width);
+					tile.y1 = (std::min)(y0 + tileSize, height);
+					tiles.push_back(tile);
+				}
+			}
+
+			std::deque<int> pending;
+			for (int tile = 0; tile < static_cast<int>(tiles.size()); tile++) {
+				pending.push_back(tile);
+			}
+
+			AccumulationBuffer accumulation(width, height);
+			size_t finished = 0;
+			while (finished < tiles.size()) {
+				// Keep every idle worker busy
+				for (Worker& worker : _workers) {
+					if (worker.pid < 0 || worker.tile >= 0 || pending.empty()) {
+						continue;
+					}
+					worker.tile = pending.front();
+					pending.pop_front();
+					worker.reply.resize(sizeof(distributed::Tile) + distributed::tileFloats(tiles[worker.tile]) * sizeof(float));
+					worker.received = 0;
+					const long long samples = static_cast<long long>(distributed::tileFloats(tiles[worker.tile]) / 3) * settings.aliasSamples;
+					worker.deadline = Clock::now() + replyTimeout + sampleTimeout * samples;
+					if (!distributed::writeAll(worker.input, &tiles[worker.tile], sizeof(distributed::Tile))) {
+						loseWorker(worker, pending);
+					}
+				}
+
+				// Wait for replies, but only until the first busy worker's deadline
+				std::vector<pollfd> waiting;
+				std::vector<Worker*> busy;
+				int timeout = -1;
+				const Clock::time_point now = Clock::now();
+				for (Worker& worker : _workers) {
+					if (worker.pid >= 0 && worker.tile >= 0) {
+						pollfd entry;
+						entry.fd = worker.output;
+						entry.events = POLLIN;
+						entry.revents = 0;
+						waiting.push_back(entry);
+						busy.push_back(&worker);
+						const auto left = std::chrono::ceil<std::chrono::milliseconds>(worker.deadline - now).count();
+						const int wait = static_cast<int>((std::max)(left, static_cast<decltype(left)>(0)));
+						timeout = timeout < 0 ? wait : (std::min)(timeout, wait);
+					}
+				}
+				if (waiting.empty()) {
+					error = "every render worker failed";
+					return false;
+				}
+				if (poll(waiting.data(), waiting.size(), timeout) < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					error = "could not wait for the render workers";
+					return false;
+				}
+
+				for (size_t n = 0; n < waiting.size(); n++) {
+					Worker& worker = *busy[n];
+					if (waiting[n].revents == 0) {
+						if (Clock::now() >= worker.deadline) {
+							loseWorker(worker, pending);
+						}
+						continue;
+					}
+
+					const ssize_t count = distributed::readSome(worker.output, worker.reply.data() + worker.received, worker.reply.size() - worker.received);
+					if (count < 0) {
+						loseWorker(worker, pending);
+						continue;
+					}
+					if (count > 0) {
+						worker.received += static_cast<size_t>(count);
+						worker.deadline = Clock::now() + replyTimeout;
+					}
+					if (worker.received < worker.reply.size()) {
+						continue;
+					}
+
+					const distributed::Tile& tile = tiles[worker.tile];
+					distributed::Tile reply;
+					std::memcpy(&reply, worker.reply.data(), sizeof(reply));
+					if (reply.x0 != tile.x0 || reply.y0 != tile.y0 || reply.x1 != tile.x1 || reply.y1 != tile.y1) {
+						loseWorker(worker, pending);
+						continue;
+					}
+
+					const char* sums = worker.reply.data() + sizeof(reply);
+					float pixel[3];
+					for (int j = tile.y0; j < tile.y1; j++) {
+						for (int i = tile.x0; i < tile.x1; i++, sums += sizeof(pixel)) {
+							std::memcpy(pixel, sums, sizeof(pixel));
+							accumulation.add(i, j, Vec3(pixel[0], pixel[1], pixel[2]));
+						}
+					}
+					worker.tile = -1;
+					finished++;
+				}
+			}
+
+			accumulation.addSamples(settings.aliasSamples);
+			accumulation.resolve(framebuffer, ToneMapper(settings.exposure, settings.gamma));
+			stopWorkers();
+			return true;
+		}
+
+		// Getters
+		const int workerCount() const { return static_cast<int>(_workers.size()); }
+		const int workersLost() const { return _workersLost; }
+		const int tilesReassigned() const { return _tilesReassigned; }
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		struct Worker {
+			// Negative once the worker has been stopped or lost
+			pid_t pid;
+			// The coordinator writes requests to input and reads replies from output
+			int input;
+			int output;
+			// The tile the worker is tracing, or -1 when it is idle
+			int tile;
+			// The reply to the tile, of which the first received bytes are in
+			std::vector<char> reply;
+			size_t received;
+			// When the worker is dropped unless more of the reply has come in
+			Clock::time_point deadline;
+		};
+
+		std::vector<Worker> _workers;
+		int _workersLost;
+		int _tilesReassigned;
+
+		// Kill a worker that failed and queue its tile to be traced first by another one
+		void loseWorker(Worker& worker, std::deque<int>& pending) {
+			if (worker.tile >= 0) {
+				pending.push_front(worker.tile);
+				_tilesReassigned++;
+			}
+			kill(worker.pid, SIGKILL);
+			stopWorker(worker);
+			_workersLost++;
+		}
+
+		// Closing its input tells a worker there are no more tiles, so it exits
+		void stopWorker(Worker& worker) {
+			if (worker.pid < 0) {
+				return;
+			}
+			close(worker.input);
+			close(worker.output);
+			int status;
+			while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+			}
+			worker.pid = -1;
+			worker.tile = -1;
+		}
+
+		void stopWorkers() {
+			for (Worker& worker : _workers) {
+				stopWorker(worker);
+			}
+		}
+};
+
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+#ifndef FEATUREBUFFER_H
+#define FEATUREBUFFER_H
+
+#include "surface.h"
+#include "vec3.h"
+#include <algorithm>
+#include <vector>
+
+/*
+	What the camera rays saw besides color, for the denoiser (see denoiser.h): for each
+	pixel, the normal and distance of the first surface its rays hit, and how noisy
+	its samples were. Noise in a path traced image comes from the bounces after the
+	first hit, so these come out nearly clean after a handful of samples, and show
+	where the edges of objects are when the color is still too noisy to tell.
+
+	Like an AccumulationBuffer it holds running sums, and the getters average them
+	over the samples taken. Rays that miss everything count a distance of skyDepth,
+	and the direction back along the ray as their normal, so neighbouring pixels of
+	sky look alike.
+*/
+class FeatureBuffer {
+	public:
+		// The distance recorded for rays that reach the sky
+		static constexpr float skyDepth = 1.0e4f;
+
+		FeatureBuffer() : _width(0), _height(0), _sampleCount(0) {}
+		FeatureBuffer(int width, int height) { resize(width, height); }
+
+		// Resize the buffer and throw away all accumulated samples
+		void resize(int width, int height) {
+			_width = width;
+			_height = height;
+			_pixels.assign(static_cast<size_t>(width) * height, Features());
+			_sampleCount = 0;
+		}
+
+		// Throw away all accumulated samples
+		void clear() { resize(_width, _height); }
+
+		// Getters
+		const int width() const { return _width; }
+		const int height() const { return _height; }
+		const int sampleCount() const { return _sampleCount; }
+
+		// The average normal of the surfaces hit, which is shorter than 1 where they disagree
+		Vec3 normal(int i, int j) const { return _pixels[index(i, j)].normal * scale(); }
+		float depth(int i, int j) const { return _pixels[index(i, j)].depth * scale(); }
+		float luminance(int i, int j) const { return _pixels[index(i, j)].luminance * scale(); }
+
+		// The variance of the samples' luminance, as linear light
+		float variance(int i, int j) const {
+			const Features& pixel = _pixels[index(i, j)];
+			const float mean = pixel.luminance * scale();
+			return (std::max)(pixel.luminanceSquares * scale() - mean * mean, 0.0f);
+		}
+
+		/*
+			Add one sample's camera ray to a pixel: whether and where the ray hit, and the
+			color the sample came out. Each pixel is only ever touched by one thread.
+		*/
+		void add(int i, int j, const Ray& r, bool hit, const Intersection& sect, const Vec3& color) {
+			Features& pixel = _pixels[index(i, j)];
+			if (hit) {
+				pixel.normal += sect.normal;
+				pixel.depth += sect.t * r.direction().length();
+			} else {
+				pixel.normal -= unit(r.direction());
+				pixel.depth += skyDepth;
+			}
+			// Rec. 709 luminance weights, as for adaptive sampling
+			const float luminance = 0.2126f * color.x() + 0.7152f * color.y() + 0.0722f * color.z();
+			pixel.luminance += luminance;
+			pixel.luminanceSquares += luminance * luminance;
+		}
+
+		// Record that every pixel received count more samples
+		void addSamples(int count) { _sampleCount += count; }
+
+	private:
+		struct Features {
+			Vec3 normal;
+			float depth = 0.0f;
+			float luminance = 0.0f;
+			float luminanceSquares = 0.0f;
+		};
+
+		int _width;
+		int _height;
+		int _sampleCount;
+		std::vector<Features> _pixels;
+
+		size_t index(int i, int j) const { return static_cast<size_t>(j) * _width + i; }
+		float scale() const { return _sampleCount > 0 ? 1.0f / _sampleCount : 0.0f; }
+};
+
+#endif
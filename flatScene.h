@@ -0,0 +1,298 @@
+#pragma once
+#ifndef FLATSCENE_H
+#define FLATSCENE_H
+
+#include "rendyUtils.h"
+#include "arena.h"
+#include "bvh.h"
+#include "primitives.h"
+#include "renderStats.h"
+#include "surface.h"
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+/*
+	A scene that stores its primitives by value in contiguous per-type arrays,
+	instead of a SurfaceList's vector of shared_ptrs where every object is its own heap
+	allocation with its own reference count, scattered around the heap.
+
+	All storage comes from one Arena, so building a scene of a million spheres is a
+	handful of allocations, and tearing it down frees those few blocks (one, if the
+	size was reserved up front). Adding a primitive returns a PrimitiveHandle rather
+	than a pointer.
+
+	The primitive types are the closed set in Primitives (see primitives.h), so no
+	sphere is tested through a virtual call. Before the BVH is built, rays run through
+	each type's array in a loop with the test inlined into it. Once built, a BVHTree
+	over the primitives finds the closest hit, and the build puts the primitives in
+	leaf order so the leaf loop reads memory in order.
+*/
+class FlatScene : public Surface {
+	public:
+		// Every kind of primitive a FlatScene can hold. SurfaceRef takes any other Surface.
+		typedef PrimitiveArrays<SphereData, SurfaceRef> Primitives;
+
+		FlatScene() : _primitives(_arena), _handles(_arena) {}
+		FlatScene(const FlatScene&) = delete;
+		FlatScene& operator=(const FlatScene&) = delete;
+
+		// Make room for count more spheres without growing the arrays
+		void reserveSpheres(size_t count) {
+			const size_t spheres = _primitives.array<SphereData>().size() + count;
+			_arena.reserve(spheres * sizeof(SphereData) + (_handles.size() + count) * sizeof(PrimitiveHandle) + 64);
+			_primitives.reserve<SphereData>(spheres);
+			_handles.reserve(_handles.size() + count);
+		}
+
+		PrimitiveHandle addSphere(const Vec3& center, float radius) {
+			SphereData sphere;
+			sphere.center = center;
+			sphere.radius = radius;
+			return add(sphere);
+		}
+
+		// Construct any other kind of Surface in the scene's arena
+		template <typename T, typename... Args>
+		PrimitiveHandle addSurface(Args&&... args) {
+			SurfaceRef ref;
+			ref.surface = _arena.create<T>(std::forward<Args>(args)...);
+			return add(ref);
+		}
+
+		// Add a primitive of one of the types in Primitives
+		template <typename T>
+		PrimitiveHandle add(const T& primitive) {
+			PrimitiveHandle handle = _primitives.add(primitive);
+			_handles.push_back(handle);
+			_tree = BVHTree();
+			return handle;
+		}
+
+		/*
+			Build the BVH over every primitive added so far. Until it is built, rays test
+			every primitive in turn. Adding primitives afterwards drops the tree again.
+
+			Building renumbers the primitives into the order of the tree's leaves, so the
+			spheres of a leaf sit next to each other in the sphere array. Handles taken
+			before the build don't survive it.
+		*/
+		void build(int buildThreads = 0) {
+			std::vector<AABB> bounds = primitiveBounds();
+			_tree.build(bounds, buildThreads);
+			saveBuiltAreas();
+			bounds = std::vector<AABB>();
+
+			std::vector<PrimitiveHandle> order;
+			order.reserve(_handles.size());
+			for (int primitive : _tree.primitives()) {
+				order.push_back(_handles[primitive]);
+			}
+			_handles.clear();
+			for (const PrimitiveHandle& handle : _primitives.reorder(order)) {
+				_handles.push_back(handle);
+			}
+			_tree.renumberPrimitives();
+		}
+
+		// Move a sphere. The BVH is out of date until refit is called.
+		void moveSphere(PrimitiveHandle handle, const Vec3& center) {
+			_primitives.get<SphereData>(handle).center = center;
+		}
+
+		/*
+			Bring the BVH up to date after primitives have moved, for the next frame of an
+			animation. Usually the tree is refit in place (see BVHTree::refit), which takes
+			a fraction of the time of a build. Once refitting has let the tree's nodes grow
+			past rebuildRatio times their size after the last build (see growth), it is
+			built again instead, and refit returns true.
+
+			Unlike build, this never moves the primitives themselves, so handles stay valid
+			across frames. A rebuild only reorders the scene's list of handles to match the
+			new leaves.
+		*/
+		bool refit(float rebuildRatio = 1.5f, int buildThreads = 0) {
+			if (_tree.nodes().empty()) {
+				return false;
+			}
+			std::vector<AABB> bounds = primitiveBounds();
+			_tree.refit(bounds);
+			if (growth() <= rebuildRatio) {
+				return false;
+			}
+
+			_tree.build(bounds, buildThreads);
+			saveBuiltAreas();
+			std::vector<PrimitiveHandle> order;
+			order.reserve(_handles.size());
+			for (int primitive : _tree.primitives()) {
+				order.push_back(_handles[primitive]);
+			}
+			for (size_t primitive = 0; primitive < order.size(); primitive++) {
+				_handles[primitive] = order[primitive];
+			}
+			_tree.renumberPrimitives();
+			return true;
+		}
+
+		// Getters
+		const size_t size() const { return _handles.size(); }
+		const size_t sphereCount() const { return _primitives.array<SphereData>().size(); }
+		const SphereData& sphere(PrimitiveHandle handle) const { return _primitives.get<SphereData>(handle); }
+		const Surface& surface(PrimitiveHandle handle) const { return *_primitives.get<SurfaceRef>(handle).surface; }
+		const PrimitiveHandle handle(size_t primitive) const { return _handles[primitive]; }
+		const Primitives& primitives() const { return _primitives; }
+		const Arena& arena() const { return _arena; }
+		const BVHTree& tree() const { return _tree; }
+
+		/*
+			How far refitting has let the BVH's nodes grow: the average over the nodes of
+			each one's surface area over its area right after the build, so 1 for a fresh
+			tree. The chance of a ray entering a node grows with its area, so the higher
+			this gets, the more nodes each ray has to visit.
+
+			Every node counts the same. Weighing them by area, as the build's surface area
+			heuristic does, would leave the scene's ground sphere, whose nodes are thousands
+			of times the size of the rest, as the only thing that counts.
+		*/
+		float growth() const {
+			if (_builtAreas.empty() || _builtAreas.size() != _tree.nodes().size()) {
+				return 1.0f;
+			}
+			double total = 0.0;
+			for (size_t node = 0; node < _builtAreas.size(); node++) {
+				if (_builtAreas[node] > 0.0f) {
+					total += _tree.nodes()[node].bounds.surfaceArea() / _builtAreas[node];
+				} else {
+					total += 1.0;
+				}
+			}
+			return static_cast<float>(total / _builtAreas.size());
+		}
+
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			bool hitAnything = false;
+			if (_tree.nodes().empty()) {
+				// One plain loop per primitive type, with that type's test inlined
+				_primitives.forEachArray([&](const auto& primitives) {
+					typedef std::decay_t<decltype(primitives[0])> Primitive;
+					size_t index;
+					if (::closestHit(primitives.data(), primitives.size(), r, rayT, hit, index)) {
+						hitAnything = true;
+						rayT.max = hit.t;
+						claim(hit, PrimitiveHandle{ Primitives::typeOf<Primitive>(), static_cast<uint32_t>(index) });
+					}
+				});
+				return hitAnything;
+			}
+
+			// The primitives are in tree order, so a leaf is a run of the handle array
+			return _tree.traverseLeaves(r, rayT, [&](int begin, int end, Interval leafT, float& t) {
+				bool found = false;
+				for (int primitive = begin; primitive < end; primitive++) {
+					if (hitPrimitive(_handles[primitive], r, Interval(leafT.min, found ? t : leafT.max), hit)) {
+						found = true;
+						t = hit.t;
+					}
+				}
+				return found;
+			});
+		}
+
+		void hitAttributes(const Ray& r, const Hit& hit, Intersection& sect) const override {
+			_primitives.visit(PrimitiveHandle::unpack(hit.primitive), [&](const auto& primitive) { primitive.hitAttributes(r, hit.t, sect); });
+		}
+
+		// Each primitive tests the lanes that reached its leaf, each cut off at its closest hit so far
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			if (_tree.nodes().empty()) {
+				Surface::closestHitPacket(packet, hits);
+				return;
+			}
+
+			float closest[RayPacket::size];
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				closest[lane] = packet.tMax[lane];
+			}
+
+			_tree.traversePacket(packet, closest, [&](int primitive, uint32_t laneMask, float* laneClosest) {
+				const PrimitiveHandle handle = _handles[primitive];
+				for (int lane = 0; lane < RayPacket::size; lane++) {
+					if (!((laneMask >> lane) & 1u)) {
+						continue;
+					}
+					if (hitPrimitive(handle, packet.ray(lane), Interval(packet.tMin[lane], laneClosest[lane]), hits.closest[lane])) {
+						laneClosest[lane] = hits.closest[lane].t;
+						hits.hitMask |= 1u << lane;
+					}
+				}
+			});
+		}
+
+		AABB boundingBox() const override {
+			if (!_tree.nodes().empty()) {
+				return _tree.bounds();
+			}
+			AABB bounds;
+			_primitives.forEachArray([&](const auto& primitives) {
+				for (size_t i = 0; i < primitives.size(); i++) {
+					bounds.expand(primitives[i].boundingBox());
+				}
+			});
+			return bounds;
+		}
+
+	private:
+		// Declared first so it outlives the arrays that point into it
+		Arena _arena;
+		Primitives _primitives;
+		// Every primitive in the order it was added, which is what the BVH indexes
+		ArenaArray<PrimitiveHandle> _handles;
+		BVHTree _tree;
+		// The surface area of every node of the tree when it was built, for growth
+		std::vector<float> _builtAreas;
+
+		void saveBuiltAreas() {
+			_builtAreas.resize(_tree.nodes().size());
+			for (size_t node = 0; node < _builtAreas.size(); node++) {
+				_builtAreas[node] = _tree.nodes()[node].bounds.surfaceArea();
+			}
+		}
+
+		// The bounds of every primitive, in the order of the handle array
+		std::vector<AABB> primitiveBounds() const {
+			std::vector<AABB> bounds;
+			bounds.reserve(_handles.size());
+			for (const PrimitiveHandle& handle : _handles) {
+				bounds.push_back(_primitives.visit(handle, [](const auto& primitive) { return primitive.boundingBox(); }));
+			}
+			return bounds;
+		}
+
+		/*
+			Kept out of line: inlined, the sphere test and the virtual call make the leaf loop
+			big enough that the BVH traversal around it spills its registers, which costs more
+			than the call (nearly a third of the time per ray at 100k spheres). The dispatch on
+			the type inside it is still a switch, with each type's test inlined into it.
+			Only the distance and the primitive are kept while searching, and hitAttributes
+			works out the point and normal of the closest one.
+		*/
+		RENDY_NOINLINE bool hitPrimitive(PrimitiveHandle handle, const Ray& r, Interval rayT, Hit& hit) const {
+			if (!_primitives.visit(handle, [&](const auto& primitive) { return primitive.closestHit(r, rayT, hit); })) {
+				return false;
+			}
+			claim(hit, handle);
+			return true;
+		}
+
+		// A hit a primitive left for the scene to finish names the scene and the primitive's handle
+		void claim(Hit& hit, PrimitiveHandle handle) const {
+			if (!hit.surface) {
+				hit.surface = this;
+				hit.primitive = handle.pack();
+			}
+		}
+};
+
+#endif
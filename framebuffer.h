@@ -0,0 +1,60 @@
+#pragma once
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+	The Framebuffer is the in-memory render target that the Camera writes into.
+	Pixels are packed as 0x00RRGGBB in row-major order starting at the top left,
+	which is the same memory layout as a top-down 32-bit Windows DIB. That lets the
+	Win32 front end hand the whole buffer to GDI in one call, and lets the headless
+	front end write it straight out as an image file.
+*/
+class Framebuffer {
+	public:
+		Framebuffer() : _width(0), _height(0) {}
+		Framebuffer(int width, int height) { resize(width, height); }
+
+		void resize(int width, int height) {
+			_width = width;
+			_height = height;
+			_pixels.assign(static_cast<size_t>(width) * height, 0);
+		}
+
+		// Getters
+		const int width() const { return _width; }
+		const int height() const { return _height; }
+		const uint32_t* data() const { return _pixels.data(); }
+
+		uint32_t pixel(int i, int j) const { return _pixels[index(i, j)]; }
+		int r(int i, int j) const { return (pixel(i, j) >> 16) & 0xFF; }
+		int g(int i, int j) const { return (pixel(i, j) >> 8) & 0xFF; }
+		int b(int i, int j) const { return pixel(i, j) & 0xFF; }
+
+		/*
+			Store a pixel given its channels in the range [0, 255]. Channels are
+			clamped so that values slightly outside of the range never wrap around.
+		*/
+		void setPixel(int i, int j, float r, float g, float b) {
+			_pixels[index(i, j)] = (quantize(r) << 16) | (quantize(g) << 8) | quantize(b);
+		}
+
+		// Store a pixel already packed as 0x00RRGGBB, for example by a ToneMapper
+		void pixel(int i, int j, uint32_t packed) { _pixels[index(i, j)] = packed; }
+
+	private:
+		int _width;
+		int _height;
+		std::vector<uint32_t> _pixels;
+
+		size_t index(int i, int j) const { return static_cast<size_t>(j) * _width + i; }
+
+		static uint32_t quantize(float channel) {
+			return static_cast<uint32_t>((std::min)((std::max)(channel, 0.0f), 255.0f));
+		}
+};
+
+#endif
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include "accumulationBuffer.h"
+#include "framebuffer.h"
+#include "vec3.h"
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*
+	Image writers for the Framebuffer, and for the linear HDR image before it is tone
+	mapped. Each writer returns false if the file could not be opened or written so
+	the caller can report the failure.
+*/
+
+// Writes the framebuffer as a binary (P6) PPM
+inline bool writePPM(const std::string& path, const Framebuffer& framebuffer) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		return false;
+	}
+
+	out << "P6\n" << framebuffer.width() << ' ' << framebuffer.height() << "\n255\n";
+	std::vector<unsigned char> row(static_cast<size_t>(framebuffer.width()) * 3);
+	for (int j = 0; j < framebuffer.height(); j++) {
+		for (int i = 0; i < framebuffer.width(); i++) {
+			row[i * 3 + 0] = static_cast<unsigned char>(framebuffer.r(i, j));
+			row[i * 3 + 1] = static_cast<unsigned char>(framebuffer.g(i, j));
+			row[i * 3 + 2] = static_cast<unsigned char>(framebuffer.b(i, j));
+		}
+		out.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+
+	return static_cast<bool>(out);
+}
+
+namespace png {
+	inline uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0) {
+		static const std::array<uint32_t, 256> table = [] {
+			std::array<uint32_t, 256> t = {};
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) {
+					c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				}
+				t[n] = c;
+			}
+			return t;
+		}();
+
+		crc = ~crc;
+		for (size_t n = 0; n < length; n++) {
+			crc = table[(crc ^ data[n]) & 0xFF] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	inline void putU32(std::vector<unsigned char>& out, uint32_t value) {
+		out.push_back((value >> 24) & 0xFF);
+		out.push_back((value >> 16) & 0xFF);
+		out.push_back((value >> 8) & 0xFF);
+		out.push_back(value & 0xFF);
+	}
+
+	inline void writeChunk(std::ofstream& out, const char type[4], const std::vector<unsigned char>& data) {
+		std::vector<unsigned char> chunk;
+		putU32(chunk, static_cast<uint32_t>(data.size()));
+		chunk.insert(chunk.end(), type, type + 4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+		// The CRC covers the chunk type and data but not the length
+		putU32(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+		out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	}
+}
+
+/*
+	Writes the framebuffer as an 8-bit RGB PNG. The image data is stored in
+	uncompressed deflate blocks so that we don't need to pull in zlib; the files are
+	larger than a compressed PNG but any viewer can open them.
+
+	See: https://www.w3.org/TR/png/ and https://www.rfc-editor.org/rfc/rfc1950
+*/
+inline bool writePNG(const std::string& path, const Framebuffer& framebuffer) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		return false;
+	}
+
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<unsigned char> header;
+	png::putU32(header, framebuffer.width());
+	png::putU32(header, framebuffer.height());
+	header.push_back(8);	// Bit depth
+	header.push_back(2);	// Color type: RGB
+	header.push_back(0);	// Compression method
+	header.push_back(0);	// Filter method
+	header.push_back(0);	// No interlacing
+	png::writeChunk(out, "IHDR", header);
+
+	// Each scanline is prefixed with its filter type, which is always 0 (none) for us
+	std::vector<unsigned char> raw;
+	raw.reserve(static_cast<size_t>(framebuffer.width() * 3 + 1) * framebuffer.height());
+	for (int j = 0; j < framebuffer.height(); j++) {
+		raw.push_back(0);
+		for (int i = 0; i < framebuffer.width(); i++) {
+			raw.push_back(static_cast<unsigned char>(framebuffer.r(i, j)));
+			raw.push_back(static_cast<unsigned char>(framebuffer.g(i, j)));
+			raw.push_back(static_cast<unsigned char>(framebuffer.b(i, j)));
+		}
+	}
+
+	// Wrap the scanlines in a zlib stream made of stored (uncompressed) deflate blocks
+	std::vector<unsigned char> zlib = { 0x78, 0x01 };
+	const size_t maxBlock = 65535;
+	size_t offset = 0;
+	do {
+		size_t length = (std::min)(maxBlock, raw.size() - offset);
+		bool last = offset + length == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(length & 0xFF);
+		zlib.push_back((length >> 8) & 0xFF);
+		zlib.push_back(~length & 0xFF);
+		zlib.push_back((~length >> 8) & 0xFF);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+	} while (offset < raw.size());
+
+	uint32_t a = 1, b = 0;
+	for (unsigned char byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	png::putU32(zlib, (b << 16) | a);
+	png::writeChunk(out, "IDAT", zlib);
+	png::writeChunk(out, "IEND", {});
+
+	return static_cast<bool>(out);
+}
+
+/*
+	Writes a linear float image as a color PFM, the float counterpart of PPM, which
+	keeps every sample's light unclamped for compositing or tone mapping elsewhere.
+	color(i, j) gives the color of each pixel. PFM stores little-endian floats when
+	the scale on its third line is negative, and its rows from the bottom up.
+
+	See: https://netpbm.sourceforge.net/doc/pfm.html
+*/
+template <typename Color>
+bool writePFM(const std::string& path, int width, int height, Color&& color) {
+	std::ofstream out(path, std::ios::binary);
+	if (!out) {
+		return false;
+	}
+
+	out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+	std::vector<unsigned char> row(static_cast<size_t>(width) * 3 * 4);
+	for (int j = height - 1; j >= 0; j--) {
+		for (int i = 0; i < width; i++) {
+			const Vec3 pixel = color(i, j);
+			const float channels[3] = { pixel.x(), pixel.y(), pixel.z() };
+			for (int c = 0; c < 3; c++) {
+				uint32_t bits;
+				std::memcpy(&bits, &channels[c], sizeof(bits));
+				unsigned char* bytes = &row[(static_cast<size_t>(i) * 3 + c) * 4];
+				bytes[0] = bits & 0xFF;
+				bytes[1] = (bits >> 8) & 0xFF;
+				bytes[2] = (bits >> 16) & 0xFF;
+				bytes[3] = (bits >> 24) & 0xFF;
+			}
+		}
+		out.write(reinterpret_cast<const char*>(row.data()), row.size());
+	}
+
+	return static_cast<bool>(out);
+}
+
+// Writes the averaged samples of an accumulation buffer as a PFM
+inline bool writePFM(const std::string& path, const AccumulationBuffer& accumulation) {
+	return writePFM(path, accumulation.width(), accumulation.height(), [&](int i, int j) { return accumulation.average(i, j); });
+}
+
+// Whether a path names a PFM file, which has to be written from the linear image instead of a framebuffer
+inline bool isPfmFile(const std::string& path) {
+	return path.size() >= 4 && path.compare(path.size() - 4, 4, ".pfm") == 0;
+}
+
+// Writes the framebuffer in the format matching the extension of the path, defaulting to PPM
+inline bool writeImage(const std::string& path, const Framebuffer& framebuffer) {
+	if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0) {
+		return writePNG(path, framebuffer);
+	}
+	return writePPM(path, framebuffer);
+}
+
+#endif
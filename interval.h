@@ -10,6 +10,12 @@ class Interval {
 
 		Interval() : min(+infinity), max(-infinity) {}
 		Interval(float _min, float _max) : min(_min), max(_max) {}
+		// The smallest interval that encloses both intervals
+		Interval(const Interval& a, const Interval& b) : min(a.min <= b.min ? a.min : b.min), max(a.max >= b.max ? a.max : b.max) {}
+
+		float size() const {
+			return max - min;
+		}
 
 		bool contains(float x) const {
 			return min <= x && x <= max;
@@ -34,7 +40,7 @@ class Interval {
 		static const Interval empty, universe;
 };
 
-const static const Interval empty(+infinity, -infinity);
-const static const Interval universe(-infinity, +infinity);
+inline const Interval Interval::empty(+infinity, -infinity);
+inline const Interval Interval::universe(-infinity, +infinity);
 
 #endif // ! INTERVAL_H
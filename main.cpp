@@ -1,25 +1,92 @@
 #include "rendyUtils.h"
-#include "sphere.h"
+#include "bvh.h"
 #include "camera.h"
+#include "objFile.h"
+#include "progressiveRenderer.h"
+#include "renderJob.h"
+#include "sceneFile.h"
+#include "scenes.h"
+#include "rendyWindow.h"
 #include <windows.h>
 #include <tchar.h>
 
 int ALIAS_SAMPLES	= 10;
 int MAX_DEPTH		= 10;
+int ROULETTE_DEPTH	= 3;
+int TILE_SIZE		= 32;
+int THREAD_COUNT	= 0;
 int WINDOW_WIDTH	= 1920;
 float ASPECT_RATIO	= 16.0 / 9.0;
+// Run the preview through the denoiser, so it looks clean after a few samples
+bool DENOISE		= true;
+// Show a new view at 1/8, 1/4 and 1/2 resolution before the full resolution passes, so resizing stays responsive
+int PREVIEW_SCALE	= 8;
+// A scene file to render instead of the built-in scene, taken from the command line
+std::string SCENE_FILE;
 
-void rendyInit(HDC hdc) {
-	// Make our list of objects in our scene and add objects
-	SurfaceList sceneObjects;
-	// make_shared creates an object, in this case a sphere, and returns
-	// a shared_ptr to it
-	sceneObjects.add(std::make_shared<Sphere>(Vec3(0, 0, -1), 0.5));
-	sceneObjects.add(std::make_shared<Sphere>(Vec3(0, -100.5, -1), 100));
+// The renderer keeps the scene and the partially refined frame alive between paints,
+// so uncovering or moving the window only has to copy the cached frame back
+std::unique_ptr<ProgressiveRenderer> RENDERER;
+// The pass the renderer is adding on its own thread, if any. While it runs, only the
+// job touches RENDERER, and the window shows SHOWN, the frame of the last finished pass
+std::unique_ptr<RenderJob> PASS;
+Framebuffer SHOWN;
+// Posted by a pass when it is done, with its number, so a pass that was cancelled can't be mistaken for the current one
+const UINT WM_PASS_DONE = WM_APP + 1;
+WPARAM PASS_NUMBER = 0;
+
+/*
+	Load SCENE_FILE, or return null if it can't be read. An OBJ file becomes a triangle
+	mesh with its own BVH standing on the ground; any other file is a scene file whose
+	spheres go in a SphereBatch with its own BVH.
+*/
+std::shared_ptr<const Surface> loadSceneFile() {
+	if (isObjFile(SCENE_FILE)) {
+		auto mesh = std::make_shared<TriangleMesh>();
+		std::string error;
+		if (!loadObj(SCENE_FILE, *mesh, error)) {
+			MessageBoxA(NULL, error.c_str(), "Rendy", MB_OK);
+			return nullptr;
+		}
+		auto sceneObjects = std::make_shared<SurfaceList>();
+		buildMeshScene(*sceneObjects, mesh);
+		mesh->build(THREAD_COUNT);
+		return sceneObjects;
+	}
+
+	auto batch = std::make_shared<SphereBatch>();
+	std::string error;
+	if (!loadScene(SCENE_FILE, *batch, error)) {
+		MessageBoxA(NULL, error.c_str(), "Rendy", MB_OK);
+		return nullptr;
+	}
+	batch->buildBVH(THREAD_COUNT);
+	return batch;
+}
+
+void rendyInit() {
+	std::shared_ptr<const Surface> world;
+	if (!SCENE_FILE.empty()) {
+		world = loadSceneFile();
+	}
+	if (!world) {
+		// Make our list of objects in our scene and add objects
+		SurfaceList sceneObjects;
+		buildDefaultScene(sceneObjects);
+		// Put the objects in a BVH so rays only test the objects they might hit
+		world = std::make_shared<BVH>(sceneObjects);
+	}
 	// Create our Camera object
 	Camera camera = Camera(WINDOW_WIDTH, ASPECT_RATIO);
-	// Render our scene
-	camera.render(ALIAS_SAMPLES, MAX_DEPTH, sceneObjects, hdc);
+	RenderSettings settings;
+	settings.aliasSamples = ALIAS_SAMPLES;
+	settings.maxDepth = MAX_DEPTH;
+	settings.rouletteDepth = ROULETTE_DEPTH;
+	settings.tileSize = TILE_SIZE;
+	settings.threadCount = THREAD_COUNT;
+	RENDERER = std::make_unique<ProgressiveRenderer>(world, camera, settings);
+	RENDERER->denoise(DENOISE);
+	RENDERER->preview(PREVIEW_SCALE);
 }
 
 
@@ -36,16 +103,45 @@ LRESULT CALLBACK WindowProc(
 	case WM_PAINT:
 		PAINTSTRUCT ps;
 		hdc = BeginPaint(hWnd, &ps);
-		rendyInit(hdc);
+		if (!RENDERER) {
+			rendyInit();
+		}
+		// Make sure there is something to show the first time the frame is painted,
+		// the message loop adds the rest of the passes while the window is idle
+		if (!PASS && RENDERER->passCount() == 0) {
+			RENDERER->refine();
+			SHOWN = RENDERER->frame();
+		}
+		blitFramebuffer(hdc, SHOWN);
 		EndPaint(hWnd, &ps);
 		break;
+	case WM_PASS_DONE:
+		// Show the pass's frame, unless it was cancelled and its job is already gone
+		if (PASS && wParam == PASS_NUMBER) {
+			PASS->wait();
+			if (PASS->completed()) {
+				SHOWN = RENDERER->frame();
+				InvalidateRect(hWnd, NULL, FALSE);
+			}
+			PASS.reset();
+		}
+		break;
 	case WM_SIZE:
-		WINDOW_WIDTH = LOWORD(lParam);
+		// Only a real change of size needs a new render; minimizing reports a width of zero
+		if (LOWORD(lParam) > 0 && LOWORD(lParam) != WINDOW_WIDTH) {
+			WINDOW_WIDTH = LOWORD(lParam);
+			// The pass in flight is for the old size: cancelling it only waits for the tiles already being traced
+			PASS.reset();
+			if (RENDERER) {
+				RENDERER->restart(Camera(WINDOW_WIDTH, ASPECT_RATIO));
+			}
+		}
 		break;
 	case WM_CLOSE:
 		DestroyWindow(hWnd);
 		break;
 	case WM_DESTROY:
+		PASS.reset();
 		PostQuitMessage(0);
 		break;
 	default:
@@ -63,6 +159,12 @@ int WINAPI WinMain(
 	_In_ int nCmdShow
 ) {
 
+	// The command line, if there is one, is the path of a scene file to render
+	SCENE_FILE = lpCmdLine;
+	if (SCENE_FILE.size() >= 2 && SCENE_FILE.front() == '"' && SCENE_FILE.back() == '"') {
+		SCENE_FILE = SCENE_FILE.substr(1, SCENE_FILE.size() - 2);
+	}
+
 	static TCHAR szWindowClass[] = _T("Rendy");
 	static TCHAR szTitle[] = _T("Rendy");
 
@@ -144,10 +246,34 @@ int WINAPI WinMain(
 	UpdateWindow(hWnd);
 
 	// Message loop
+	/*
+		Messages are handled as they come in. Whenever the queue is empty, no pass is
+		running and the frame isn't finished yet, we start another pass as a RenderJob
+		on its own thread, so the image refines while the window is idle: first the low
+		resolution previews, then one more sample for every pixel at a time. The pass
+		posts WM_PASS_DONE when it is done, which shows its frame. Messages keep being
+		handled while it runs, and a resize cancels it, so the new size only waits for
+		the tiles that were already being traced. Otherwise we sleep until the next
+		message arrives.
+	*/
 	MSG message;
-	while (GetMessage(&message, NULL, 0, 0)) {
-		TranslateMessage(&message);
-		DispatchMessage(&message);
+	while (true) {
+		if (PeekMessage(&message, NULL, 0, 0, PM_REMOVE)) {
+			if (message.message == WM_QUIT) {
+				break;
+			}
+			TranslateMessage(&message);
+			DispatchMessage(&message);
+		} else if (RENDERER && !PASS && !RENDERER->converged()) {
+			const WPARAM number = ++PASS_NUMBER;
+			PASS = std::make_unique<RenderJob>([hWnd, number](const RenderControl& control) {
+				const bool finished = RENDERER->refine(1, control);
+				PostMessage(hWnd, WM_PASS_DONE, number, 0);
+				return finished;
+			});
+		} else {
+			WaitMessage();
+		}
 	}
 
 	return 0;
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+	A read-only view of a whole file. The file is memory-mapped, so the operating
+	system pages it in as it is read instead of it being copied into a buffer first.
+*/
+class MappedFile {
+	public:
+		MappedFile() : _data(nullptr), _size(0) {}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile() { close(); }
+
+		bool open(const std::string& path) {
+			close();
+#ifdef _WIN32
+			_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (_file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER size;
+			if (!GetFileSizeEx(_file, &size)) {
+				close();
+				return false;
+			}
+			_size = static_cast<size_t>(size.QuadPart);
+			if (_size == 0) {
+				return true;
+			}
+			_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (_mapping == NULL) {
+				close();
+				return false;
+			}
+			_data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+			int file = ::open(path.c_str(), O_RDONLY);
+			if (file < 0) {
+				return false;
+			}
+			struct stat info;
+			if (fstat(file, &info) != 0) {
+				::close(file);
+				return false;
+			}
+			_size = static_cast<size_t>(info.st_size);
+			if (_size == 0) {
+				::close(file);
+				return true;
+			}
+			void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, file, 0);
+			// The mapping keeps the file alive on its own
+			::close(file);
+			if (data == MAP_FAILED) {
+				_size = 0;
+				return false;
+			}
+			// The file is read front to back, so let the kernel read ahead aggressively
+			madvise(data, _size, MADV_SEQUENTIAL);
+			_data = static_cast<const char*>(data);
+#endif
+			if (_data == nullptr) {
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (_data != nullptr) {
+				UnmapViewOfFile(_data);
+			}
+			if (_mapping != NULL) {
+				CloseHandle(_mapping);
+			}
+			if (_file != INVALID_HANDLE_VALUE) {
+				CloseHandle(_file);
+			}
+			_mapping = NULL;
+			_file = INVALID_HANDLE_VALUE;
+#else
+			if (_data != nullptr) {
+				munmap(const_cast<char*>(_data), _size);
+			}
+#endif
+			_data = nullptr;
+			_size = 0;
+		}
+
+		// Getters
+		const char* data() const { return _data; }
+		const size_t size() const { return _size; }
+
+	private:
+		const char* _data;
+		size_t _size;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = NULL;
+#endif
+};
+
+#endif
@@ -0,0 +1,186 @@
+#pragma once
+#ifndef OBJFILE_H
+#define OBJFILE_H
+
+#include "mappedFile.h"
+#include "triangleMesh.h"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+/*
+	Loading triangle meshes from Wavefront OBJ files, the plain text format most
+	modelling tools can export.
+
+	Only the geometry is read: vertex positions ("v x y z") and faces ("f a b c ...").
+	A face lists vertex numbers counting from 1, or counting back from the latest
+	vertex if negative, each optionally followed by texture and normal numbers
+	("a/t/n", "a//n") which are skipped. Faces with more than three corners are split
+	into a fan of triangles. Texture coordinates, normals, groups, materials and
+	everything else are ignored.
+
+	The file is memory-mapped and parsed in place, one line at a time, straight into
+	the mesh's vertex and index arrays. A first pass counts the vertices and faces so
+	those arrays are allocated once at their final size, and nothing the size of the
+	file is ever held besides the mapping itself.
+*/
+
+namespace objFile {
+	inline bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	// Call f(begin, end) for every line of the text, without the newline
+	template <typename F>
+	inline bool forEachLine(const char* data, size_t size, F&& f) {
+		const char* end = data + size;
+		for (const char* line = data; line < end; ) {
+			const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if (lineEnd == nullptr) {
+				lineEnd = end;
+			}
+			if (!f(line, lineEnd)) {
+				return false;
+			}
+			line = lineEnd + 1;
+		}
+		return true;
+	}
+
+	// Move cursor past the leading whitespace of a line, and lineEnd back to the # of a comment
+	inline void trimLine(const char*& cursor, const char*& lineEnd) {
+		while (cursor < lineEnd && isSpace(*cursor)) {
+			cursor++;
+		}
+		const char* comment = static_cast<const char*>(std::memchr(cursor, '#', lineEnd - cursor));
+		if (comment != nullptr) {
+			lineEnd = comment;
+		}
+	}
+
+	// If the line starts with the keyword followed by a space, move cursor past it
+	inline bool startsWith(const char*& cursor, const char* lineEnd, const char* keyword) {
+		const size_t length = std::strlen(keyword);
+		if (static_cast<size_t>(lineEnd - cursor) <= length || std::memcmp(cursor, keyword, length) != 0 || !isSpace(cursor[length])) {
+			return false;
+		}
+		cursor += length;
+		return true;
+	}
+}
+
+// Whether the path names an OBJ file rather than a scene file
+inline bool isObjFile(const std::string& path) {
+	const std::string obj = ".obj";
+	return path.size() >= obj.size() && path.compare(path.size() - obj.size(), obj.size(), obj) == 0;
+}
+
+/*
+	Load the triangles of an OBJ file into the mesh, replacing anything it held. On
+	failure, returns false with a description of the problem in error. The mesh's
+	BVH is not built.
+*/
+inline bool loadObj(const std::string& path, TriangleMesh& mesh, std::string& error) {
+	using namespace objFile;
+
+	MappedFile file;
+	if (!file.open(path)) {
+		error = "could not open " + path;
+		return false;
+	}
+
+	// Count the vertices and faces first, so the mesh's arrays are allocated once
+	size_t vertexLines = 0;
+	size_t faceLines = 0;
+	forEachLine(file.data(), file.size(), [&](const char* cursor, const char* lineEnd) {
+		trimLine(cursor, lineEnd);
+		if (startsWith(cursor, lineEnd, "v")) {
+			vertexLines++;
+		} else if (startsWith(cursor, lineEnd, "f")) {
+			faceLines++;
+		}
+		return true;
+	});
+
+	mesh = TriangleMesh();
+	mesh.reserve(vertexLines, faceLines);
+
+	int lineNumber = 0;
+	const bool loaded = forEachLine(file.data(), file.size(), [&](const char* cursor, const char* lineEnd) {
+		lineNumber++;
+		auto skipSpace = [&]() {
+			while (cursor < lineEnd && isSpace(*cursor)) {
+				cursor++;
+			}
+		};
+		trimLine(cursor, lineEnd);
+
+		if (startsWith(cursor, lineEnd, "v")) {
+			float position[3];
+			for (int axis = 0; axis < 3; axis++) {
+				skipSpace();
+				std::from_chars_result result = std::from_chars(cursor, lineEnd, position[axis]);
+				if (result.ec != std::errc()) {
+					error = "line " + std::to_string(lineNumber) + ": expected \"v x y z\"";
+					return false;
+				}
+				cursor = result.ptr;
+			}
+			mesh.addVertex(Vec3(position[0], position[1], position[2]));
+		} else if (startsWith(cursor, lineEnd, "f")) {
+			uint32_t first = 0;
+			uint32_t previous = 0;
+			int corners = 0;
+			while (true) {
+				skipSpace();
+				if (cursor == lineEnd) {
+					break;
+				}
+				long long number;
+				std::from_chars_result result = std::from_chars(cursor, lineEnd, number);
+				if (result.ec != std::errc()) {
+					error = "line " + std::to_string(lineNumber) + ": expected vertex numbers after \"f\"";
+					return false;
+				}
+				cursor = result.ptr;
+				// Skip the texture and normal numbers
+				while (cursor < lineEnd && !isSpace(*cursor)) {
+					cursor++;
+				}
+
+				const long long vertexCount = static_cast<long long>(mesh.vertexCount());
+				const long long index = number < 0 ? vertexCount + number : number - 1;
+				if (number == 0 || index < 0 || index >= vertexCount) {
+					error = "line " + std::to_string(lineNumber) + ": vertex " + std::to_string(number) + " does not exist";
+					return false;
+				}
+
+				const uint32_t vertex = static_cast<uint32_t>(index);
+				if (corners == 0) {
+					first = vertex;
+				} else if (corners >= 2) {
+					mesh.addTriangle(first, previous, vertex);
+				}
+				previous = vertex;
+				corners++;
+			}
+			if (corners < 3) {
+				error = "line " + std::to_string(lineNumber) + ": a face needs at least three vertices";
+				return false;
+			}
+		}
+		return true;
+	});
+
+	if (!loaded) {
+		error = path + ": " + error;
+		mesh = TriangleMesh();
+		return false;
+	}
+	// Faces with more than three corners made more triangles than were reserved for
+	mesh.shrinkToFit();
+	return true;
+}
+
+#endif
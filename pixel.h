@@ -3,49 +3,120 @@
 #define COLOR_H
 
 #include "rendyUtils.h"
+#include "renderStats.h"
+#include "sampler.h"
 #include "surface.h"
-#include <windows.h>
+#include <algorithm>
 #include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 class Pixel : public Vec3 {
 	private:
 		int _vpI;
 		int _vpJ;
 
-		Vec3 color(int depth, const Surface& sceneObjects, const Ray& r) {
-			// If there is an intersection of this ray, color the pixel
-			// based on the normal of this intersection
-			Intersection sect;
-			Vec3 color;
-			const float reflectance = 0.5;
-			if (depth <= 0 ) {
-				return Vec3(0, 0, 0);
-			} else if (sceneObjects.intersect(r, Interval(0.001, infinity), sect)) {
-				Vec3 direction = sect.normal + randomUnitVectorInUnitSphere();
-				color = this->color(depth-1, sceneObjects, Ray(sect.point, direction)) * reflectance;
-			} else {
-				// If there is no collision, color the pixel along a blue->white gradient based on the y direction
-				float scalar = 0.5 * (unit(r.direction()).y() + 1.0);
-				color = (Vec3(1.0, 1.0, 1.0) * (1.0 - scalar)) + (Vec3(0.5, 0.7, 1.0) * scalar);
+		/*
+			Follow the path of a ray as it bounces through the scene and return the
+			light it carries back to the camera.
+
+			Instead of recursing once per bounce, the path is followed in a loop that
+			carries its throughput: the fraction of the light found at the end of the path
+			that makes it back to the camera. Each diffuse bounce multiplies it by the
+			reflectance. This keeps the stack flat however large maxDepth is.
+
+			After rouletteDepth bounces, Russian roulette ends the path with a probability
+			that grows as the throughput shrinks, since a dim path can barely change the
+			pixel. Paths that survive have their throughput divided by the survival
+			probability, so on average the result is the same as tracing every path to
+			maxDepth (unbiased), but far fewer bounces are traced. A negative rouletteDepth
+			turns Russian roulette off.
+
+			See: https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/Russian_Roulette_and_Splitting
+
+			If primaryKnown is set, primaryHit and primarySect already hold the closest
+			intersection of r, for example from tracing it as part of a RayPacket.
+		*/
+		Vec3 color(
+			int maxDepth,
+			int rouletteDepth,
+			const Surface& sceneObjects,
+			Ray r,
+			bool primaryKnown = false,
+			bool primaryHit = false,
+			const Intersection& primarySect = Intersection()
+		) {
+			Vec3 throughput = Vec3(1.0, 1.0, 1.0);
+
+			for (int bounce = 0; bounce < maxDepth; bounce++) {
+				// Every bounce draws from its own random stream
+				Rng::local().bounce(maxDepth - bounce);
+				if (bounce == 0) {
+					RENDY_STAT(primaryRays);
+				} else {
+					RENDY_STAT(bounceRays);
+				}
+
+				// If there is an intersection of this ray, bounce in a random direction
+				// around the normal of this intersection
+				Intersection sect;
+				bool hit;
+				if (bounce == 0 && primaryKnown) {
+					hit = primaryHit;
+					sect = primarySect;
+				} else {
+					hit = sceneObjects.intersect(r, Interval(0.001, infinity), sect);
+				}
+
+				if (!hit) {
+					RENDY_STAT(pathsToSky);
+					RENDY_STAT_DEPTH(bounce);
+					return throughput * sky(r);
+				}
+
+				if (!scatter(bounce, rouletteDepth, sect, r, throughput)) {
+					return Vec3(0, 0, 0);
+				}
 			}
 
-			return color;
+			// The path ran out of bounces without reaching the sky
+			RENDY_STAT(pathsTruncated);
+			RENDY_STAT_DEPTH(maxDepth);
+			return Vec3(0, 0, 0);
+		}
+
+		// The color stays linear: gamma is applied once to the averaged pixel (see toneMapper.h)
+		void setColor(const Vec3& color) {
+			this->x(color.x());
+			this->y(color.y());
+			this->z(color.z());
 		}
 
 	public:
 		/*
 			Color the pixel that the ray hits in the viewport.
 
+			const int maxDepth: the maximum number of bounces of the path
+			const int rouletteDepth: bounces before Russian roulette may end the path, negative to disable
 			const Surface& sceneObjects: a pointer to a list of objects in the scene
 			const Ray& r: the ray coming from the camera to the viewport
 		*/
-		Pixel(const int maxDepth, const Surface& sceneObjects, const Ray& r, int vpI, int vpJ) {
+		Pixel(const int maxDepth, const int rouletteDepth, const Surface& sceneObjects, const Ray& r, int vpI, int vpJ) {
 			_vpI = vpI;
 			_vpJ = vpJ;
-			Vec3 color = this->color(maxDepth, sceneObjects, r);
-			this->x(gammaTransform(color.x()));
-			this->y(gammaTransform(color.y()));
-			this->z(gammaTransform(color.z()));
+			setColor(this->color(maxDepth, rouletteDepth, sceneObjects, r));
+		}
+
+		/*
+			Color the pixel when the camera ray has already been intersected with the
+			scene, for example as one lane of a RayPacket. hit and sect are the result of
+			that intersection. The random stream for the sample must already be seeded.
+		*/
+		Pixel(const int maxDepth, const int rouletteDepth, const Surface& sceneObjects, const Ray& r, bool hit, const Intersection& sect, int vpI, int vpJ) {
+			_vpI = vpI;
+			_vpJ = vpJ;
+			setColor(this->color(maxDepth, rouletteDepth, sceneObjects, r, true, hit, sect));
 		}
 
 		Pixel(float r, float g, float b, int vpI, int vpJ) {
@@ -64,14 +135,57 @@ class Pixel : public Vec3 {
 			_vpJ = vpJ;
 		}
 
+		// The light of the sky a ray that hits nothing sees: a blue->white gradient based on the y direction
+		static Vec3 sky(const Ray& r) {
+			float scalar = 0.5 * (unit(r.direction()).y() + 1.0);
+			return (Vec3(1.0, 1.0, 1.0) * (1.0 - scalar)) + (Vec3(0.5, 0.7, 1.0) * scalar);
+		}
+
+		/*
+			Bounce a path off the diffuse surface it hit: r becomes the ray leaving sect in
+			a random direction around its normal, and the throughput takes the reflectance
+			and, once bounce reaches rouletteDepth, Russian roulette. Returns false if
+			Russian roulette ended the path. The random stream of the bounce must already
+			be selected.
+		*/
+		static bool scatter(int bounce, int rouletteDepth, const Intersection& sect, Ray& r, Vec3& throughput) {
+			const float reflectance = 0.5;
+			const Sampler& sampler = Sampler::local();
+
+			// Both give directions with the cosine weighted distribution of a diffuse surface
+			Vec3 direction;
+			if (sampler.independent()) {
+				direction = sect.normal + randomUnitVectorInUnitSphere();
+			} else {
+				float u, v;
+				sampler.get2D(Sampler::bounceDimension(bounce), u, v);
+				direction = cosineDirection(sect.normal, u, v);
+			}
+			r = Ray(sect.point, direction);
+			throughput = throughput * reflectance;
+
+			if (rouletteDepth >= 0 && bounce + 1 >= rouletteDepth) {
+				float survival = (std::min)(1.0f, (std::max)(throughput.x(), (std::max)(throughput.y(), throughput.z())));
+				const float roll = sampler.independent() ? random_float() : sampler.get1D(Sampler::rouletteDimension(bounce));
+				if (roll >= survival) {
+					RENDY_STAT(pathsKilled);
+					RENDY_STAT_DEPTH(bounce + 1);
+					return false;
+				}
+				throughput = throughput / survival;
+			}
+			return true;
+		}
+
 		// Setters and Getters
-		const float r() const { return static_cast<int>(255.999 * this->x()); }
+		// The channels as gamma corrected 8-bit levels
+		const float r() const { return static_cast<int>(255.999 * gammaTransform(this->x())); }
 		void r(float r) { this->x(r); }
 
-		const float g() const { return static_cast<int>(255.999 * this->y()); }
+		const float g() const { return static_cast<int>(255.999 * gammaTransform(this->y())); }
 		void g(float g) { this->y(g); }
 
-		const float b() const { return static_cast<int>(255.999 * this->z()); }
+		const float b() const { return static_cast<int>(255.999 * gammaTransform(this->z())); }
 		void b(float b) { this->z(b); }
 
 		const int vpI() const { return _vpI; }
@@ -80,17 +194,20 @@ class Pixel : public Vec3 {
 		const int vpJ() const { return _vpJ; }
 		void vpJ(int vpJ) { _vpJ = vpJ; }
 
+#ifdef _WIN32
 		// Get the Windows COLORREF from the RGB triplet
 		COLORREF getColorRef() {
 			return RGB(this->r(), this->g(), this->b());
 		}
+#endif
 
-		Vec3 getColorVector() {
-			return Vec3(this->r(), this->g(), this->b());
+		// The linear light the sample carried back, which is what the camera adds up
+		Vec3 getColorVector() const {
+			return Vec3(this->x(), this->y(), this->z());
 		}
 
-		float gammaTransform(float channel) {
-			return sqrt(channel);
+		static float gammaTransform(float channel) {
+			return sqrt((std::min)(channel, 1.0f));
 		}
 };
 
@@ -0,0 +1,243 @@
+#pragma once
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include "rendyUtils.h"
+#include "aabb.h"
+#include "arena.h"
+#include "sphere.h"
+#include "surface.h"
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+	Primitives as plain values instead of Surfaces.
+
+	Every Surface is tested through the virtual intersect, so a loop over a list of
+	them makes an indirect call per object that the compiler can't see through: the
+	sphere test can't be inlined into the loop, let alone unrolled or vectorized
+	across objects.
+
+	A primitive type here is a small struct without a vtable that provides
+
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const
+		void hitAttributes(const Ray& r, float t, Intersection& sect) const
+		AABB boundingBox() const
+
+	as ordinary inline member functions. closestHit works like Surface::closestHit,
+	except that a primitive leaves hit.surface null when the hit is its own: the
+	scene holding it then fills in itself and the primitive's handle, and later hands
+	the hit back to the primitive's hitAttributes. A scene names the full set of primitive
+	types it can hold up front, as the template arguments of PrimitiveArrays, and
+	keeps one array per type. Because the set is closed, the type of a primitive is a
+	small number, and picking the right intersect for it is a switch the compiler
+	writes out at compile time rather than a call through a pointer.
+
+	The scene itself is still a Surface, so the rest of the renderer doesn't know
+	the difference.
+*/
+
+// The plain data of a sphere, without the vtable pointer that Sphere carries as a Surface
+struct SphereData {
+	Vec3 center;
+	float radius;
+
+	RENDY_FORCEINLINE bool closestHit(const Ray& r, Interval rayT, Hit& hit) const {
+		float t;
+		if (!hitSphere(center, radius, r, rayT, t)) {
+			return false;
+		}
+		hit.t = t;
+		hit.surface = nullptr;
+		return true;
+	}
+
+	void hitAttributes(const Ray& r, float t, Intersection& sect) const {
+		sphereHitAttributes(center, radius, r, t, sect);
+	}
+
+	AABB boundingBox() const {
+		Vec3 extent = Vec3(radius, radius, radius);
+		return AABB(center - extent, center + extent);
+	}
+};
+
+/*
+	Any other Surface, tested through its virtual intersect. It keeps the set of
+	primitive types open to surfaces that don't have a value type of their own, at
+	the cost of the virtual call for those alone. Its hits are the surface's own, so
+	the surface finishes them and hitAttributes is never called.
+*/
+struct SurfaceRef {
+	const Surface* surface;
+
+	bool closestHit(const Ray& r, Interval rayT, Hit& hit) const {
+		return surface->closestHit(r, rayT, hit);
+	}
+
+	void hitAttributes(const Ray&, float, Intersection&) const {
+		assert(false && "the hits of a SurfaceRef belong to its surface");
+		std::abort();
+	}
+
+	AABB boundingBox() const {
+		return surface->boundingBox();
+	}
+};
+
+/*
+	The closest hit within rayT among count primitives of one type, stored one after
+	another, with the position of the primitive hit in index. Since the type is known,
+	its closestHit is inlined into the loop.
+*/
+template <typename T>
+inline bool closestHit(const T* primitives, size_t count, const Ray& r, Interval rayT, Hit& hit, size_t& index) {
+	bool hitAnything = false;
+	for (size_t i = 0; i < count; i++) {
+		if (primitives[i].closestHit(r, rayT, hit)) {
+			hitAnything = true;
+			rayT.max = hit.t;
+			index = i;
+		}
+	}
+	return hitAnything;
+}
+
+/*
+	Names a primitive by its type, the position of the type in the list of
+	PrimitiveArrays, and its index in that type's array
+*/
+struct PrimitiveHandle {
+	uint32_t type;
+	uint32_t index;
+
+	// The largest index a handle can be packed with
+	static const uint32_t maxIndex = 0x0FFFFFFFu;
+
+	// The handle in the 32 bits of Hit::primitive: the type in the top 4 and the index in the rest
+	uint32_t pack() const { return (type << 28) | index; }
+	static PrimitiveHandle unpack(uint32_t packed) {
+		PrimitiveHandle handle;
+		handle.type = packed >> 28;
+		handle.index = packed & maxIndex;
+		return handle;
+	}
+};
+
+namespace primitives {
+	// The position of T in Types
+	template <typename T, typename First, typename... Rest>
+	constexpr uint32_t typeIndex() {
+		if constexpr (std::is_same<T, First>::value) {
+			return 0;
+		} else {
+			static_assert(sizeof...(Rest) > 0, "not one of the primitive types");
+			return 1 + typeIndex<T, Rest...>();
+		}
+	}
+}
+
+/*
+	One arena-backed array for each primitive type in Types. visit looks a handle's
+	primitive up and calls a function with it as its real type, and forEachArray
+	hands over each array in turn, so a loop over one type's primitives is an
+	ordinary loop the compiler can inline the test into.
+*/
+template <typename... Types>
+class PrimitiveArrays {
+	static_assert(sizeof...(Types) <= 16, "a packed PrimitiveHandle has 4 bits for the type");
+
+	public:
+		explicit PrimitiveArrays(Arena& arena) : _arrays(ArenaArray<Types>(arena)...) {}
+
+		template <typename T>
+		static constexpr uint32_t typeOf() { return primitives::typeIndex<T, Types...>(); }
+
+		// Throws std::length_error past PrimitiveHandle::maxIndex primitives of one type, which a handle can't name
+		template <typename T>
+		PrimitiveHandle add(const T& primitive) {
+			ArenaArray<T>& primitives = array<T>();
+			if (primitives.size() > PrimitiveHandle::maxIndex) {
+				throw std::length_error("too many primitives of one type for a PrimitiveHandle");
+			}
+			primitives.push_back(primitive);
+			PrimitiveHandle handle;
+			handle.type = typeOf<T>();
+			handle.index = static_cast<uint32_t>(primitives.size() - 1);
+			return handle;
+		}
+
+		template <typename T>
+		void reserve(size_t count) { array<T>().reserve(count); }
+
+		// Forget every primitive, keeping the storage
+		void clear() {
+			std::apply([](auto&... arrays) { (arrays.clear(), ...); }, _arrays);
+		}
+
+		// Call visitor with the primitive the handle names, as its own type
+		template <typename Visitor>
+		decltype(auto) visit(PrimitiveHandle handle, Visitor&& visitor) const {
+			return visitIn<0>(_arrays, handle, std::forward<Visitor>(visitor));
+		}
+
+		/*
+			Rearrange the arrays into the order of the handles in order, which must name
+			every primitive once, and return the primitives' new handles in that order
+		*/
+		std::vector<PrimitiveHandle> reorder(const std::vector<PrimitiveHandle>& order) {
+			std::tuple<std::vector<Types>...> saved(std::vector<Types>(array<Types>().begin(), array<Types>().end())...);
+			clear();
+			std::vector<PrimitiveHandle> handles;
+			handles.reserve(order.size());
+			for (const PrimitiveHandle& handle : order) {
+				visitIn<0>(saved, handle, [&](const auto& primitive) { handles.push_back(add(primitive)); });
+			}
+			return handles;
+		}
+
+		// Call f with the array of each type in turn
+		template <typename F>
+		void forEachArray(F&& f) const {
+			std::apply([&](const auto&... arrays) { (f(arrays), ...); }, _arrays);
+		}
+
+		// Getters
+		template <typename T>
+		ArenaArray<T>& array() { return std::get<ArenaArray<T>>(_arrays); }
+		template <typename T>
+		const ArenaArray<T>& array() const { return std::get<ArenaArray<T>>(_arrays); }
+		template <typename T>
+		const T& get(PrimitiveHandle handle) const { return array<T>()[handle.index]; }
+		template <typename T>
+		T& get(PrimitiveHandle handle) { return array<T>()[handle.index]; }
+		const size_t size() const {
+			size_t total = 0;
+			forEachArray([&](const auto& primitives) { total += primitives.size(); });
+			return total;
+		}
+
+	private:
+		std::tuple<ArenaArray<Types>...> _arrays;
+
+		// Unrolls into a chain of comparisons against constants, which the compiler turns into a switch
+		template <size_t I, typename Arrays, typename Visitor>
+		static decltype(auto) visitIn(Arrays& arrays, PrimitiveHandle handle, Visitor&& visitor) {
+			if constexpr (I + 1 == sizeof...(Types)) {
+				return visitor(std::get<I>(arrays)[handle.index]);
+			} else {
+				if (handle.type == I) {
+					return visitor(std::get<I>(arrays)[handle.index]);
+				}
+				return visitIn<I + 1>(arrays, handle, std::forward<Visitor>(visitor));
+			}
+		}
+};
+
+#endif
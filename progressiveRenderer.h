@@ -0,0 +1,163 @@
+#pragma once
+#ifndef PROGRESSIVERENDERER_H
+#define PROGRESSIVERENDERER_H
+
+#include "accumulationBuffer.h"
+#include "camera.h"
+#include "denoiser.h"
+#include "featureBuffer.h"
+#include "framebuffer.h"
+#include "surface.h"
+#include "threadPool.h"
+#include <memory>
+
+/*
+	Keeps a scene, a camera and a partially rendered frame alive between redraws.
+
+	The frame starts out with no samples and every call to refine adds a few more to
+	each pixel, until settings.aliasSamples have been traced. Showing the frame again
+	costs nothing but a copy of the cached framebuffer; only restart, for a new camera
+	or scene, throws the accumulated samples away.
+
+	With denoising on, the frame is the accumulated samples run through the Denoiser,
+	so the first few passes already show a clean, if soft, preview.
+
+	With a preview scale of 8, the first passes after a restart render one sample per
+	pixel at 1/8, 1/4 and 1/2 of the frame's width and height, each blown up to fill
+	the frame, before the samples at full resolution start. The first of those costs
+	1/64 of a full resolution pass, so a resized window shows the new view almost at
+	once, and every pass is a separate call to refine, so a restart in between throws
+	away no more than one pass of work. Running each pass as a RenderJob (see
+	renderJob.h) cuts that down to a tile: the Win32 build cancels the pass in flight
+	as soon as the window is resized.
+*/
+class ProgressiveRenderer {
+	public:
+		ProgressiveRenderer(std::shared_ptr<const Surface> world, const Camera& camera, const RenderSettings& settings)
+			: _world(world), _camera(camera), _settings(settings), _pool(settings.threadCount), _toneMapper(settings.exposure, settings.gamma) {
+			restart(camera);
+		}
+
+		// Start over with a new camera, for example after the window was resized
+		void restart(const Camera& camera) {
+			_camera = camera;
+			_previewScale = _largestPreviewScale;
+			_passCount = 0;
+			_accumulation.resize(camera.imageWidth(), camera.imageHeight());
+			_features.resize(camera.imageWidth(), camera.imageHeight());
+			_accumulation.resolve(_frame, _toneMapper);
+		}
+
+		// Start over with a new scene
+		void restart(std::shared_ptr<const Surface> world) {
+			_world = world;
+			restart(_camera);
+		}
+
+		/*
+			Add up to samples more samples per pixel, stopping at settings.aliasSamples,
+			and update the frame.
+
+			control can stop the pass partway through (see RenderJob), for example when the
+			window is resized during it. Since only some pixels have the new samples then,
+			the frame starts over as if restarted, and refine returns false.
+		*/
+		bool refine(int samples = 1, const RenderControl& control = RenderControl()) {
+			if (_previewScale > 1) {
+				return refinePreview(control);
+			}
+			samples = (std::min)(samples, _settings.aliasSamples - _accumulation.sampleCount());
+			if (samples <= 0) {
+				return true;
+			}
+			if (!_camera.accumulate(_settings, *_world, _accumulation, samples, _pool, _denoise ? &_features : nullptr, control)) {
+				restart(_camera);
+				return false;
+			}
+			_passCount++;
+			if (_denoise) {
+				_denoiser.denoise(_accumulation, _features, _frame, _toneMapper, _pool);
+			} else {
+				_accumulation.resolve(_frame, _toneMapper);
+			}
+			return true;
+		}
+
+		// Turning denoising on or off starts the frame over, since the features are only gathered while it is on
+		void denoise(bool enabled) {
+			if (enabled != _denoise) {
+				_denoise = enabled;
+				restart(_camera);
+			}
+		}
+
+		/*
+			Start every frame with low resolution passes, the first at 1 / largestScale of
+			the frame's size and each one after it at twice the resolution of the last.
+			1 turns them off. Changing it starts the frame over.
+		*/
+		void preview(int largestScale) {
+			largestScale = (std::max)(largestScale, 1);
+			if (largestScale != _largestPreviewScale) {
+				_largestPreviewScale = largestScale;
+				restart(_camera);
+			}
+		}
+
+		// Getters
+		const bool converged() const { return _accumulation.sampleCount() >= _settings.aliasSamples; }
+		// How many passes the frame has had, previews included
+		const int passCount() const { return _passCount; }
+		// The fraction of the frame's size the next pass renders at is 1 / previewScale
+		const int previewScale() const { return _previewScale; }
+		const int sampleCount() const { return _accumulation.sampleCount(); }
+		const Camera& camera() const { return _camera; }
+		const Framebuffer& frame() const { return _frame; }
+		const bool denoising() const { return _denoise; }
+
+		// The linear color of a pixel of the frame, before it was tone mapped
+		const Vec3 color(int i, int j) const {
+			if (_accumulation.sampleCount() == 0) {
+				const float scaleX = static_cast<float>(_preview.width()) / _frame.width();
+				const float scaleY = static_cast<float>(_preview.height()) / _frame.height();
+				return _preview.sampleCount() > 0 ? _preview.average((i + 0.5f) * scaleX, (j + 0.5f) * scaleY) : Vec3(0, 0, 0);
+			}
+			return _denoise ? _denoiser.color(i, j) : _accumulation.average(i, j);
+		}
+
+	private:
+		std::shared_ptr<const Surface> _world;
+		Camera _camera;
+		RenderSettings _settings;
+		ThreadPool _pool;
+		ToneMapper _toneMapper;
+		AccumulationBuffer _accumulation;
+		FeatureBuffer _features;
+		Denoiser _denoiser;
+		bool _denoise = false;
+		Framebuffer _frame;
+		// The low resolution image of the last preview pass
+		AccumulationBuffer _preview;
+		int _largestPreviewScale = 1;
+		int _previewScale = 1;
+		int _passCount = 0;
+
+		// Render one sample per pixel at 1 / _previewScale of the frame's size and stretch it over the frame
+		bool refinePreview(const RenderControl& control) {
+			const int width = _camera.imageWidth();
+			const int height = _camera.imageHeight();
+			const float aspectRatio = static_cast<float>(width) / height;
+			const Camera camera((std::max)(width / _previewScale, 1), aspectRatio, _camera.cameraCenter());
+			_preview.clear();
+			if (!camera.accumulate(_settings, *_world, _preview, 1, _pool, nullptr, control)) {
+				restart(_camera);
+				return false;
+			}
+			_preview.resolve(_frame, _toneMapper, width, height, _pool);
+			_previewScale /= 2;
+			_passCount++;
+			return true;
+		}
+};
+
+#endif
@@ -16,7 +16,8 @@ class Ray {
 		// Getters
 		Vec3 origin() const { return orig; }
 		Vec3 direction() const { return dir; }
-		Vec3 at(float t) const { return orig + (dir*t); }
+		// One fused multiply-add where the CPU has it
+		Vec3 at(float t) const { return mulAdd(dir, t, orig); }
 };
 
 #endif
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef RAYPACKET_H
+#define RAYPACKET_H
+
+#include "rendyUtils.h"
+#include "aabb.h"
+#include <cstdint>
+
+/*
+	A bundle of rays traced together, stored as a structure of arrays with one lane
+	per ray. Camera uses it for the primary rays of a 4x4 block of neighbouring
+	pixels: those rays start at the same point and point in nearly the same direction,
+	so they tend to visit the same BVH nodes and spheres. Testing a node once for the
+	whole packet amortizes the memory traffic and the traversal decisions.
+
+	Each lane has its own Interval of t, stored as separate tMin and tMax arrays so the
+	lane loops can load them as vectors. Lanes whose bit is clear in activeMask (for
+	example pixels past the edge of a tile) are ignored everywhere.
+*/
+struct RayPacket {
+	static const int width = 4;
+	static const int size = width * width;
+
+	float ox[size], oy[size], oz[size];
+	float dx[size], dy[size], dz[size];
+	// Reciprocal directions for the slab test, filled in by prepare()
+	float invDx[size], invDy[size], invDz[size];
+	float tMin[size], tMax[size];
+	uint32_t activeMask = 0;
+
+	void setRay(int lane, const Ray& r, Interval interval) {
+		Vec3 origin = r.origin();
+		Vec3 direction = r.direction();
+		ox[lane] = origin.x();
+		oy[lane] = origin.y();
+		oz[lane] = origin.z();
+		dx[lane] = direction.x();
+		dy[lane] = direction.y();
+		dz[lane] = direction.z();
+		setInterval(lane, interval);
+		activeMask |= 1u << lane;
+	}
+
+	// Call once all rays are set and before the packet is traced
+	void prepare() {
+		for (int lane = 0; lane < size; lane++) {
+			// Give inactive lanes a harmless ray so the lane loops never read garbage
+			if (!active(lane)) {
+				ox[lane] = oy[lane] = oz[lane] = 0;
+				dx[lane] = dy[lane] = dz[lane] = 1;
+				setInterval(lane, Interval::empty);
+			}
+			invDx[lane] = 1.0f / dx[lane];
+			invDy[lane] = 1.0f / dy[lane];
+			invDz[lane] = 1.0f / dz[lane];
+		}
+	}
+
+	bool active(int lane) const { return (activeMask >> lane) & 1u; }
+
+	Interval rayT(int lane) const { return Interval(tMin[lane], tMax[lane]); }
+	void setInterval(int lane, Interval interval) {
+		tMin[lane] = interval.min;
+		tMax[lane] = interval.max;
+	}
+
+	Ray ray(int lane) const {
+		return Ray(Vec3(ox[lane], oy[lane], oz[lane]), Vec3(dx[lane], dy[lane], dz[lane]));
+	}
+
+	/*
+		Slab test of every lane in laneMask against the box, where lane l is only
+		interested in hits closer than closest[l] rather than its own tMax. Returns
+		the mask of lanes that hit the box, and the smallest entry distance among
+		them in tNearest.
+
+		The loop over lanes is written without branches (min/max instead of swapping
+		the slab distances) so that the compiler can vectorize it.
+	*/
+	uint32_t hitBox(const AABB& box, uint32_t laneMask, const float* closest, float& tNearest) const {
+		float tEnter[size];
+		bool hit[size];
+		for (int lane = 0; lane < size; lane++) {
+			float tx0 = (box.x.min - ox[lane]) * invDx[lane];
+			float tx1 = (box.x.max - ox[lane]) * invDx[lane];
+			float ty0 = (box.y.min - oy[lane]) * invDy[lane];
+			float ty1 = (box.y.max - oy[lane]) * invDy[lane];
+			float tz0 = (box.z.min - oz[lane]) * invDz[lane];
+			float tz1 = (box.z.max - oz[lane]) * invDz[lane];
+			float tNear = (std::max)((std::max)((std::min)(tx0, tx1), (std::min)(ty0, ty1)), (std::max)((std::min)(tz0, tz1), tMin[lane]));
+			float tFar = (std::min)((std::min)((std::max)(tx0, tx1), (std::max)(ty0, ty1)), (std::min)((std::max)(tz0, tz1), closest[lane]));
+			tEnter[lane] = tNear;
+			hit[lane] = tNear <= tFar;
+		}
+
+		uint32_t mask = 0;
+		tNearest = infinity;
+		for (int lane = 0; lane < size; lane++) {
+			if (((laneMask >> lane) & 1u) && hit[lane]) {
+				mask |= 1u << lane;
+				tNearest = (std::min)(tNearest, tEnter[lane]);
+			}
+		}
+		return mask;
+	}
+};
+
+#endif
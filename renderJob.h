@@ -0,0 +1,151 @@
+#pragma once
+#ifndef RENDERJOB_H
+#define RENDERJOB_H
+
+#include "camera.h"
+#include "framebuffer.h"
+#include "stopToken.h"
+#include "surface.h"
+#include "threadPool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+	A render running on a thread of its own, so that whoever started it can carry on
+	handling messages, or start other work, and throw it away the moment its result is
+	no longer wanted (for example a frame of a window that has since been resized).
+
+	The job runs its work once, handing it a RenderControl (see camera.h) whose
+	StopToken the job's cancel sets, and whose tileDone keeps count of the finished
+	tiles for progress before passing each one on to the job's own tileDone. Since the
+	Camera checks the token before every tile, a cancelled job stops within one tile:
+	wait returns once the tiles that were already being traced are finished.
+
+	The work must return true if it ran to the end and false if it was stopped, like
+	Camera::render. Whatever the work writes, such as a framebuffer, belongs to the job
+	until it is done, except for the pixels of tiles already passed to tileDone.
+	Destroying a job that is still running cancels it and waits for it, so a job
+	never outlives what it renders into, as long as those outlive the job.
+
+	The work runs on the job's thread and drives the thread pool it renders with, and a
+	ThreadPool can only run one parallelFor at a time, so a pool must not be used by
+	anything else while a job is using it.
+*/
+class RenderJob {
+	public:
+		using Work = std::function<bool(const RenderControl& control)>;
+		using TileCallback = std::function<void(const TileProgress& tile)>;
+
+		RenderJob(Work work, TileCallback tileDone = nullptr)
+			: _tileDone(std::move(tileDone)), _tilesDone(0), _tileCount(0), _done(false), _completed(false) {
+			_thread = std::thread([this, work = std::move(work)] { run(work); });
+		}
+
+		// Render a frame of the camera into the framebuffer with Camera::render
+		static std::unique_ptr<RenderJob> render(
+			const Camera& camera,
+			const RenderSettings& settings,
+			std::shared_ptr<const Surface> world,
+			Framebuffer& framebuffer,
+			ThreadPool& pool,
+			TileCallback tileDone = nullptr
+		) {
+			return std::make_unique<RenderJob>([camera, settings, world, &framebuffer, &pool](const RenderControl& control) {
+				return camera.render(settings, *world, framebuffer, pool, control);
+			}, std::move(tileDone));
+		}
+
+		~RenderJob() {
+			cancel();
+			wait();
+		}
+
+		RenderJob(const RenderJob&) = delete;
+		RenderJob& operator=(const RenderJob&) = delete;
+
+		// Ask the work to stop. No new tile starts after this, and the job is done once the running ones are
+		void cancel() { _stop.requestStop(); }
+
+		// Block until the job is done. Only the thread that owns the job may wait for it
+		void wait() {
+			if (_thread.joinable()) {
+				_thread.join();
+			}
+		}
+
+		// Block until the job is done or the timeout runs out, returning whether it is done
+		template <typename Rep, typename Period>
+		bool waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+			std::unique_lock<std::mutex> lock(_mutex);
+			return _finished.wait_for(lock, timeout, [this] { return _done; });
+		}
+
+		// Getters
+		const bool done() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _done;
+		}
+		// Whether the work ran to the end, rather than being cancelled or still running
+		const bool completed() const {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _completed;
+		}
+		const bool cancelled() const { return _stop.stopRequested(); }
+		StopToken stopToken() const { return _stop.token(); }
+
+		// The tiles finished so far, of the tiles of the render, which is zero until the first one is done
+		const int tilesDone() const { return _tilesDone.load(std::memory_order_relaxed); }
+		const int tileCount() const { return _tileCount.load(std::memory_order_relaxed); }
+
+		// The fraction of the render that is done, from 0 to 1
+		const float progress() const {
+			if (completed()) {
+				return 1.0f;
+			}
+			const int count = tileCount();
+			return count > 0 ? static_cast<float>(tilesDone()) / count : 0.0f;
+		}
+
+	private:
+		StopSource _stop;
+		TileCallback _tileDone;
+		std::atomic<int> _tilesDone;
+		std::atomic<int> _tileCount;
+
+		mutable std::mutex _mutex;
+		std::condition_variable _finished;
+		bool _done;
+		bool _completed;
+
+		// Started last, once everything it uses is ready
+		std::thread _thread;
+
+		void run(const Work& work) {
+			RenderControl control;
+			control.stop = _stop.token();
+			control.tileDone = [this](const TileProgress& tile) {
+				// Tiles finish in any order on the pool's threads, so only ever raise the count
+				int done = _tilesDone.load(std::memory_order_relaxed);
+				while (done < tile.tilesDone && !_tilesDone.compare_exchange_weak(done, tile.tilesDone, std::memory_order_relaxed)) {}
+				_tileCount.store(tile.tileCount, std::memory_order_relaxed);
+				if (_tileDone) {
+					_tileDone(tile);
+				}
+			};
+
+			const bool completed = work(control);
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_completed = completed;
+				_done = true;
+			}
+			_finished.notify_all();
+		}
+};
+
+#endif
@@ -0,0 +1,192 @@
+#pragma once
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+	Counters for where the work of a frame goes: how many rays are traced, how many
+	objects and BVH nodes they are tested against, how often the rejection loop in
+	randomInUnitSphere has to retry, and how many bounces paths last.
+
+	Every thread counts into its own RenderStats, so counting is just an increment
+	with no locks or atomics, and RenderStats::collect adds them all up once the frame
+	is done. The counters are only compiled in when RENDY_STATS is defined (the CMake
+	option of the same name); otherwise the RENDY_STAT macros expand to nothing and the
+	renderer runs exactly as if they weren't there.
+*/
+struct RenderStats {
+	// Paths that last longer than this many bounces share the last bin of the histogram
+	static const int depthBins = 32;
+
+	// Camera rays and the rays of every bounce after them
+	uint64_t primaryRays = 0;
+	uint64_t bounceRays = 0;
+	// Calls to Surface::intersect on any surface, including the ones inside lists and BVHs
+	uint64_t intersectCalls = 0;
+	// Ray-sphere tests, and how many of them found an intersection
+	uint64_t sphereTests = 0;
+	uint64_t sphereHits = 0;
+	// Ray-triangle tests, and how many of them found an intersection
+	uint64_t triangleTests = 0;
+	uint64_t triangleHits = 0;
+	// BVH nodes visited, once per node for a whole packet
+	uint64_t bvhNodeVisits = 0;
+	// Calls to randomInUnitSphere and the points it drew to answer them
+	uint64_t unitSphereCalls = 0;
+	uint64_t unitSphereIterations = 0;
+	// How paths ended: escaping to the sky, Russian roulette, or running out of bounces
+	uint64_t pathsToSky = 0;
+	uint64_t pathsKilled = 0;
+	uint64_t pathsTruncated = 0;
+	// Number of paths that ended after each number of bounces
+	uint64_t depthHistogram[depthBins] = {};
+
+	uint64_t rays() const { return primaryRays + bounceRays; }
+	uint64_t paths() const { return pathsToSky + pathsKilled + pathsTruncated; }
+
+	void recordDepth(int bounces) {
+		depthHistogram[(std::min)((std::max)(bounces, 0), depthBins - 1)]++;
+	}
+
+	void merge(const RenderStats& other) {
+		primaryRays += other.primaryRays;
+		bounceRays += other.bounceRays;
+		intersectCalls += other.intersectCalls;
+		sphereTests += other.sphereTests;
+		sphereHits += other.sphereHits;
+		triangleTests += other.triangleTests;
+		triangleHits += other.triangleHits;
+		bvhNodeVisits += other.bvhNodeVisits;
+		unitSphereCalls += other.unitSphereCalls;
+		unitSphereIterations += other.unitSphereIterations;
+		pathsToSky += other.pathsToSky;
+		pathsKilled += other.pathsKilled;
+		pathsTruncated += other.pathsTruncated;
+		for (int bin = 0; bin < depthBins; bin++) {
+			depthHistogram[bin] += other.depthHistogram[bin];
+		}
+	}
+
+	// Print the totals for a frame that took the given number of seconds
+	void report(std::FILE* file, double seconds) const {
+		const double rayCount = static_cast<double>((std::max)(rays(), uint64_t(1)));
+		std::fprintf(file, "Rays:           %llu (%llu primary, %llu bounce)\n",
+			static_cast<unsigned long long>(rays()), static_cast<unsigned long long>(primaryRays), static_cast<unsigned long long>(bounceRays));
+		if (seconds > 0) {
+			std::fprintf(file, "Mrays/s:        %.2f\n", rays() / seconds * 1e-6);
+		}
+		std::fprintf(file, "Intersects:     %.2f per ray\n", intersectCalls / rayCount);
+		std::fprintf(file, "Sphere tests:   %.2f per ray, %.1f%% hit\n",
+			sphereTests / rayCount, 100.0 * sphereHits / (std::max)(sphereTests, uint64_t(1)));
+		if (triangleTests > 0) {
+			std::fprintf(file, "Triangle tests: %.2f per ray, %.1f%% hit\n",
+				triangleTests / rayCount, 100.0 * triangleHits / triangleTests);
+		}
+		std::fprintf(file, "BVH nodes:      %.2f per ray\n", bvhNodeVisits / rayCount);
+		std::fprintf(file, "Unit sphere:    %.3f points per call\n",
+			static_cast<double>(unitSphereIterations) / (std::max)(unitSphereCalls, uint64_t(1)));
+
+		const double pathCount = static_cast<double>((std::max)(paths(), uint64_t(1)));
+		std::fprintf(file, "Paths:          %.1f%% reached the sky, %.1f%% ended by roulette, %.1f%% hit max depth\n",
+			100.0 * pathsToSky / pathCount, 100.0 * pathsKilled / pathCount, 100.0 * pathsTruncated / pathCount);
+
+		int lastBin = 0;
+		uint64_t largestBin = 1;
+		for (int bin = 0; bin < depthBins; bin++) {
+			if (depthHistogram[bin] > 0) {
+				lastBin = bin;
+			}
+			largestBin = (std::max)(largestBin, depthHistogram[bin]);
+		}
+		std::fprintf(file, "Path depth (bounces):\n");
+		for (int bin = 0; bin <= lastBin; bin++) {
+			int bar = static_cast<int>(50.0 * depthHistogram[bin] / largestBin);
+			std::fprintf(file, "  %2d%s %6.2f%% %s\n", bin, bin == depthBins - 1 ? "+" : " ",
+				100.0 * depthHistogram[bin] / pathCount, std::string(bar, '#').c_str());
+		}
+	}
+
+	// The counters of the calling thread
+	static RenderStats& local();
+
+	/*
+		Add up the counters of every thread. Call it while no thread is counting, for
+		example once the frame's parallelFor has returned.
+	*/
+	static RenderStats collect();
+
+	// Zero the counters of every thread, to start counting a new frame
+	static void reset();
+};
+
+namespace renderStats {
+	// The counters of every live thread, and the totals of threads that have exited
+	struct Registry {
+		std::mutex mutex;
+		std::vector<RenderStats*> threads;
+		RenderStats finished;
+	};
+
+	inline Registry& registry() {
+		static Registry registry;
+		return registry;
+	}
+
+	// Registers a thread's counters on first use, and keeps its totals when it exits
+	struct ThreadStats {
+		RenderStats counters;
+
+		ThreadStats() {
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().threads.push_back(&counters);
+		}
+
+		~ThreadStats() {
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			registry().finished.merge(counters);
+			registry().threads.erase(std::find(registry().threads.begin(), registry().threads.end(), &counters));
+		}
+	};
+}
+
+inline RenderStats& RenderStats::local() {
+	thread_local renderStats::ThreadStats stats;
+	return stats.counters;
+}
+
+inline RenderStats RenderStats::collect() {
+	renderStats::Registry& registry = renderStats::registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	RenderStats total = registry.finished;
+	for (const RenderStats* stats : registry.threads) {
+		total.merge(*stats);
+	}
+	return total;
+}
+
+inline void RenderStats::reset() {
+	renderStats::Registry& registry = renderStats::registry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.finished = RenderStats();
+	for (RenderStats* stats : registry.threads) {
+		*stats = RenderStats();
+	}
+}
+
+#ifdef RENDY_STATS
+#define RENDY_STAT(counter) (RenderStats::local().counter++)
+#define RENDY_STAT_ADD(counter, amount) (RenderStats::local().counter += (amount))
+#define RENDY_STAT_DEPTH(bounces) (RenderStats::local().recordDepth(bounces))
+#else
+#define RENDY_STAT(counter) ((void)0)
+#define RENDY_STAT_ADD(counter, amount) ((void)0)
+#define RENDY_STAT_DEPTH(bounces) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,444 @@
+#include "rendyUtils.h"
+#include "benchmark.h"
+#include "bvh.h"
+#include "camera.h"
+#include "flatScene.h"
+#include "scenes.h"
+#include "simd.h"
+#include "threadPool.h"
+#include "toneMapper.h"
+#include "triangleMesh.h"
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+	Benchmarks for the render kernels, from single Vec3 operations up to whole frames.
+
+	Every benchmark uses fixed seeds, so two runs measure exactly the same work and
+	their results can be compared. The intersection and render benchmarks are run over
+	a range of scene sizes to show how they scale.
+
+	--json file writes the results as JSON ("-" for stdout), --filter text only runs the
+	benchmarks whose name contains text, --min-time seconds sets how long each measurement
+	runs, and --threads N sets the thread count of the frame renders.
+*/
+
+double MIN_TIME		= 0.2;
+int THREAD_COUNT	= 0;
+std::string FILTER;
+std::string JSON_OUTPUT;
+
+// How many rays or vectors the per operation benchmarks cycle through
+const int INPUT_COUNT = 1024;
+
+/*
+	Forwards to another surface and counts the rays traced against it, so the frame
+	benchmarks can report Mrays/s. It only counts calls made on it directly, not the ones
+	the wrapped surface makes to its children.
+*/
+class CountingSurface : public Surface {
+	public:
+		CountingSurface(const Surface& surface) : _surface(surface), _rays(0) {}
+
+		// The hits are the wrapped surface's, so it finishes them itself
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			_rays.fetch_add(1, std::memory_order_relaxed);
+			return _surface.closestHit(r, rayT, hit);
+		}
+
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			int lanes = 0;
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				lanes += packet.active(lane);
+			}
+			_rays.fetch_add(lanes, std::memory_order_relaxed);
+			_surface.closestHitPacket(packet, hits);
+		}
+
+		void hitAttributes(const Ray&, const Hit&, Intersection&) const override {
+			assert(false && "CountingSurface passes the wrapped surface's hits on");
+			std::abort();
+		}
+
+		AABB boundingBox() const override { return _surface.boundingBox(); }
+
+		// Getters
+		const long long rays() const { return _rays.load(); }
+
+	private:
+		const Surface& _surface;
+		mutable std::atomic<long long> _rays;
+};
+
+// Camera rays through random points of a 320x180 image, the same every run
+std::vector<Ray> cameraRays(const Camera& camera) {
+	std::vector<Ray> rays;
+	Rng rng(1);
+	for (int n = 0; n < INPUT_COUNT; n++) {
+		int i = static_cast<int>(rng.nextFloat() * camera.imageWidth());
+		int j = static_cast<int>(rng.nextFloat() * camera.imageHeight());
+		Rng::local().seed(n, 0, 0);
+		rays.push_back(camera.getRay(camera.pixelCenter(i, j)));
+	}
+	return rays;
+}
+
+void benchmarkVec3(BenchmarkRunner& runner) {
+	std::vector<Vec3> vectors;
+	Rng::local().seed(0, 0, 0);
+	for (int n = 0; n < INPUT_COUNT; n++) {
+		vectors.push_back(Vec3::random(-1, 1));
+	}
+	const int mask = INPUT_COUNT - 1;
+
+	runner.run("vec3_add", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(vectors[n & mask] + vectors[(n + 1) & mask]);
+		}
+	});
+	runner.run("vec3_dot", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(dot(vectors[n & mask], vectors[(n + 1) & mask]));
+		}
+	});
+	runner.run("vec3_cross", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(cross(vectors[n & mask], vectors[(n + 1) & mask]));
+		}
+	});
+	runner.run("vec3_unit", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(unit(vectors[n & mask]));
+		}
+	});
+	runner.run("vec3_fast_unit", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(fastUnit(vectors[n & mask]));
+		}
+	});
+}
+
+void benchmarkSampling(BenchmarkRunner& runner, const Camera& camera) {
+	runner.run("random_in_unit_sphere", 0, 0, [&](long long operations) {
+		Rng::local().seed(0, 0, 0);
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(randomInUnitSphere());
+		}
+	});
+
+	// The numbers one diffuse bounce draws, its direction and its Russian roulette roll, from each sampler
+	const Vec3 normal = unit(Vec3(0.3f, 1.0f, -0.2f));
+	runner.run("bounce_sample_random", 0, 0, [&](long long operations) {
+		Rng::local().seed(0, 0, 0);
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(normal + randomUnitVectorInUnitSphere());
+			doNotOptimize(random_float());
+		}
+	});
+	for (SamplerType type : { SamplerType::Stratified, SamplerType::Sobol, SamplerType::BlueNoise }) {
+		runner.run(std::string("bounce_sample_") + samplerTypeName(type), 0, 0, [&](long long operations) {
+			Sampler sampler;
+			for (long long n = 0; n < operations; n++) {
+				sampler.start(type, static_cast<int>(n & 255), static_cast<int>((n >> 8) & 255), 256, static_cast<uint32_t>(n >> 16), 16, 0);
+				float u, v;
+				sampler.get2D(Sampler::bounceDimension(1), u, v);
+				doNotOptimize(cosineDirection(normal, u, v));
+				doNotOptimize(sampler.get1D(Sampler::rouletteDimension(1)));
+			}
+		});
+	}
+
+	runner.run("camera_get_ray", 0, 0, [&](long long operations) {
+		Rng::local().seed(0, 0, 0);
+		const int width = camera.imageWidth();
+		const int pixels = width * camera.imageHeight();
+		for (long long n = 0; n < operations; n++) {
+			int pixel = static_cast<int>(n % pixels);
+			doNotOptimize(camera.getRay(camera.pixelCenter(pixel % width, pixel / width)));
+		}
+	});
+}
+
+/*
+	Turning one averaged linear pixel into a framebuffer pixel: with the ToneMapper's
+	table, and with a pow per channel, which is what the table stands in for
+*/
+void benchmarkToneMap(BenchmarkRunner& runner) {
+	std::vector<Vec3> colors;
+	Rng::local().seed(0, 0, 0);
+	for (int n = 0; n < INPUT_COUNT; n++) {
+		colors.push_back(Vec3::random(0, 1.2f));
+	}
+	const int mask = INPUT_COUNT - 1;
+
+	ToneMapper toneMapper(1.0f, 2.2f);
+	runner.run("tonemap_pixel_table", 0, 0, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			doNotOptimize(toneMapper.pack(colors[n & mask]));
+		}
+	});
+	runner.run("tonemap_pixel_pow", 0, 0, [&](long long operations) {
+		Framebuffer framebuffer(1, 1);
+		const float inverseGamma = 1.0f / 2.2f;
+		for (long long n = 0; n < operations; n++) {
+			const Vec3& color = colors[n & mask];
+			framebuffer.setPixel(0, 0, 255.999f * std::pow(color.x(), inverseGamma), 255.999f * std::pow(color.y(), inverseGamma),
+				255.999f * std::pow(color.z(), inverseGamma));
+			doNotOptimize(framebuffer.pixel(0, 0));
+		}
+	});
+}
+
+// Time the closest hit of the camera rays against surface, one ray per operation
+void benchmarkIntersect(BenchmarkRunner& runner, const std::string& name, long long size, const Surface& surface, const std::vector<Ray>& rays) {
+	const int mask = INPUT_COUNT - 1;
+	runner.run(name, size, 1, [&](long long operations) {
+		for (long long n = 0; n < operations; n++) {
+			Intersection sect;
+			doNotOptimize(surface.intersect(rays[n & mask], Interval(0.001, infinity), sect));
+			doNotOptimize(sect.t);
+		}
+	});
+}
+
+// A rippled n by n grid of quads, two triangles each, filling the view in front of the camera
+void buildRippleMesh(TriangleMesh& mesh, int n) {
+	mesh.reserve(static_cast<size_t>(n + 1) * (n + 1), 2 * static_cast<size_t>(n) * n);
+	for (int j = 0; j <= n; j++) {
+		for (int i = 0; i <= n; i++) {
+			float x = -4.0f + 8.0f * i / n;
+			float z = -0.5f - 8.0f * j / n;
+			mesh.addVertex(Vec3(x, -0.5f + 0.2f * std::sin(3.0f * x) * std::sin(3.0f * z), z));
+		}
+	}
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) {
+			uint32_t corner = static_cast<uint32_t>(j * (n + 1) + i);
+			mesh.addTriangle(corner, corner + 1, corner + n + 2);
+			mesh.addTriangle(corner, corner + n + 2, corner + n + 1);
+		}
+	}
+}
+
+void benchmarkIntersection(BenchmarkRunner& runner, const Camera& camera) {
+	std::vector<Ray> rays = cameraRays(camera);
+
+	Sphere sphere = Sphere(Vec3(0, 0, -1), 0.5);
+	benchmarkIntersect(runner, "sphere_intersect", 1, sphere, rays);
+
+	for (int count : { 2, 8, 32, 128, 512 }) {
+		SurfaceList sceneObjects;
+		buildRandomSpheresScene(sceneObjects, count - 2, 0);
+		benchmarkIntersect(runner, "surface_list_intersect", count, sceneObjects, rays);
+	}
+
+	for (int count : { 2, 32, 512, 8192, 131072 }) {
+		if (!runner.enabled("bvh_intersect")) {
+			break;
+		}
+		SurfaceList sceneObjects;
+		buildRandomSpheresScene(sceneObjects, count - 2, 0);
+		BVH bvh = BVH(sceneObjects, THREAD_COUNT);
+		benchmarkIntersect(runner, "bvh_intersect", count, bvh, rays);
+	}
+
+	for (int count : { 2, 32, 512, 8192, 131072 }) {
+		if (!runner.enabled("flat_scene_intersect")) {
+			break;
+		}
+		FlatScene scene;
+		buildRandomSpheresFlatScene(scene, count - 2, 0);
+		scene.build(THREAD_COUNT);
+		benchmarkIntersect(runner, "flat_scene_intersect", count, scene, rays);
+	}
+
+	for (int n : { 1, 4, 16, 64, 256 }) {
+		if (!runner.enabled("triangle_mesh_intersect")) {
+			break;
+		}
+		TriangleMesh mesh;
+		buildRippleMesh(mesh, n);
+		mesh.build(THREAD_COUNT);
+		benchmarkIntersect(runner, "triangle_mesh_intersect", static_cast<long long>(mesh.triangleCount()), mesh, rays);
+	}
+}
+
+/*
+	Time the same spheres tested through the virtual Surface::intersect and through
+	the closed set of primitive types of a FlatScene, where the sphere test is
+	inlined. Without a BVH every sphere is tested, which shows the cost of the
+	dispatch alone (compare surface_list_intersect). With one, the scene of Sphere
+	surfaces has the same tree and the same order as flat_scene_intersect, and only
+	the call differs.
+*/
+void benchmarkDispatch(BenchmarkRunner& runner, const Camera& camera) {
+	std::vector<Ray> rays = cameraRays(camera);
+
+	for (int count : { 2, 8, 32, 128, 512 }) {
+		if (!runner.enabled("flat_list_intersect")) {
+			break;
+		}
+		FlatScene scene;
+		buildRandomSpheresFlatScene(scene, count - 2, 0);
+		benchmarkIntersect(runner, "flat_list_intersect", count, scene, rays);
+	}
+
+	for (int count : { 2, 32, 512, 8192, 131072 }) {
+		if (!runner.enabled("flat_scene_virtual_intersect")) {
+			break;
+		}
+		FlatScene scene;
+		scene.addSurface<Sphere>(Vec3(0, 0, -1), 0.5f);
+		scene.addSurface<Sphere>(Vec3(0, -100.5, -1), 100.0f);
+		scatterSpheres(count - 2, 0, [&](const Vec3& center, float radius) {
+			scene.addSurface<Sphere>(center, radius);
+		});
+		scene.build(THREAD_COUNT);
+		benchmarkIntersect(runner, "flat_scene_virtual_intersect", count, scene, rays);
+	}
+}
+
+/*
+	Time filling a scene with spheres, one scene per operation: a SurfaceList
+	allocates every Sphere on its own, while a FlatScene appends them to arrays in
+	its arena. Both are torn down inside the timing too.
+*/
+void benchmarkSceneBuild(BenchmarkRunner& runner) {
+	for (int count : { 1000, 100000 }) {
+		runner.run("surface_list_build", count, 0, [&](long long operations) {
+			for (long long n = 0; n < operations; n++) {
+				SurfaceList sceneObjects;
+				buildRandomSpheresScene(sceneObjects, count - 2, 0);
+				doNotOptimize(sceneObjects.objects.data());
+			}
+		});
+		runner.run("flat_scene_build", count, 0, [&](long long operations) {
+			for (long long n = 0; n < operations; n++) {
+				FlatScene scene;
+				buildRandomSpheresFlatScene(scene, count - 2, 0);
+				doNotOptimize(scene.size());
+			}
+		});
+	}
+}
+
+/*
+	Time full frames of the default scene with extra spheres scattered around, one
+	frame per operation. The rays of a frame are counted once up front; every frame
+	traces the same ones since the render is deterministic.
+*/
+void benchmarkRender(BenchmarkRunner& runner) {
+	ThreadPool pool(THREAD_COUNT);
+	Camera camera = Camera(320, 16.0 / 9.0);
+	RenderSettings settings;
+	settings.aliasSamples = 4;
+	settings.threadCount = pool.threadCount();
+	Framebuffer framebuffer;
+
+	for (int count : { 2, 1000, 100000 }) {
+		// One path at a time, then a bounce of every path of the tile at a time (see wavefront.h)
+		for (bool wavefront : { false, true }) {
+			std::string name = wavefront ? "render_wavefront_320x180_4spp" : "render_320x180_4spp";
+			if (!runner.enabled(name)) {
+				continue;
+			}
+			settings.wavefront = wavefront;
+
+			SurfaceList sceneObjects;
+			buildRandomSpheresScene(sceneObjects, count - 2, 0);
+			BVH bvh = BVH(sceneObjects, THREAD_COUNT);
+
+			CountingSurface counter = CountingSurface(bvh);
+			camera.render(settings, counter, framebuffer, pool);
+
+			runner.run(name, count, static_cast<double>(counter.rays()), [&](long long operations) {
+				for (long long n = 0; n < operations; n++) {
+					camera.render(settings, bvh, framebuffer, pool);
+				}
+			});
+		}
+	}
+}
+
+// A JSON object describing the machine and build, so results from different runs can be told apart
+std::string context() {
+	char date[32];
+	std::time_t now = std::time(nullptr);
+	std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+#if defined(__clang__)
+	std::string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+	std::string compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+	std::string compiler = "msvc " + std::to_string(_MSC_VER);
+#else
+	std::string compiler = "unknown";
+#endif
+
+	return "{\"date\": \"" + std::string(date) + "\", \"compiler\": \"" + compiler
+		+ "\", \"threads\": " + std::to_string(ThreadPool(THREAD_COUNT).threadCount())
+		+ ", \"simd\": \"" + simdLevelName(detectSimdLevel()) + "\", \"vec3\": \"" + vec3Backend() + "\"}";
+}
+
+void usage() {
+	std::cerr << "Usage: rendyBench [--json file|-] [--filter text] [--min-time seconds] [--threads N]\n";
+}
+
+int main(int argc, char** argv) {
+	for (int arg = 1; arg < argc; arg++) {
+		// Every option takes a value
+		if (arg + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		if (std::strcmp(argv[arg], "--json") == 0) {
+			JSON_OUTPUT = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--filter") == 0) {
+			FILTER = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--min-time") == 0) {
+			MIN_TIME = std::atof(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--threads") == 0) {
+			THREAD_COUNT = std::atoi(argv[++arg]);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	// Keep stdout clean for the JSON when it goes there
+	std::FILE* table = JSON_OUTPUT == "-" ? stderr : stdout;
+	BenchmarkRunner runner = BenchmarkRunner(MIN_TIME, 3, FILTER, table);
+	Camera camera = Camera(320, 16.0 / 9.0);
+
+	benchmarkVec3(runner);
+	benchmarkSampling(runner, camera);
+	benchmarkToneMap(runner);
+	benchmarkIntersection(runner, camera);
+	benchmarkDispatch(runner, camera);
+	benchmarkSceneBuild(runner);
+	benchmarkRender(runner);
+
+	if (!JSON_OUTPUT.empty()) {
+		std::FILE* file = JSON_OUTPUT == "-" ? stdout : std::fopen(JSON_OUTPUT.c_str(), "w");
+		bool written = file && runner.writeJson(file, context());
+		if (file && file != stdout) {
+			written = std::fclose(file) == 0 && written;
+		}
+		if (!written) {
+			std::cerr << "Could not write " << JSON_OUTPUT << "\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
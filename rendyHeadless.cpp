@@ -0,0 +1,735 @@
+#include "rendyUtils.h"
+#include "bvh.h"
+#include "camera.h"
+#include "denoiser.h"
+#include "scenes.h"
+#include "animation.h"
+#include "framebuffer.h"
+#include "imageWriter.h"
+#include "progressiveRenderer.h"
+#include "renderJob.h"
+#include "renderStats.h"
+#include "flatScene.h"
+#include "objFile.h"
+#include "sceneFile.h"
+#include "threadPool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include "distributedRender.h"
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*
+	Headless front end for Rendy. Renders the same scene as the Win32 build into a
+	framebuffer and writes it out as a PPM or PNG, so frames can be rendered without
+	a window (for example on a Linux render farm).
+
+	--spheres N scatters N extra spheres over the ground to stress the BVH. The
+	spheres are stored in a FlatScene; --surface-list puts them in a BVH over a
+	SurfaceList of separately allocated Sphere objects instead, whose spheres are
+	tested through virtual calls. --no-bvh tests every sphere in turn, for
+	comparison. --batch stores all the spheres in one SIMD SphereBatch instead, and
+	--simd scalar|sse|avx2|avx512 caps the instruction set it uses. --no-packets
+	traces every camera ray on its own instead of in 4x4 packets. --roulette N
+	starts Russian roulette after N bounces, -1 disables it.
+
+	--wavefront traces the paths of each tile together a bounce at a time, sorted by
+	where they start and which way they go before each bounce, instead of one path
+	after another (see wavefront.h). The image is the same either way.
+
+	--denoise renders the frame's samples along with the normal and depth each camera
+	ray hit, then filters out the noise with the Denoiser (see denoiser.h), guided by
+	them. A few samples per pixel plus the denoiser make a preview that would
+	otherwise take a hundred or more. With --progressive, every pass is denoised.
+
+	--sampler random|stratified|sobol|bluenoise picks where the random numbers for
+	the camera rays and bounces come from (see sampler.h). The default is sobol.
+
+	--exposure E scales the light of the image before it is shown, and --gamma G sets
+	the gamma it is shown with (2 by default). Samples are averaged as linear light and
+	only the averages are tone mapped (see toneMapper.h). An --output ending in .pfm
+	writes those averages as floats instead, with no exposure, gamma or clamping, for
+	compositing. PFM output works with plain, --denoise and --progressive renders.
+
+	--progressive renders the frame one sample per pixel at a time with the
+	ProgressiveRenderer the Win32 build uses, printing the time of every pass.
+	--preview N starts it with low resolution passes at 1/N, 2/N... of the size, the
+	way the Win32 build shows a resized window, and reports how long the first image
+	and the final one took.
+
+	--async renders the frame as a RenderJob on a thread of its own (see renderJob.h),
+	printing its progress as the tiles come in, and --cancel-after S cancels it after S
+	seconds and reports how long it took to stop and how many tiles it finished. A
+	cancelled frame isn't written out.
+
+	--adaptive T samples each pixel until the standard error of its mean is below T
+	8-bit levels, taking between --min-samples and --max-samples samples, and
+	--heatmap file.png writes how many samples each pixel took.
+
+	--scene file renders the spheres of a binary or text scene file (see sceneFile.h)
+	instead of the built-in scene. --save-scene file writes the built-in scene, with
+	its --spheres, to a scene file instead of rendering it: as text if the name ends
+	in .txt, and in the binary form otherwise. A --scene file ending in .obj is
+	loaded as a triangle mesh (see objFile.h), scaled to the size of the default
+	scene's sphere and set down on the ground in its place.
+
+	When built with the RENDY_STATS CMake option, the render also prints how many rays
+	and intersection tests it took and how deep the paths went.
+
+	Passing --scaling renders the frame once per thread count (1, 2, 4, ... up to
+	--threads) and reports how the render time scales.
+
+	--workers N renders the frame with N worker processes instead of threads (see
+	distributedRender.h). Each worker is this program started again with the same
+	options plus --worker, so it builds the same scene, and the coordinator hands the
+	tiles out over pipes and merges the float sums they send back. --fail-worker N
+	makes the first worker die after N tiles, to check that its tile goes to another
+	worker and the image comes out the same. Not available on Windows.
+
+	--frames N renders N frames at 24 frames per second of the scattered spheres
+	bouncing around (see animation.h), writing rendy.0000.ppm, rendy.0001.ppm and so on
+	for an --output of rendy.ppm. The BVH is built once and then refit to each frame,
+	unless refitting has grown its nodes more than --rebuild-ratio times their size in a fresh
+	build, when it is built again. A ratio of 0 rebuilds it every frame. Only works
+	with the FlatScene, so not with --scene, --surface-list, --batch or --no-bvh.
+*/
+
+int ALIAS_SAMPLES	= 10;
+int MAX_DEPTH		= 10;
+int ROULETTE_DEPTH	= 3;
+int WINDOW_WIDTH	= 1920;
+float ASPECT_RATIO	= 16.0 / 9.0;
+int TILE_SIZE		= 32;
+int THREAD_COUNT	= 0;
+uint32_t SEED		= 0;
+int SPHERES			= 0;
+bool USE_BVH		= true;
+bool USE_BATCH		= false;
+bool USE_FLAT		= true;
+bool USE_PACKETS	= true;
+bool WAVEFRONT		= false;
+SimdLevel SIMD		= SimdLevel::AVX512;
+SamplerType SAMPLER	= RenderSettings().sampler;
+bool SCALING		= false;
+bool PROGRESSIVE	= false;
+bool DENOISE		= false;
+int PREVIEW			= 1;
+float ADAPTIVE		= 0;
+int MIN_SAMPLES		= 16;
+int MAX_SAMPLES		= 128;
+float EXPOSURE		= 1.0f;
+float GAMMA			= 2.0f;
+std::string HEATMAP;
+std::string SCENE;
+std::string SAVE_SCENE;
+std::string OUTPUT	= "rendy.ppm";
+int WORKERS			= 0;
+int FAIL_WORKER		= -1;
+// Set in the worker processes of a --workers render
+bool WORKER			= false;
+int WORKER_EXIT_AFTER	= -1;
+int FRAMES			= 0;
+float REBUILD_RATIO	= 1.5f;
+bool ASYNC			= false;
+float CANCEL_AFTER	= -1;
+
+RenderSettings renderSettings(int threadCount) {
+	RenderSettings settings;
+	settings.aliasSamples = ALIAS_SAMPLES;
+	settings.maxDepth = MAX_DEPTH;
+	settings.rouletteDepth = ROULETTE_DEPTH;
+	settings.tileSize = TILE_SIZE;
+	settings.threadCount = threadCount;
+	settings.seed = SEED;
+	settings.packetTracing = USE_PACKETS;
+	settings.wavefront = WAVEFRONT;
+	settings.adaptiveThreshold = ADAPTIVE;
+	settings.minSamples = MIN_SAMPLES;
+	settings.maxSamples = MAX_SAMPLES;
+	settings.sampler = SAMPLER;
+	settings.exposure = EXPOSURE;
+	settings.gamma = GAMMA;
+	return settings;
+}
+
+// Render the frame and return the wall clock time it took in seconds
+double timedRender(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer, ThreadPool& pool) {
+	auto start = std::chrono::steady_clock::now();
+	camera.render(renderSettings(pool.threadCount()), sceneObjects, framebuffer, pool);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Render with adaptive sampling and report where the samples went
+bool adaptiveRender(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer) {
+	ThreadPool pool(THREAD_COUNT);
+	SampleMap sampleMap;
+	auto start = std::chrono::steady_clock::now();
+	camera.renderAdaptive(renderSettings(pool.threadCount()), sceneObjects, framebuffer, sampleMap, pool);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Rendered %dx%d adaptively in %.3fs on %d threads\n", framebuffer.width(), framebuffer.height(), seconds, pool.threadCount());
+	// The camera takes at least two samples a pixel, so it has a spread to judge them by
+	const int minSamples = (std::max)(MIN_SAMPLES, 2);
+	const int maxSamples = (std::max)(MAX_SAMPLES, minSamples);
+	std::printf("Traced %lld samples, %.2f per pixel on average (%d to %d)\n", sampleMap.total(), sampleMap.average(), minSamples, maxSamples);
+
+	if (!HEATMAP.empty()) {
+		Framebuffer heatmap;
+		sampleMap.heatmap(heatmap, maxSamples);
+		if (!writeImage(HEATMAP, heatmap)) {
+			std::cerr << "Could not write " << HEATMAP << "\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+// Write the linear colors color(i, j) of the frame to OUTPUT as a PFM
+template <typename Color>
+bool writeHdrOutput(int width, int height, Color&& color) {
+	if (!writePFM(OUTPUT, width, height, color)) {
+		std::cerr << "Could not write " << OUTPUT << "\n";
+		return false;
+	}
+	return true;
+}
+
+// Render the frame's samples into an accumulation buffer, to be written out as a PFM
+bool hdrRender(const Camera& camera, const Surface& sceneObjects) {
+	ThreadPool pool(THREAD_COUNT);
+	AccumulationBuffer accumulation;
+	auto start = std::chrono::steady_clock::now();
+	camera.accumulate(renderSettings(pool.threadCount()), sceneObjects, accumulation, ALIAS_SAMPLES, pool);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Rendered %dx%d in %.3fs on %d threads\n", accumulation.width(), accumulation.height(), seconds, pool.threadCount());
+	return writeHdrOutput(accumulation.width(), accumulation.height(), [&](int i, int j) { return accumulation.average(i, j); });
+}
+
+// Render the samples and features of the frame, then denoise it
+bool denoisedRender(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer) {
+	ThreadPool pool(THREAD_COUNT);
+	AccumulationBuffer accumulation;
+	FeatureBuffer features;
+	Denoiser denoiser;
+	auto start = std::chrono::steady_clock::now();
+	camera.accumulate(renderSettings(pool.threadCount()), sceneObjects, accumulation, ALIAS_SAMPLES, pool, &features);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Rendered %dx%d in %.3fs on %d threads\n", accumulation.width(), accumulation.height(), seconds, pool.threadCount());
+
+	start = std::chrono::steady_clock::now();
+	denoiser.denoise(accumulation, features, framebuffer, ToneMapper(EXPOSURE, GAMMA), pool);
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Denoised in %.3fs\n", seconds);
+	if (isPfmFile(OUTPUT)) {
+		return writeHdrOutput(denoiser.width(), denoiser.height(), [&](int i, int j) { return denoiser.color(i, j); });
+	}
+	return true;
+}
+
+// Refine the frame one sample at a time, the way the Win32 build does between paints
+bool progressiveRender(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer) {
+	// The renderer shares ownership of its scene, but here the scene outlives it, so it gets a non-owning pointer
+	std::shared_ptr<const Surface> world(std::shared_ptr<const Surface>(), &sceneObjects);
+	ProgressiveRenderer renderer(world, camera, renderSettings(THREAD_COUNT));
+	renderer.denoise(DENOISE);
+	renderer.preview(PREVIEW);
+
+	auto start = std::chrono::steady_clock::now();
+	double firstImage = 0;
+	while (!renderer.converged()) {
+		auto passStart = std::chrono::steady_clock::now();
+		const int scale = renderer.previewScale();
+		renderer.refine();
+		auto passEnd = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(passEnd - passStart).count();
+		if (renderer.passCount() == 1) {
+			firstImage = std::chrono::duration<double>(passEnd - start).count();
+		}
+		if (scale > 1) {
+			std::printf("Preview 1/%d: %.3fs\n", scale, seconds);
+		} else {
+			std::printf("Pass %d: %.3fs\n", renderer.sampleCount(), seconds);
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Rendered %dx%d progressively in %.3fs\n", renderer.frame().width(), renderer.frame().height(), seconds);
+	std::printf("First image after %.3fs, final image after %.3fs\n", firstImage, seconds);
+	framebuffer = renderer.frame();
+	if (isPfmFile(OUTPUT)) {
+		return writeHdrOutput(framebuffer.width(), framebuffer.height(), [&](int i, int j) { return renderer.color(i, j); });
+	}
+	return true;
+}
+
+/*
+	Render the frame as a RenderJob, printing its progress every tenth of the tiles,
+	and cancel it after CANCEL_AFTER seconds if that is set. Returns whether the frame
+	was finished.
+*/
+bool asyncRender(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer) {
+	ThreadPool pool(THREAD_COUNT);
+	// The job shares ownership of its scene, but here the scene outlives it, so it gets a non-owning pointer
+	std::shared_ptr<const Surface> world(std::shared_ptr<const Surface>(), &sceneObjects);
+	auto start = std::chrono::steady_clock::now();
+	std::unique_ptr<RenderJob> job = RenderJob::render(camera, renderSettings(pool.threadCount()), world, framebuffer, pool);
+
+	double cancelled = -1;
+	int reported = 0;
+	while (!job->waitFor(std::chrono::milliseconds(5))) {
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		const int tenths = static_cast<int>(job->progress() * 10);
+		if (tenths > reported) {
+			reported = tenths;
+			std::printf("%3d%% after %.3fs (%d of %d tiles)\n", 10 * tenths, seconds, job->tilesDone(), job->tileCount());
+		}
+		if (CANCEL_AFTER >= 0 && seconds >= CANCEL_AFTER && cancelled < 0) {
+			job->cancel();
+			cancelled = seconds;
+		}
+	}
+	job->wait();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (!job->completed()) {
+		std::printf("Cancelled after %.3fs, stopped %.3fs later with %d of %d tiles done\n", cancelled, seconds - cancelled, job->tilesDone(), job->tileCount());
+		return false;
+	}
+	std::printf("Rendered %dx%d in %.3fs on %d threads\n", framebuffer.width(), framebuffer.height(), seconds, pool.threadCount());
+	return true;
+}
+
+// Render once per thread count and print the speedup relative to one thread
+void reportScaling(const Camera& camera, const Surface& sceneObjects, Framebuffer& framebuffer) {
+	const int maxThreads = THREAD_COUNT > 0 ? THREAD_COUNT : ThreadPool(0).threadCount();
+	double baseline = 0;
+
+	std::printf("%8s %10s %8s %10s\n", "threads", "seconds", "speedup", "efficiency");
+	for (int threads = 1; ; threads = (std::min)(threads * 2, maxThreads)) {
+		ThreadPool pool(threads);
+		double seconds = timedRender(camera, sceneObjects, framebuffer, pool);
+		if (threads == 1) {
+			baseline = seconds;
+		}
+		double speedup = baseline / seconds;
+		std::printf("%8d %10.3f %8.2f %9.0f%%\n", threads, seconds, speedup, 100.0 * speedup / threads);
+		if (threads == maxThreads) {
+			break;
+		}
+	}
+}
+
+// The name of one frame of a sequence: rendy.ppm becomes rendy.0003.ppm
+std::string frameName(const std::string& output, int frame) {
+	char number[16];
+	std::snprintf(number, sizeof(number), ".%04d", frame);
+	const size_t dot = output.find_last_of('.');
+	const size_t slash = output.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return output + number;
+	}
+	return output.substr(0, dot) + number + output.substr(dot);
+}
+
+// Animate the scene over FRAMES frames, refitting its BVH to each one before rendering it
+bool renderSequence(const Camera& camera, FlatScene& scene, Framebuffer& framebuffer) {
+	const float framesPerSecond = 24.0f;
+	BouncingSpheres animation(scene, SEED);
+	ThreadPool pool(THREAD_COUNT);
+	int rebuilds = 0;
+	double setupTotal = 0;
+	double renderTotal = 0;
+	std::printf("Animating %zu spheres over %d frames\n", animation.size(), FRAMES);
+	for (int frame = 0; frame < FRAMES; frame++) {
+		auto start = std::chrono::steady_clock::now();
+		animation.apply(scene, frame / framesPerSecond);
+		const bool rebuilt = scene.refit(REBUILD_RATIO, THREAD_COUNT);
+		double setup = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		rebuilds += rebuilt ? 1 : 0;
+
+		double seconds = timedRender(camera, scene, framebuffer, pool);
+		setupTotal += setup;
+		renderTotal += seconds;
+		std::printf("Frame %d: %s in %.2fms (nodes %.2fx as big as built), rendered in %.3fs\n", frame, rebuilt ? "rebuilt" : "refit", setup * 1000.0,
+			scene.growth(), seconds);
+
+		const std::string name = frameName(OUTPUT, frame);
+		if (!writeImage(name, framebuffer)) {
+			std::cerr << "Could not write " << name << "\n";
+			return false;
+		}
+	}
+	std::printf("Rendered %d frames in %.3fs, %.2fms per frame updating the BVH (%d rebuilds)\n", FRAMES, renderTotal, setupTotal * 1000.0 / FRAMES, rebuilds);
+	return true;
+}
+
+#ifndef _WIN32
+/*
+	Start WORKERS copies of this program with the same options plus --worker, so they
+	all build the same scene, and render the frame with them
+*/
+bool workerRender(int argc, char** argv) {
+	std::vector<std::string> command = { argv[0], "--worker" };
+	for (int arg = 1; arg < argc; arg++) {
+		// Only the coordinator starts workers, and only the first worker is told to fail
+		if (std::strcmp(argv[arg], "--workers") == 0 || std::strcmp(argv[arg], "--fail-worker") == 0) {
+			arg++;
+			continue;
+		}
+		command.push_back(argv[arg]);
+	}
+
+	RenderCoordinator coordinator;
+	for (int worker = 0; worker < WORKERS; worker++) {
+		std::vector<std::string> workerCommand = command;
+		if (worker == 0 && FAIL_WORKER >= 0) {
+			workerCommand.push_back("--worker-exit-after");
+			workerCommand.push_back(std::to_string(FAIL_WORKER));
+		}
+		if (!coordinator.startWorker(workerCommand)) {
+			std::cerr << "Could not start render worker " << worker << "\n";
+			return false;
+		}
+	}
+
+	Camera camera = Camera(WINDOW_WIDTH, ASPECT_RATIO);
+	Framebuffer framebuffer;
+	std::string error;
+	auto start = std::chrono::steady_clock::now();
+	if (!coordinator.render(camera, renderSettings(1), framebuffer, error)) {
+		std::cerr << error << "\n";
+		return false;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Rendered %dx%d in %.3fs on %d worker processes\n", framebuffer.width(), framebuffer.height(), seconds, coordinator.workerCount());
+	if (coordinator.workersLost() > 0) {
+		std::printf("Lost %d workers, reassigned %d tiles\n", coordinator.workersLost(), coordinator.tilesReassigned());
+	}
+
+	if (!writeImage(OUTPUT, framebuffer)) {
+		std::cerr << "Could not write " << OUTPUT << "\n";
+		return false;
+	}
+	return true;
+}
+#endif
+
+void usage() {
+	std::cerr << "Usage: rendyHeadless [--width N] [--samples N] [--depth N] [--roulette N] [--tile-size N] [--threads N]\n"
+		<< "                     [--seed N] [--spheres N] [--no-bvh] [--surface-list] [--batch] [--no-packets]\n"
+		<< "                     [--simd scalar|sse|avx2|avx512] [--sampler random|stratified|sobol|bluenoise]\n"
+		<< "                     [--scaling] [--progressive] [--preview N] [--denoise] [--exposure E] [--gamma G]\n"
+		<< "                     [--adaptive T] [--min-samples N] [--max-samples N] [--heatmap file]\n"
+		<< "                     [--scene file|file.obj] [--save-scene file] [--output file.ppm|file.png|file.pfm]\n"
+		<< "                     [--workers N] [--fail-worker N] [--frames N] [--rebuild-ratio R]\n"
+		<< "                     [--wavefront] [--async] [--cancel-after S]\n";
+}
+
+int main(int argc, char** argv) {
+	for (int arg = 1; arg < argc; arg++) {
+		if (std::strcmp(argv[arg], "--scaling") == 0) {
+			SCALING = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--progressive") == 0) {
+			PROGRESSIVE = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--denoise") == 0) {
+			DENOISE = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--no-bvh") == 0) {
+			USE_BVH = false;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--no-packets") == 0) {
+			USE_PACKETS = false;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--async") == 0) {
+			ASYNC = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--wavefront") == 0) {
+			WAVEFRONT = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--surface-list") == 0) {
+			USE_FLAT = false;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--batch") == 0) {
+			USE_BATCH = true;
+			continue;
+		}
+		if (std::strcmp(argv[arg], "--worker") == 0) {
+			WORKER = true;
+			continue;
+		}
+
+		// Every other option takes a value
+		if (arg + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		if (std::strcmp(argv[arg], "--width") == 0) {
+			WINDOW_WIDTH = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--samples") == 0) {
+			ALIAS_SAMPLES = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--depth") == 0) {
+			MAX_DEPTH = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--roulette") == 0) {
+			ROULETTE_DEPTH = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--tile-size") == 0) {
+			TILE_SIZE = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--threads") == 0) {
+			THREAD_COUNT = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--spheres") == 0) {
+			SPHERES = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--simd") == 0) {
+			if (!parseSimdLevel(argv[++arg], SIMD)) {
+				usage();
+				return 1;
+			}
+		} else if (std::strcmp(argv[arg], "--sampler") == 0) {
+			if (!parseSamplerType(argv[++arg], SAMPLER)) {
+				usage();
+				return 1;
+			}
+		} else if (std::strcmp(argv[arg], "--seed") == 0) {
+			SEED = static_cast<uint32_t>(std::strtoul(argv[++arg], nullptr, 10));
+		} else if (std::strcmp(argv[arg], "--adaptive") == 0) {
+			ADAPTIVE = static_cast<float>(std::atof(argv[++arg]));
+		} else if (std::strcmp(argv[arg], "--min-samples") == 0) {
+			MIN_SAMPLES = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--max-samples") == 0) {
+			MAX_SAMPLES = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--heatmap") == 0) {
+			HEATMAP = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--scene") == 0) {
+			SCENE = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--save-scene") == 0) {
+			SAVE_SCENE = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--output") == 0) {
+			OUTPUT = argv[++arg];
+		} else if (std::strcmp(argv[arg], "--workers") == 0) {
+			WORKERS = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--fail-worker") == 0) {
+			FAIL_WORKER = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--worker-exit-after") == 0) {
+			WORKER_EXIT_AFTER = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--frames") == 0) {
+			FRAMES = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--rebuild-ratio") == 0) {
+			REBUILD_RATIO = static_cast<float>(std::atof(argv[++arg]));
+		} else if (std::strcmp(argv[arg], "--preview") == 0) {
+			PREVIEW = std::atoi(argv[++arg]);
+		} else if (std::strcmp(argv[arg], "--exposure") == 0) {
+			EXPOSURE = static_cast<float>(std::atof(argv[++arg]));
+		} else if (std::strcmp(argv[arg], "--cancel-after") == 0) {
+			CANCEL_AFTER = static_cast<float>(std::atof(argv[++arg]));
+		} else if (std::strcmp(argv[arg], "--gamma") == 0) {
+			GAMMA = static_cast<float>(std::atof(argv[++arg]));
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (WINDOW_WIDTH <= 0 || ALIAS_SAMPLES <= 0 || MAX_DEPTH < 0 || TILE_SIZE <= 0 || ADAPTIVE < 0 || MIN_SAMPLES <= 0 || MAX_SAMPLES < MIN_SAMPLES) {
+		usage();
+		return 1;
+	}
+	// Workers render plain frames, one tile at a time
+	if ((WORKERS > 0 || WORKER) && (SCALING || PROGRESSIVE || ADAPTIVE > 0 || DENOISE)) {
+		usage();
+		return 1;
+	}
+	// Sequences move the spheres of a FlatScene and refit its BVH, and render plain frames
+	if (FRAMES < 0 || REBUILD_RATIO < 0 || (FRAMES > 0 && (!SCENE.empty() || !USE_FLAT || USE_BATCH || !USE_BVH
+		|| WORKERS > 0 || WORKER || SCALING || PROGRESSIVE || ADAPTIVE > 0 || DENOISE))) {
+		usage();
+		return 1;
+	}
+	// Previews are passes of the progressive renderer
+	if (PREVIEW < 1 || (PREVIEW > 1 && !PROGRESSIVE)) {
+		usage();
+		return 1;
+	}
+	// --async only runs the plain 8-bit render as a job, though renderAdaptive, accumulate and
+	// ProgressiveRenderer::refine take a RenderControl too and could be cancelled the same way
+	if ((CANCEL_AFTER >= 0 && !ASYNC) || (ASYNC && (WORKERS > 0 || WORKER || FRAMES > 0 || SCALING || PROGRESSIVE || ADAPTIVE > 0
+		|| DENOISE || isPfmFile(OUTPUT)))) {
+		usage();
+		return 1;
+	}
+	// PFM output needs the linear image, which only the plain, denoised and progressive renders keep
+	if (EXPOSURE <= 0 || GAMMA <= 0 || (isPfmFile(OUTPUT) && (SCALING || ADAPTIVE > 0 || FRAMES > 0 || WORKERS > 0))) {
+		usage();
+		return 1;
+	}
+
+#ifndef _WIN32
+	// A worker's standard output carries its replies to the coordinator, so everything it prints is thrown away
+	int workerOutput = -1;
+	if (WORKER) {
+		workerOutput = dup(STDOUT_FILENO);
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, STDOUT_FILENO);
+		close(devNull);
+	}
+#else
+	if (WORKERS > 0 || WORKER) {
+		std::cerr << "--workers is not available on Windows\n";
+		return 1;
+	}
+#endif
+
+	if (!SAVE_SCENE.empty()) {
+		SphereBatch batch;
+		buildRandomSphereBatch(batch, SPHERES, SEED);
+		if (!writeScene(SAVE_SCENE, batch)) {
+			std::cerr << "Could not write " << SAVE_SCENE << "\n";
+			return 1;
+		}
+		std::printf("Wrote %d spheres to %s\n", batch.size(), SAVE_SCENE.c_str());
+		return 0;
+	}
+
+#ifndef _WIN32
+	if (WORKERS > 0) {
+		return workerRender(argc, argv) ? 0 : 1;
+	}
+#endif
+
+	SurfaceList sceneObjects;
+	FlatScene flatScene;
+	std::shared_ptr<SphereBatch> sceneFileBatch;
+	std::shared_ptr<TriangleMesh> sceneMesh;
+	const bool useFlatScene = USE_FLAT && SCENE.empty() && !USE_BATCH;
+	if (!SCENE.empty() && isObjFile(SCENE)) {
+		sceneMesh = std::make_shared<TriangleMesh>();
+		auto start = std::chrono::steady_clock::now();
+		std::string error;
+		if (!loadObj(SCENE, *sceneMesh, error)) {
+			std::cerr << error << "\n";
+			return 1;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Loaded %zu triangles and %zu vertices from %s in %.3fs\n", sceneMesh->triangleCount(), sceneMesh->vertexCount(), SCENE.c_str(), seconds);
+		buildMeshScene(sceneObjects, sceneMesh);
+	} else if (!SCENE.empty()) {
+		sceneFileBatch = std::make_shared<SphereBatch>();
+		sceneFileBatch->simdLevel(SIMD);
+		auto start = std::chrono::steady_clock::now();
+		std::string error;
+		if (!loadScene(SCENE, *sceneFileBatch, error)) {
+			std::cerr << error << "\n";
+			return 1;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Loaded %d spheres from %s in %.3fs (%.1f MB)\n", sceneFileBatch->size(), SCENE.c_str(), seconds, sceneFileBatch->size() * 4.0 * sizeof(float) / (1 << 20));
+		sceneObjects.add(sceneFileBatch);
+	} else if (USE_BATCH) {
+		buildRandomSphereBatchScene(sceneObjects, SPHERES, SEED, SIMD);
+		std::printf("Intersecting spheres with the %s kernel\n", simdLevelName((std::min)(SIMD, SphereBatch::supportedSimdLevel())));
+	} else {
+		auto start = std::chrono::steady_clock::now();
+		if (useFlatScene) {
+			buildRandomSpheresFlatScene(flatScene, SPHERES, SEED);
+		} else {
+			buildRandomSpheresScene(sceneObjects, SPHERES, SEED);
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Built the scene in %.3fs (%s)\n", seconds, useFlatScene ? "FlatScene" : "SurfaceList");
+	}
+
+	BVH bvh;
+	if (USE_BVH && sceneFileBatch) {
+		// A loaded scene is a single SphereBatch, which builds its own BVH over its spheres
+		auto start = std::chrono::steady_clock::now();
+		sceneFileBatch->buildBVH(THREAD_COUNT);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Built BVH over %d spheres in %.3fs (%zu nodes)\n", sceneFileBatch->size(), seconds, sceneFileBatch->tree().nodes().size());
+	} else if (USE_BVH && sceneMesh) {
+		// The mesh builds its own BVH over its triangles, leaving the scene only it and the ground
+		auto start = std::chrono::steady_clock::now();
+		sceneMesh->build(THREAD_COUNT);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Built BVH over %zu triangles in %.3fs (%zu nodes, %.1f MB with the mesh)\n", sceneMesh->triangleCount(), seconds, sceneMesh->tree().nodes().size(), sceneMesh->memoryBytes() / static_cast<double>(1 << 20));
+	} else if (USE_BVH && useFlatScene) {
+		auto start = std::chrono::steady_clock::now();
+		flatScene.build(THREAD_COUNT);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Built BVH over %zu objects in %.3fs (%zu nodes)\n", flatScene.size(), seconds, flatScene.tree().nodes().size());
+	} else if (USE_BVH) {
+		auto start = std::chrono::steady_clock::now();
+		bvh = BVH(sceneObjects, THREAD_COUNT);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::printf("Built BVH over %zu objects in %.3fs (%zu nodes)\n", sceneObjects.objects.size(), seconds, bvh.tree().nodes().size());
+	}
+	const Surface* worldSurface = &sceneObjects;
+	if (useFlatScene) {
+		worldSurface = &flatScene;
+	} else if (USE_BVH && !sceneFileBatch && !sceneMesh) {
+		worldSurface = &bvh;
+	}
+	const Surface& world = *worldSurface;
+
+	Camera camera = Camera(WINDOW_WIDTH, ASPECT_RATIO);
+	Framebuffer framebuffer;
+
+#ifndef _WIN32
+	if (WORKER) {
+		return serveTiles(camera, renderSettings(1), world, STDIN_FILENO, workerOutput, WORKER_EXIT_AFTER) ? 0 : 1;
+	}
+#endif
+
+	if (FRAMES > 0) {
+		return renderSequence(camera, flatScene, framebuffer) ? 0 : 1;
+	}
+
+	if (SCALING) {
+		reportScaling(camera, world, framebuffer);
+	} else if (ADAPTIVE > 0) {
+		if (!adaptiveRender(camera, world, framebuffer)) {
+			return 1;
+		}
+	} else if (PROGRESSIVE) {
+		if (!progressiveRender(camera, world, framebuffer)) {
+			return 1;
+		}
+	} else if (DENOISE) {
+		if (!denoisedRender(camera, world, framebuffer)) {
+			return 1;
+		}
+	} else if (ASYNC) {
+		if (!asyncRender(camera, world, framebuffer)) {
+			// Nothing to write out for a cancelled frame
+			return 0;
+		}
+	} else if (isPfmFile(OUTPUT)) {
+		return hdrRender(camera, world) ? 0 : 1;
+	} else {
+		ThreadPool pool(THREAD_COUNT);
+		RenderStats::reset();
+		double seconds = timedRender(camera, world, framebuffer, pool);
+		std::printf("Rendered %dx%d in %.3fs on %d threads\n", framebuffer.width(), framebuffer.height(), seconds, pool.threadCount());
+#ifdef RENDY_STATS
+		RenderStats::collect().report(stdout, seconds);
+#endif
+	}
+
+	if (!isPfmFile(OUTPUT) && !writeImage(OUTPUT, framebuffer)) {
+		std::cerr << "Could not write " << OUTPUT << "\n";
+		return 1;
+	}
+
+	return 0;
+}
@@ -6,6 +6,25 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include "rng.h"
+
+// Keeps a function out of line, for calls in hot loops whose bodies would crowd out the loop's own registers
+#if defined(__GNUC__) || defined(__clang__)
+#define RENDY_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define RENDY_NOINLINE __declspec(noinline)
+#else
+#define RENDY_NOINLINE
+#endif
+
+// Inlines a function even where the compiler's size limits would keep it out of line
+#if defined(__GNUC__) || defined(__clang__)
+#define RENDY_FORCEINLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define RENDY_FORCEINLINE __forceinline
+#else
+#define RENDY_FORCEINLINE inline
+#endif
 
 // Constants
 const float infinity = std::numeric_limits<float>::infinity();
@@ -16,9 +35,10 @@ inline float radians(float degrees) {
 	return degrees * pi / 180.0;
 }
 
-// Returns a random float in the interval [0,1)
+// Returns a random float in the interval [0,1) from the calling thread's generator.
+// Camera seeds the generator per pixel and sample, and Pixel selects the bounce.
 inline float random_float() {
-	return rand() / (RAND_MAX + 1.0);
+	return Rng::local().nextFloat();
 }
 
 // Returns a random float in the interval [min,max)
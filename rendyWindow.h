@@ -1 +1,40 @@
 #pragma once
+#ifndef RENDYWINDOW_H
+#define RENDYWINDOW_H
+
+#include "framebuffer.h"
+#include <windows.h>
+
+/*
+	Copy the whole framebuffer to the device context in a single GDI call.
+
+	The framebuffer is laid out as 32-bit 0x00RRGGBB pixels, which is exactly a
+	BI_RGB 32bpp DIB. A negative height tells GDI that the rows are top-down,
+	matching the order the Camera writes them in.
+
+	See: https://learn.microsoft.com/en-us/windows/win32/api/wingdi/nf-wingdi-setdibitstodevice
+*/
+inline void blitFramebuffer(HDC hdc, const Framebuffer& framebuffer) {
+	BITMAPINFO info = {};
+	info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	info.bmiHeader.biWidth = framebuffer.width();
+	info.bmiHeader.biHeight = -framebuffer.height();
+	info.bmiHeader.biPlanes = 1;
+	info.bmiHeader.biBitCount = 32;
+	info.bmiHeader.biCompression = BI_RGB;
+
+	SetDIBitsToDevice(
+		hdc,
+		0, 0,								// Destination upper left
+		framebuffer.width(),
+		framebuffer.height(),
+		0, 0,								// Source lower left
+		0,									// First scan line in the array
+		framebuffer.height(),				// Number of scan lines
+		framebuffer.data(),
+		&info,
+		DIB_RGB_COLORS
+	);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+/*
+	A counter-based random number generator.
+
+	Instead of carrying hidden state forward like rand(), every number is a hash of
+	a key and a counter. The key is derived from the pixel, the sample and the frame
+	seed, and the counter is split into the bounce (high 32 bits) and the draw within
+	that bounce (low 32 bits). The same pixel, sample and bounce always produce the
+	same numbers no matter which thread renders them or in what order, so renders are
+	bit-identical across thread counts and schedules.
+
+	The hash is the SplitMix64 finalizer, which is cheap (a few multiplies and shifts)
+	and passes BigCrush when fed a counter.
+
+	See: https://prng.di.unimi.it/splitmix64.c
+	and: https://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+*/
+class Rng {
+	public:
+		Rng() : _key(0), _counter(0) {}
+		Rng(uint64_t key) : _key(mix(key)), _counter(0) {}
+
+		// Start the random stream for one sample of one pixel
+		void seed(uint64_t pixel, uint32_t sample, uint32_t frameSeed = 0) {
+			_key = mix(mix(pixel ^ (static_cast<uint64_t>(frameSeed) << 40)) + sample);
+			_counter = 0;
+		}
+
+		// Switch to the stream for a bounce of the current sample
+		void bounce(uint32_t bounce) {
+			_counter = static_cast<uint64_t>(bounce) << 32;
+		}
+
+		uint32_t nextU32() {
+			return static_cast<uint32_t>(mix(_key + (_counter++) * 0x9E3779B97F4A7C15ull) >> 32);
+		}
+
+		// Returns a float in the interval [0,1) using the top 24 bits so every value is exact
+		float nextFloat() {
+			return (nextU32() >> 8) * (1.0f / 16777216.0f);
+		}
+
+		// The generator used by random_float on the calling thread
+		static Rng& local() {
+			static thread_local Rng rng;
+			return rng;
+		}
+
+	private:
+		uint64_t _key;
+		uint64_t _counter;
+
+		static uint64_t mix(uint64_t z) {
+			z += 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+};
+
+#endif
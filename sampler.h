@@ -0,0 +1,498 @@
+#pragma once
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "rendyUtils.h"
+#include "rng.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+	Where the random numbers of a sample come from.
+
+	A path traced pixel is an integral over many dimensions at once: two for where in
+	the pixel the camera ray goes, then, for every bounce, two for the direction it
+	scatters in and one for Russian roulette. Independent random numbers cover that
+	space with clumps and gaps, and the error only falls as one over the square root
+	of the sample count. Spreading each pixel's samples out more evenly makes the
+	error fall faster, so the same image takes fewer samples.
+
+	Random		independent uniform numbers from Rng, the way Rendy always sampled
+	Stratified	correlated multi-jittered sampling: every pair of dimensions is split
+				into a grid with one sample per cell, jittered in a way that also
+				spreads the samples evenly along each axis
+	Sobol		the Sobol sequence, Owen scrambled per pixel. Each pair of dimensions
+				takes its own shuffled copy of the sequence's first two dimensions
+	BlueNoise	one Owen scrambled Sobol sequence shared by every pixel, offset per pixel
+				by a blue noise mask, so what error is left looks like fine, even grain
+				rather than blotches
+
+	Stratified needs to know how many samples the pixel gets. Past that count, it
+	starts a new round of strata. Sobol and BlueNoise have no such limit.
+
+	See: Kensler, "Correlated Multi-Jittered Sampling" (Pixar 2013), Burley,
+	"Practical Hash-based Owen Scrambling" (JCGT 2020), and Georgiev and Fajardo,
+	"Blue-noise Dithered Sampling" (SIGGRAPH 2016)
+*/
+enum class SamplerType {
+	Random = 0,
+	Stratified = 1,
+	Sobol = 2,
+	BlueNoise = 3
+};
+
+inline const char* samplerTypeName(SamplerType type) {
+	switch (type) {
+		case SamplerType::Stratified: return "stratified";
+		case SamplerType::Sobol: return "sobol";
+		case SamplerType::BlueNoise: return "bluenoise";
+		default: return "random";
+	}
+}
+
+// Parses a name returned by samplerTypeName, returning false if it isn't one
+inline bool parseSamplerType(const std::string& name, SamplerType& type) {
+	for (int n = 0; n <= static_cast<int>(SamplerType::BlueNoise); n++) {
+		if (name == samplerTypeName(static_cast<SamplerType>(n))) {
+			type = static_cast<SamplerType>(n);
+			return true;
+		}
+	}
+	return false;
+}
+
+namespace sampling {
+	// A 32-bit integer hash with good avalanche (Chris Wellons' lowbias32)
+	inline uint32_t hash(uint32_t x) {
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	inline uint32_t hashCombine(uint32_t seed, uint32_t value) {
+		return seed ^ (hash(value) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+	}
+
+	// The top 24 bits as a float in [0, 1), so every value is exact
+	inline float toFloat(uint32_t bits) {
+		return (bits >> 8) * (1.0f / 16777216.0f);
+	}
+
+	inline uint32_t reverseBits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	/*
+		Owen scrambling: flip each bit with a probability that depends on the bits
+		above it. The Laine-Karras hash only lets a bit affect the bits above it, so
+		running it on the reversed bits does exactly that. This takes and returns the
+		bits reversed, since the Sobol points come out that way anyway.
+	*/
+	inline uint32_t laineKarras(uint32_t reversed, uint32_t seed) {
+		reversed += seed;
+		reversed ^= reversed * 0x6c50b47cu;
+		reversed ^= reversed * 0xb82f1e52u;
+		reversed ^= reversed * 0xc7afe638u;
+		reversed ^= reversed * 0x8d22f6e6u;
+		return reversed;
+	}
+
+	/*
+		The Sobol sequence's first dimension is the index with its bits reversed, and its
+		second is the XOR of one direction number per set bit of the index. The
+		directions of each byte of the index are XORed together ahead of time, so it
+		takes four lookups instead of a loop over 32 bits. The table holds them reversed,
+		ready for laineKarras.
+	*/
+	class SobolTable {
+		public:
+			static const SobolTable& get() {
+				static const SobolTable table;
+				return table;
+			}
+
+			uint32_t reversedSecond(uint32_t index) const {
+				return _bytes[0][index & 0xff] ^ _bytes[1][(index >> 8) & 0xff] ^ _bytes[2][(index >> 16) & 0xff] ^ _bytes[3][index >> 24];
+			}
+
+		private:
+			uint32_t _bytes[4][256];
+
+			SobolTable() {
+				uint32_t directions[32];
+				directions[0] = 1u << 31;
+				for (int bit = 1; bit < 32; bit++) {
+					directions[bit] = directions[bit - 1] ^ (directions[bit - 1] >> 1);
+				}
+				for (int byte = 0; byte < 4; byte++) {
+					for (uint32_t value = 0; value < 256; value++) {
+						uint32_t x = 0;
+						for (int bit = 0; bit < 8; bit++) {
+							if ((value >> bit) & 1u) {
+								x ^= directions[8 * byte + bit];
+							}
+						}
+						_bytes[byte][value] = reverseBits(x);
+					}
+				}
+			}
+	};
+
+	/*
+		Point index of a shuffled, Owen scrambled (0, 2) Sobol sequence, given the index
+		with its bits reversed. The index is Owen scrambled too, which shuffles the
+		order of the points without losing their spread.
+	*/
+	inline void scrambledSobol2D(uint32_t reversedIndex, uint32_t seed, float& u, float& v) {
+		const uint32_t index = reverseBits(laineKarras(reversedIndex, seed));
+		u = toFloat(reverseBits(laineKarras(index, hashCombine(seed, 0))));
+		v = toFloat(reverseBits(laineKarras(SobolTable::get().reversedSecond(index), hashCombine(seed, 1))));
+	}
+
+	// Just the first number of scrambledSobol2D
+	inline float scrambledSobol1D(uint32_t reversedIndex, uint32_t seed) {
+		return toFloat(reverseBits(laineKarras(reverseBits(laineKarras(reversedIndex, seed)), hashCombine(seed, 0))));
+	}
+
+	// Kensler's hash based permutation of [0, length), one for each value of seed
+	inline uint32_t permute(uint32_t i, uint32_t length, uint32_t seed) {
+		uint32_t w = length - 1;
+		w |= w >> 1;
+		w |= w >> 2;
+		w |= w >> 4;
+		w |= w >> 8;
+		w |= w >> 16;
+		// Permute within the next power of two, and try again until the result lands inside
+		do {
+			i ^= seed;
+			i *= 0xe170893du;
+			i ^= seed >> 16;
+			i ^= (i & w) >> 4;
+			i ^= seed >> 8;
+			i *= 0x0929eb3fu;
+			i ^= seed >> 23;
+			i ^= (i & w) >> 1;
+			i *= 1 | seed >> 27;
+			i *= 0x6935fa69u;
+			i ^= (i & w) >> 11;
+			i *= 0x74dcb303u;
+			i ^= (i & w) >> 2;
+			i *= 0x9e501cc3u;
+			i ^= (i & w) >> 2;
+			i *= 0xc860a3dfu;
+			i &= w;
+			i ^= i >> 5;
+		} while (i >= length);
+		return (i + seed) % length;
+	}
+
+	/*
+		Sample index of count correlated multi-jittered samples: a grid of columns x rows
+		cells with one sample in each, placed so that the samples also fall one per
+		column of a finer columns * rows grid along each axis
+	*/
+	inline void multiJittered2D(uint32_t index, uint32_t count, uint32_t seed, float& u, float& v) {
+		const uint32_t columns = (std::max)(1u, static_cast<uint32_t>(std::sqrt(static_cast<float>(count))));
+		const uint32_t rows = (count + columns - 1) / columns;
+		index = permute(index, count, seed * 0x51633e2du);
+		const uint32_t column = index % columns;
+		const uint32_t row = index / columns;
+		const uint32_t subColumn = permute(column, columns, seed * 0x68bc21ebu);
+		const uint32_t subRow = permute(row, rows, seed * 0x02e5be93u);
+		const float jitterU = toFloat(hash(hashCombine(index, seed * 0x967a889bu)));
+		const float jitterV = toFloat(hash(hashCombine(index, seed * 0x368cc8b7u)));
+		u = (std::min)((column + (subRow + jitterU) / rows) / columns, 0x1.fffffep-1f);
+		v = (std::min)((row + (subColumn + jitterV) / columns) / rows, 0x1.fffffep-1f);
+	}
+
+	/*
+		A size x size tile of blue noise: every value from 0 to 1 appears once, and
+		nearby pixels have values far apart. Made once, on first use, with Ulichney's
+		void and cluster method: starting from a few well spread out points, the pixel
+		furthest from all the points so far (the largest void) is added next and given
+		the next rank, until every pixel has one. The tile wraps around at its edges.
+
+		See: Ulichney, "The void-and-cluster method for dither array generation" (1993)
+	*/
+	class BlueNoiseMask {
+		public:
+			static const int size = 64;
+
+			static const BlueNoiseMask& get() {
+				static const BlueNoiseMask mask;
+				return mask;
+			}
+
+			float value(int x, int y) const { return _values[(y & (size - 1)) * size + (x & (size - 1))]; }
+
+		private:
+			std::vector<float> _values;
+
+			BlueNoiseMask() {
+				const int pixels = size * size;
+				// The gaussian each point spreads over its neighbours, by wrapped offset
+				std::vector<float> spread(pixels);
+				for (int y = 0; y < size; y++) {
+					for (int x = 0; x < size; x++) {
+						const int dx = (std::min)(x, size - x);
+						const int dy = (std::min)(y, size - y);
+						spread[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * 1.5f * 1.5f));
+					}
+				}
+
+				std::vector<float> energy(pixels, 0.0f);
+				std::vector<bool> taken(pixels, false);
+				auto change = [&](int pixel, float sign) {
+					const int px = pixel % size;
+					const int py = pixel / size;
+					for (int y = 0; y < size; y++) {
+						for (int x = 0; x < size; x++) {
+							energy[y * size + x] += sign * spread[((y - py) & (size - 1)) * size + ((x - px) & (size - 1))];
+						}
+					}
+				};
+				auto extreme = [&](bool ofTaken, bool largest) {
+					int best = -1;
+					for (int pixel = 0; pixel < pixels; pixel++) {
+						if (taken[pixel] == ofTaken && (best < 0 || (largest ? energy[pixel] > energy[best] : energy[pixel] < energy[best]))) {
+							best = pixel;
+						}
+					}
+					return best;
+				};
+
+				// A tenth of the pixels at random, then moved from the tightest cluster to the largest void until settled
+				Rng rng(0x5eed);
+				std::vector<int> initial;
+				while (static_cast<int>(initial.size()) < pixels / 10) {
+					const int pixel = static_cast<int>(rng.nextU32() % pixels);
+					if (!taken[pixel]) {
+						taken[pixel] = true;
+						change(pixel, 1.0f);
+						initial.push_back(pixel);
+					}
+				}
+				for (int move = 0; move < pixels; move++) {
+					const int cluster = extreme(true, true);
+					taken[cluster] = false;
+					change(cluster, -1.0f);
+					const int gap = extreme(false, false);
+					taken[gap] = true;
+					change(gap, 1.0f);
+					if (gap == cluster) {
+						break;
+					}
+				}
+
+				// Rank the starting points by taking out the tightest cluster first, giving it the highest rank
+				std::vector<int> rank(pixels, 0);
+				std::vector<bool> start = taken;
+				std::vector<float> startEnergy = energy;
+				const int startCount = pixels / 10;
+				for (int r = startCount - 1; r >= 0; r--) {
+					const int cluster = extreme(true, true);
+					taken[cluster] = false;
+					change(cluster, -1.0f);
+					rank[cluster] = r;
+				}
+				// Then fill the largest void, over and over
+				taken = start;
+				energy = startEnergy;
+				for (int r = startCount; r < pixels; r++) {
+					const int gap = extreme(false, false);
+					taken[gap] = true;
+					change(gap, 1.0f);
+					rank[gap] = r;
+				}
+
+				_values.resize(pixels);
+				for (int pixel = 0; pixel < pixels; pixel++) {
+					_values[pixel] = (rank[pixel] + 0.5f) / pixels;
+				}
+			}
+	};
+}
+
+/*
+	The sampler for the sample being traced on the calling thread. The camera starts it
+	for each pixel and sample, and the numbers of dimension d are then a pure function
+	of the pixel, the sample and d, like Rng's, so renders stay identical however
+	they are split between threads.
+
+	Dimensions go in pairs. Each pair is sampled as a 2D point, so 2D uses (like the
+	point in the pixel or a bounce direction) must take both numbers of one pair,
+	starting at an even dimension. 1D uses take the first of a pair.
+*/
+class Sampler {
+	public:
+		// The dimensions of the camera ray's point in the pixel
+		static const uint32_t pixelDimension = 0;
+
+		// The dimensions of a bounce: a pair for the direction, and the next pair for Russian roulette
+		static uint32_t bounceDimension(int bounce) { return 2 + 4 * static_cast<uint32_t>(bounce); }
+		static uint32_t rouletteDimension(int bounce) { return bounceDimension(bounce) + 2; }
+
+		Sampler() { start(SamplerType::Random, 0, 0, 1, 0, 1, 0); }
+
+		// Start a sample of the pixel (x, y) of an image width pixels wide, out of sampleCount
+		void start(SamplerType type, int x, int y, int width, uint32_t sample, uint32_t sampleCount, uint32_t seed) {
+			_type = type;
+			_x = x;
+			_y = y;
+			_sample = sample;
+			_sampleCount = (std::max)(sampleCount, 1u);
+			_seed = seed;
+			// Everything about the sample that doesn't depend on the dimension
+			_pixelSeed = sampling::hashCombine(seed, static_cast<uint32_t>(y) * static_cast<uint32_t>(width) + static_cast<uint32_t>(x));
+			_sampleSeed = sampling::hashCombine(_pixelSeed, sample);
+			_reversedSample = sampling::reverseBits(sample);
+		}
+
+		// Getters
+		const SamplerType type() const { return _type; }
+		// Random samples come straight from Rng, in the order they are drawn
+		const bool independent() const { return _type == SamplerType::Random; }
+
+		// The two numbers in [0, 1) of the pair of dimensions starting at dimension
+		void get2D(uint32_t dimension, float& u, float& v) const {
+			const uint32_t pair = dimension / 2;
+			switch (_type) {
+				case SamplerType::Stratified:
+					sampling::multiJittered2D(_sample % _sampleCount, _sampleCount, stratifiedSeed(pair), u, v);
+					break;
+				case SamplerType::Sobol:
+					sampling::scrambledSobol2D(_reversedSample, sampling::hashCombine(_pixelSeed, pair), u, v);
+					break;
+				case SamplerType::BlueNoise: {
+					// Every pixel gets the same sequence, rotated by the mask, shifted around the tile for each pair
+					const uint32_t seed = sampling::hashCombine(_seed, pair);
+					sampling::scrambledSobol2D(_reversedSample, seed, u, v);
+					const uint32_t shift = sampling::hash(seed);
+					const sampling::BlueNoiseMask& mask = sampling::BlueNoiseMask::get();
+					u = wrap(u + mask.value(_x + static_cast<int>(shift & 63), _y + static_cast<int>((shift >> 6) & 63)));
+					v = wrap(v + mask.value(_x + static_cast<int>((shift >> 12) & 63), _y + static_cast<int>((shift >> 18) & 63)));
+					break;
+				}
+				default: {
+					const uint32_t seed = sampling::hashCombine(_sampleSeed, pair);
+					u = sampling::toFloat(sampling::hash(seed));
+					v = sampling::toFloat(sampling::hash(seed ^ 0x2545f491u));
+					break;
+				}
+			}
+		}
+
+		// The first number of the pair starting at dimension, without working out the second
+		float get1D(uint32_t dimension) const {
+			const uint32_t pair = dimension / 2;
+			switch (_type) {
+				case SamplerType::Stratified: {
+					// Plain stratification in one dimension: a jittered point in each of sampleCount strata
+					const uint32_t seed = stratifiedSeed(pair);
+					const uint32_t stratum = sampling::permute(_sample % _sampleCount, _sampleCount, seed * 0x51633e2du);
+					const float jitter = sampling::toFloat(sampling::hash(sampling::hashCombine(stratum, seed * 0x967a889bu)));
+					return (std::min)((stratum + jitter) / _sampleCount, 0x1.fffffep-1f);
+				}
+				case SamplerType::Sobol:
+					return sampling::scrambledSobol1D(_reversedSample, sampling::hashCombine(_pixelSeed, pair));
+				case SamplerType::BlueNoise: {
+					const uint32_t seed = sampling::hashCombine(_seed, pair);
+					const uint32_t shift = sampling::hash(seed);
+					const sampling::BlueNoiseMask& mask = sampling::BlueNoiseMask::get();
+					return wrap(sampling::scrambledSobol1D(_reversedSample, seed) + mask.value(_x + static_cast<int>(shift & 63), _y + static_cast<int>((shift >> 6) & 63)));
+				}
+				default:
+					return sampling::toFloat(sampling::hash(sampling::hashCombine(_sampleSeed, pair)));
+			}
+		}
+
+		// The sampler on the calling thread
+		static Sampler& local() {
+			static thread_local Sampler sampler;
+			return sampler;
+		}
+
+	private:
+		SamplerType _type;
+		int _x;
+		int _y;
+		uint32_t _sample;
+		uint32_t _sampleCount;
+		uint32_t _seed;
+		uint32_t _pixelSeed;
+		uint32_t _sampleSeed;
+		uint32_t _reversedSample;
+
+		// Each round of sampleCount samples gets new strata
+		uint32_t stratifiedSeed(uint32_t pair) const {
+			return sampling::hashCombine(sampling::hashCombine(_pixelSeed, pair), _sample / _sampleCount);
+		}
+
+		// The fractional part of a sum of two numbers in [0, 1)
+		static float wrap(float value) {
+			return value >= 1.0f ? (std::min)(value - 1.0f, 0x1.fffffep-1f) : value;
+		}
+};
+
+/*
+	The sine and cosine of an angle given in turns in [0, 1). The library's sin and
+	cos are calls that take as long as a bounce's whole sampler. Here the turn is split
+	into quarters, and the angle within its quarter, measured from the quarter's middle
+	and so at most an eighth of a turn either way, goes through short Taylor series
+	that are exact to float precision over that range. Rotating by the middle of the
+	quarter gives the rest.
+*/
+inline void sinCosTurns(float turns, float& sine, float& cosine) {
+	const float quarters = turns * 4.0f;
+	const int quarter = (std::min)(static_cast<int>(quarters), 3);
+	const float angle = (quarters - quarter - 0.5f) * (0.5f * pi);
+	const float angle2 = angle * angle;
+	const float s = angle * (1.0f - angle2 / 6.0f * (1.0f - angle2 / 20.0f * (1.0f - angle2 / 42.0f)));
+	const float c = 1.0f - angle2 / 2.0f * (1.0f - angle2 / 12.0f * (1.0f - angle2 / 30.0f * (1.0f - angle2 / 56.0f)));
+	// The middle of quarter q is at (2q + 1) / 8 turns, where the sine and cosine are +-sqrt(1/2)
+	const float half = 0.70710678f;
+	const float middleSine = quarter < 2 ? half : -half;
+	const float middleCosine = quarter == 0 || quarter == 3 ? half : -half;
+	sine = middleSine * c + middleCosine * s;
+	cosine = middleCosine * c - middleSine * s;
+}
+
+/*
+	Turn two numbers in [0, 1) into a direction around the unit normal, with the
+	probability of each direction in proportion to its cosine with the normal: the
+	distribution of light a diffuse surface reflects. Points spread evenly over the
+	unit disk (by the square root of u) and lifted straight up onto the hemisphere
+	land with exactly that distribution, so unlike normal + randomUnitVectorInUnitSphere
+	no numbers are ever thrown away, and points spread evenly in [0, 1)^2 stay spread
+	evenly over the hemisphere.
+
+	See: https://www.pbr-book.org/3ed-2018/Monte_Carlo_Integration/2D_Sampling_with_Multidimensional_Transformations#Cosine-WeightedHemisphereSampling
+	and, for the basis around the normal: Duff et al., "Building an Orthonormal Basis,
+	Revisited" (JCGT 2017)
+*/
+inline Vec3 cosineDirection(const Vec3& normal, float u, float v) {
+	const float sign = std::copysign(1.0f, normal.z());
+	const float a = -1.0f / (sign + normal.z());
+	const float b = normal.x() * normal.y() * a;
+	const Vec3 tangent(1.0f + sign * normal.x() * normal.x() * a, sign * b, -sign * normal.x());
+	const Vec3 bitangent(b, sign + normal.y() * normal.y() * a, -normal.y());
+
+	const float radius = std::sqrt(u);
+	const float height = std::sqrt((std::max)(0.0f, 1.0f - u));
+	float sine, cosine;
+	sinCosTurns(v, sine, cosine);
+	return tangent * (radius * cosine) + bitangent * (radius * sine) + normal * height;
+}
+
+#endif
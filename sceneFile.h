@@ -0,0 +1,228 @@
+#pragma once
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include "mappedFile.h"
+#include "sphereBatch.h"
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+	Scene files, so scenes can be rendered without recompiling.
+
+	A scene is a list of spheres, which is loaded into a SphereBatch: four contiguous
+	arrays of floats rather than one heap allocated object per sphere. There are two
+	forms of the same scene:
+
+	The binary form is a 24 byte header followed by every sphere's center x, then
+	every center y, every center z and every radius, as little-endian floats. That is
+	the same structure-of-arrays layout SphereBatch keeps in memory, so loading a
+	scene is four straight copies out of the memory-mapped file, and the memory it
+	takes is the size of the data itself. The radii are checked after the copies.
+
+		char     magic[8]     "RENDYSCN"
+		uint32_t version      1
+		uint32_t reserved     0
+		uint64_t sphereCount
+
+	The text form is for writing scenes by hand, one sphere per line:
+
+		# a sphere resting on a huge "ground" sphere
+		sphere 0 0 -1 0.5
+		sphere 0 -100.5 -1 100
+
+	Blank lines and lines starting with # are skipped, and a # after the radius starts
+	a comment. In both forms every radius must be greater than zero. loadScene tells
+	the two forms apart by the magic at the start of the file.
+*/
+
+struct SceneFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t sphereCount;
+};
+
+static const char sceneFileMagic[8] = { 'R', 'E', 'N', 'D', 'Y', 'S', 'C', 'N' };
+static const uint32_t sceneFileVersion = 1;
+
+namespace sceneFile {
+	inline bool loadBinary(const char* data, size_t size, SphereBatch& batch, std::string& error) {
+		SceneFileHeader header;
+		if (size < sizeof(header)) {
+			error = "truncated header";
+			return false;
+		}
+		std::memcpy(&header, data, sizeof(header));
+		if (header.version != sceneFileVersion) {
+			error = "unsupported version " + std::to_string(header.version);
+			return false;
+		}
+
+		const uint64_t count = header.sphereCount;
+		if (count > static_cast<uint64_t>(INT32_MAX) || (size - sizeof(header)) / (4 * sizeof(float)) < count) {
+			error = "file is too short for " + std::to_string(count) + " spheres";
+			return false;
+		}
+
+		// The mapping starts on a page boundary and the header is a multiple of 4 bytes long, so the arrays are aligned for floats
+		const float* arrays = reinterpret_cast<const float*>(data + sizeof(header));
+		const size_t length = static_cast<size_t>(count);
+		batch.assign(arrays, arrays + length, arrays + 2 * length, arrays + 3 * length, length);
+		for (int i = 0; i < batch.size(); i++) {
+			if (!(batch.radius(i) > 0)) {
+				error = "sphere " + std::to_string(i + 1) + ": the radius must be greater than zero";
+				batch.clear();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline bool loadText(const char* data, size_t size, SphereBatch& batch, std::string& error) {
+		batch.clear();
+		const char* end = data + size;
+		int lineNumber = 0;
+		for (const char* line = data; line < end; ) {
+			const char* lineEnd = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if (lineEnd == nullptr) {
+				lineEnd = end;
+			}
+			lineNumber++;
+
+			const char* cursor = line;
+			auto skipSpace = [&]() {
+				while (cursor < lineEnd && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) {
+					cursor++;
+				}
+			};
+			skipSpace();
+
+			if (cursor < lineEnd && *cursor != '#') {
+				const char keyword[] = "sphere";
+				const size_t keywordLength = sizeof(keyword) - 1;
+				if (static_cast<size_t>(lineEnd - cursor) < keywordLength || std::memcmp(cursor, keyword, keywordLength) != 0) {
+					error = "line " + std::to_string(lineNumber) + ": expected \"sphere x y z radius\"";
+					return false;
+				}
+				cursor += keywordLength;
+
+				// Every number must be set off by whitespace, including the first from the keyword
+				float values[4];
+				for (int v = 0; v < 4; v++) {
+					const char* before = cursor;
+					skipSpace();
+					std::from_chars_result result = std::from_chars(cursor, lineEnd, values[v]);
+					if (cursor == before || result.ec != std::errc()) {
+						error = "line " + std::to_string(lineNumber) + ": expected \"sphere x y z radius\"";
+						return false;
+					}
+					cursor = result.ptr;
+				}
+
+				// Only whitespace or a comment may follow the radius
+				skipSpace();
+				if (cursor < lineEnd && *cursor != '#') {
+					error = "line " + std::to_string(lineNumber) + ": unexpected text after the radius";
+					return false;
+				}
+				if (!(values[3] > 0)) {
+					error = "line " + std::to_string(lineNumber) + ": the radius must be greater than zero";
+					return false;
+				}
+				batch.add(Vec3(values[0], values[1], values[2]), values[3]);
+			}
+
+			line = lineEnd + 1;
+		}
+		return true;
+	}
+}
+
+/*
+	Load the spheres of a binary or text scene file into the batch, replacing any it
+	held. On failure, returns false with a description of the problem in error.
+*/
+inline bool loadScene(const std::string& path, SphereBatch& batch, std::string& error) {
+	MappedFile file;
+	if (!file.open(path)) {
+		error = "could not open " + path;
+		return false;
+	}
+
+	bool loaded;
+	if (file.size() >= sizeof(sceneFileMagic) && std::memcmp(file.data(), sceneFileMagic, sizeof(sceneFileMagic)) == 0) {
+		loaded = sceneFile::loadBinary(file.data(), file.size(), batch, error);
+	} else {
+		loaded = sceneFile::loadText(file.data(), file.size(), batch, error);
+	}
+
+	if (!loaded) {
+		error = path + ": " + error;
+	}
+	return loaded;
+}
+
+// Write the spheres of the batch as a binary scene file
+inline bool writeSceneBinary(const std::string& path, const SphereBatch& batch) {
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+
+	SceneFileHeader header;
+	std::memcpy(header.magic, sceneFileMagic, sizeof(sceneFileMagic));
+	header.version = sceneFileVersion;
+	header.reserved = 0;
+	header.sphereCount = batch.size();
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+
+	// Write one component at a time through a small buffer, so any size of scene streams out
+	std::vector<float> buffer;
+	const int chunk = 1 << 16;
+	for (int c = 0; c < 4 && ok; c++) {
+		for (int begin = 0; begin < batch.size() && ok; begin += chunk) {
+			int end = (std::min)(begin + chunk, batch.size());
+			buffer.clear();
+			for (int i = begin; i < end; i++) {
+				Vec3 center = batch.center(i);
+				buffer.push_back(c < 3 ? center[c] : batch.radius(i));
+			}
+			ok = std::fwrite(buffer.data(), sizeof(float), buffer.size(), file) == buffer.size();
+		}
+	}
+
+	return std::fclose(file) == 0 && ok;
+}
+
+// Write the spheres of the batch as a text scene file
+inline bool writeSceneText(const std::string& path, const SphereBatch& batch) {
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	if (!file) {
+		return false;
+	}
+
+	bool ok = true;
+	for (int i = 0; i < batch.size() && ok; i++) {
+		Vec3 center = batch.center(i);
+		// 9 significant digits are enough for a float to read back exactly
+		ok = std::fprintf(file, "sphere %.9g %.9g %.9g %.9g\n", center.x(), center.y(), center.z(), batch.radius(i)) > 0;
+	}
+
+	return std::fclose(file) == 0 && ok;
+}
+
+// Write a scene file, as text if the path ends in .txt and in the binary form otherwise
+inline bool writeScene(const std::string& path, const SphereBatch& batch) {
+	const std::string text = ".txt";
+	if (path.size() >= text.size() && path.compare(path.size() - text.size(), text.size(), text) == 0) {
+		return writeSceneText(path, batch);
+	}
+	return writeSceneBinary(path, batch);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "rendyUtils.h"
+#include "flatScene.h"
+#include "sphere.h"
+#include "sphereBatch.h"
+#include "surface.h"
+#include "triangleMesh.h"
+#include <algorithm>
+#include <cmath>
+
+/*
+	Scenes shared by the Win32 and headless front ends
+*/
+
+// A sphere resting on a huge "ground" sphere
+inline void buildDefaultScene(SurfaceList& sceneObjects) {
+	// make_shared creates an object, in this case a sphere, and returns
+	// a shared_ptr to it
+	sceneObjects.add(std::make_shared<Sphere>(Vec3(0, 0, -1), 0.5));
+	sceneObjects.add(std::make_shared<Sphere>(Vec3(0, -100.5, -1), 100));
+}
+
+// The height of the top of the default scene's ground sphere above the point (x, z)
+inline float groundHeight(float x, float z) {
+	return -100.5f + std::sqrt(100.0f * 100.0f - x * x - (z + 1.0f) * (z + 1.0f));
+}
+
+/*
+	Scatter count small spheres over the ground in front of the camera, calling
+	addSphere(center, radius) for each. The spheres get smaller as count grows so
+	they stay roughly separated. The layout only depends on count and seed.
+*/
+template <typename AddSphere>
+inline void scatterSpheres(int count, uint32_t seed, AddSphere&& addSphere) {
+	const float halfWidth = 4.0f;
+	const float radius = (std::min)(0.2f, 0.35f * 2.0f * halfWidth / std::sqrt(static_cast<float>((std::max)(count, 1))));
+	Rng rng(seed);
+	for (int n = 0; n < count; n++) {
+		float x = -halfWidth + 2.0f * halfWidth * rng.nextFloat();
+		float z = -1.0f - 2.0f * halfWidth * rng.nextFloat();
+		float r = radius * (0.5f + rng.nextFloat());
+		// Rest the sphere on the curved surface of the ground sphere
+		addSphere(Vec3(x, groundHeight(x, z) + r, z), r);
+	}
+}
+
+// The default scene plus count scattered spheres, each its own Sphere object
+inline void buildRandomSpheresScene(SurfaceList& sceneObjects, int count, uint32_t seed = 0) {
+	buildDefaultScene(sceneObjects);
+	scatterSpheres(count, seed, [&](const Vec3& center, float radius) {
+		sceneObjects.add(std::make_shared<Sphere>(center, radius));
+	});
+}
+
+// The same scene as buildRandomSpheresScene, stored by value in a FlatScene
+inline void buildRandomSpheresFlatScene(FlatScene& scene, int count, uint32_t seed = 0) {
+	scene.reserveSpheres(2 + static_cast<size_t>((std::max)(count, 0)));
+	scene.addSphere(Vec3(0, 0, -1), 0.5);
+	scene.addSphere(Vec3(0, -100.5, -1), 100);
+	scatterSpheres(count, seed, [&](const Vec3& center, float radius) {
+		scene.addSphere(center, radius);
+	});
+}
+
+// The spheres of buildRandomSpheresScene, added to a SphereBatch
+inline void buildRandomSphereBatch(SphereBatch& batch, int count, uint32_t seed = 0) {
+	batch.reserve(batch.size() + 2 + static_cast<size_t>((std::max)(count, 0)));
+	batch.add(Vec3(0, 0, -1), 0.5);
+	batch.add(Vec3(0, -100.5, -1), 100);
+	scatterSpheres(count, seed, [&](const Vec3& center, float radius) {
+		batch.add(center, radius);
+	});
+}
+
+// The same scene as buildRandomSpheresScene, with every sphere in a single SphereBatch
+inline void buildRandomSphereBatchScene(SurfaceList& sceneObjects, int count, uint32_t seed = 0, SimdLevel level = SimdLevel::AVX512) {
+	auto batch = std::make_shared<SphereBatch>();
+	batch->simdLevel(level);
+	buildRandomSphereBatch(*batch, count, seed);
+	sceneObjects.add(batch);
+}
+
+/*
+	The default scene with a mesh standing in for its sphere. A mesh comes in whatever
+	units and position it was modelled in, so it is scaled to fit in the unit cube the
+	sphere took and set down on the ground where the sphere stood.
+*/
+inline void buildMeshScene(SurfaceList& sceneObjects, const std::shared_ptr<TriangleMesh>& mesh) {
+	const AABB bounds = mesh->boundingBox();
+	const float size = (std::max)({ bounds.x.size(), bounds.y.size(), bounds.z.size() });
+	const float scale = size > 0.0f ? 1.0f / size : 1.0f;
+	const Vec3 center = bounds.centroid();
+	mesh->transform(scale, Vec3(-center.x() * scale, -0.5f - bounds.y.min * scale, -1.0f - center.z() * scale));
+	sceneObjects.add(mesh);
+	sceneObjects.add(std::make_shared<Sphere>(Vec3(0, -100.5, -1), 100));
+}
+
+#endif
@@ -0,0 +1,104 @@
+#pragma once
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstring>
+#include <string>
+
+/*
+	Helpers for picking a SIMD instruction set at runtime.
+
+	Kernels for wider instruction sets are compiled into the same binary with
+	RENDY_TARGET, which lets GCC and Clang use those instructions in a single function
+	without enabling them for the whole program. MSVC always allows the intrinsics, so
+	there it expands to nothing. detectSimdLevel then asks the CPU which of those
+	kernels it can actually run.
+*/
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RENDY_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RENDY_TARGET(isa) __attribute__((target(isa)))
+#else
+#define RENDY_TARGET(isa)
+#endif
+
+enum class SimdLevel {
+	Scalar = 0,
+	SSE = 1,
+	AVX2 = 2,
+	AVX512 = 3
+};
+
+inline const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::SSE: return "sse";
+		case SimdLevel::AVX2: return "avx2";
+		case SimdLevel::AVX512: return "avx512";
+		default: return "scalar";
+	}
+}
+
+// Parses a name returned by simdLevelName, returning false if it isn't one
+inline bool parseSimdLevel(const std::string& name, SimdLevel& level) {
+	for (int n = 0; n <= static_cast<int>(SimdLevel::AVX512); n++) {
+		if (name == simdLevelName(static_cast<SimdLevel>(n))) {
+			level = static_cast<SimdLevel>(n);
+			return true;
+		}
+	}
+	return false;
+}
+
+// The widest instruction set that both the CPU and the operating system support
+inline SimdLevel detectSimdLevel() {
+#if defined(RENDY_X86) && (defined(__GNUC__) || defined(__clang__))
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) {
+		return SimdLevel::AVX512;
+	}
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return SimdLevel::AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return SimdLevel::SSE;
+	}
+	return SimdLevel::Scalar;
+#elif defined(RENDY_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int maxLeaf = info[0];
+	__cpuid(info, 1);
+	const bool sse41 = (info[2] & (1 << 19)) != 0;
+	const bool fma = (info[2] & (1 << 12)) != 0;
+	// The OS has to save the wider registers on context switches for AVX to be usable
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	const bool osAvx = (xcr0 & 0x6) == 0x6;
+	const bool osAvx512 = (xcr0 & 0xE6) == 0xE6;
+
+	bool avx2 = false, avx512 = false;
+	if (maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+		avx512 = (info[1] & (1 << 16)) != 0;
+	}
+
+	if (avx512 && osAvx512) {
+		return SimdLevel::AVX512;
+	}
+	if (avx2 && fma && osAvx) {
+		return SimdLevel::AVX2;
+	}
+	return sse41 ? SimdLevel::SSE : SimdLevel::Scalar;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+#endif
@@ -3,77 +3,151 @@
 #define SPHERE_H
 
 #include "rendyUtils.h"
+#include "renderStats.h"
 #include "surface.h"
 
+/*
+	Calculate the collision for a sphere by calculating a discriminant
+	using the offset from the center, the direction of the ray,
+	and the radius of the sphere, then using that discriminant if it is zero
+	or positive to calculate the quadratic formula for collisions. If the
+	quadratic result is zero or positive, there is at least one collision.
+
+	See https://raytracing.github.io/books/RayTracingInOneWeekend.html#addingasphere
+	for the full mathematical breakdown
+
+	Sphere and the flat scene storage both test spheres with it. It is always inlined,
+	so the loops over many spheres don't make a call per sphere. Only the distance of
+	the hit comes out of it; sphereHitAttributes works out the rest for the closest.
+*/
+RENDY_FORCEINLINE bool hitSphere(const Vec3& center, float radius, const Ray& r, Interval rayT, float& t) {
+	RENDY_STAT(sphereTests);
+	// Calculate the offset of origin from the center of the camera
+	Vec3 originCenter = r.origin() - center;
+	// We can simplify the dot of a vector with itself to be the square of it's length
+	//float a = dot(dir, dir);
+	float a = r.direction().lengthSquared();
+	// halfB and c below both dot originCenter with something, so work them out together
+	float originCenterDotDirection, originCenterLengthSquared;
+	dot2(originCenter, r.direction(), originCenter, originCenterDotDirection, originCenterLengthSquared);
+	/*
+		Since the equation for b has a factor of 2 in it, and the quadratic equation
+		divides by 2a, we can simplify. We can also pull the 2^2, or 4, out from the
+		square root portion of the discriminant
+
+		See https://raytracing.github.io/books/RayTracingInOneWeekend.html#surfacenormalsandmultipleobjects
+	*/
+	//float b = 2.0 * dot(originCenter, dir);
+	float halfB = originCenterDotDirection;
+	// We can simplify the dot of a vector with itself to be the square of it's length
+	//float c = dot(originCenter, originCenter) - (radius * radius);
+	float c = originCenterLengthSquared - radius * radius;
+	// Our quadratic discriminant formula is b^2 - 4ac. Taking out 4 we get b/2^2 - ac
+	//float discriminant = (b * b) - (4.0 * a * c);
+	float discriminant = (halfB * halfB) - (a * c);
+	// If our descriminant is negative, we cannot take the square root for our
+	// quadratic equation. Thus there is no intersection. Return false.
+	if (discriminant < 0) {
+		return false;
+	}
+	// Capture the square root of the discriminant for our quadratic calculations below
+	float sqrtD = sqrt(discriminant);
+	// In this case our root is based on a simplified quadratic formula. Since a square root can have a negative
+	// and a positive solution, we choose one to start with. In this case, we choose the negative first.
+	float root = (-halfB - sqrtD) / a;
+	// We check if our quadratic root is within the range of rayTMin < root < rayTMax
+	// where rayTMin and rayTMax are a range of t (time) that we allow the intersection to count
+	if (!rayT.surrounds(root)) {
+		// If the negative quadratic root is not within our range, we then try the positive root
+		root = (-halfB + sqrtD) / a;
+		// If neither root iw within our t range, then there is no intersection and we return false
+		if (!rayT.surrounds(root)) {
+			return false;
+		}
+	}
+
+	t = root;
+	RENDY_STAT(sphereHits);
+
+	return true;
+}
+
+// The point and normal of a hit hitSphere found at distance t
+inline void sphereHitAttributes(const Vec3& center, float radius, const Ray& r, float t, Intersection& sect) {
+	sect.t = t;
+	sect.point = r.at(t);
+	// Our outward normal is calculated by getting the offset vector
+	// of our intersection point from the center, and dividing by the radius.
+	Vec3 outwardNormal = (sect.point - center) / radius;
+	sect.setFaceNormal(r, outwardNormal);
+}
+
 class Sphere : public Surface {
 	public:
-		Sphere(Vec3 _center, double _radius): center(_center), radius(_radius) {}
+		Sphere(Vec3 _center, float _radius): center(_center), radius(_radius) {}
+
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			float t;
+			if (!hitSphere(center, radius, r, rayT, t)) {
+				return false;
+			}
+			hit.t = t;
+			hit.primitive = 0;
+			hit.surface = this;
+			return true;
+		}
+
+		void hitAttributes(const Ray& r, const Hit& hit, Intersection& sect) const override {
+			sphereHitAttributes(center, radius, r, hit.t, sect);
+		}
 
 		/*
-			Calculate the collision for a sphere by calculating a discriminant
-			using the offset from the center, the direction of the ray,
-			and the radius of the sphere, then using that discriminant if it is zero
-			or positive to calculate the quadratic formula for collisions. If the
-			quadratic result is zero or positive, there is at least one collision.
-
-			See https://raytracing.github.io/books/RayTracingInOneWeekend.html#addingasphere
-			for the full mathematical breakdown
+			The same test as closestHit for every lane of the packet. The lanes are worked
+			out side by side without branches so the compiler can vectorize the loop.
 		*/
-		bool intersect(const Ray& r, Interval rayT, Intersection& sect) const override {
-			// Calculate the offset of origin from the center of the camera
-			Vec3 originCenter = r.origin() - center;
-			// We can simplify the dot of a vector with itself to be the square of it's length
-			//float a = dot(dir, dir);
-			float a = r.direction().lengthSquared();
-			/*
-				Since the equation for b has a factor of 2 in it, and the quadratic equation
-				divides by 2a, we can simplify. We can also pull the 2^2, or 4, out from the
-				square root portion of the discriminant
-
-				See https://raytracing.github.io/books/RayTracingInOneWeekend.html#surfacenormalsandmultipleobjects
-			*/
-			//float b = 2.0 * dot(originCenter, dir);
-			float halfB = dot(originCenter, r.direction());
-			// We can simplify the dot of a vector with itself to be the square of it's length
-			//float c = dot(originCenter, originCenter) - (radius * radius);
-			float c = originCenter.lengthSquared() - radius * radius;
-			// Our quadratic discriminant formula is b^2 - 4ac. Taking out 4 we get b/2^2 - ac
-			//float discriminant = (b * b) - (4.0 * a * c);
-			float discriminant = (halfB * halfB) - (a * c);
-			// If our descriminant is negative, we cannot take the square root for our
-			// quadratic equation. Thus there is no intersection. Return false.
-			if (discriminant < 0) {
-				return false;
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			float roots[RayPacket::size];
+			bool found[RayPacket::size];
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				float ocx = packet.ox[lane] - center.x();
+				float ocy = packet.oy[lane] - center.y();
+				float ocz = packet.oz[lane] - center.z();
+				float a = packet.dx[lane] * packet.dx[lane] + packet.dy[lane] * packet.dy[lane] + packet.dz[lane] * packet.dz[lane];
+				float halfB = ocx * packet.dx[lane] + ocy * packet.dy[lane] + ocz * packet.dz[lane];
+				float c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+				float discriminant = (halfB * halfB) - (a * c);
+				float sqrtD = std::sqrt((std::max)(discriminant, 0.0f));
+				float nearRoot = (-halfB - sqrtD) / a;
+				float farRoot = (-halfB + sqrtD) / a;
+				// Bitwise rather than logical operators, so there are no branches to vectorize around
+				bool nearOk = (packet.tMin[lane] < nearRoot) & (nearRoot < packet.tMax[lane]);
+				bool farOk = (packet.tMin[lane] < farRoot) & (farRoot < packet.tMax[lane]);
+				roots[lane] = nearOk ? nearRoot : farRoot;
+				found[lane] = (discriminant >= 0) & (nearOk | farOk);
 			}
-			// Capture the square root of the discriminant for our quadratic calculations below
-			float sqrtD = sqrt(discriminant);
-			// In this case our root is based on a simplified quadratic formula. Since a square root can have a negative
-			// and a positive solution, we choose one to start with. In this case, we choose the negative first.
-			float root = (-halfB - sqrtD) / a;
-			// We check if our quadratic root is within the range of rayTMin < root < rayTMax
-			// where rayTMin and rayTMax are a range of t (time) that we allow the intersection to count
-			if (!rayT.surrounds(root)) {
-				// If the negative quadratic root is not within our range, we then try the positive root
-				root = (-halfB + sqrtD) / a;
-				// If neither root iw within our t range, then there is no intersection and we return false
-				if (!rayT.surrounds(root)) {
-					return false;
+
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				RENDY_STAT_ADD(sphereTests, packet.active(lane));
+				if (found[lane] && packet.active(lane)) {
+					Hit& hit = hits.closest[lane];
+					hit.t = roots[lane];
+					hit.primitive = 0;
+					hit.surface = this;
+					hits.hitMask |= 1u << lane;
+					RENDY_STAT(sphereHits);
 				}
 			}
+		}
 
-			sect.t = root;
-			sect.point = r.at(root);
-			// Our outward normal is calculated by getting the offset vector
-			// of our intersection point from the center, and dividing by the radius.
-			Vec3 outwardNormal = (sect.point - center) / radius;
-			sect.setFaceNormal(r, outwardNormal);
-
-			return true;
+		AABB boundingBox() const override {
+			Vec3 extent = Vec3(radius, radius, radius);
+			return AABB(center - extent, center + extent);
 		}
 
 	private:
 		Vec3 center;
-		double radius;
+		float radius;
 };
 
 #endif
\ No newline at end of file
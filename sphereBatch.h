@@ -0,0 +1,398 @@
+#pragma once
+#ifndef SPHEREBATCH_H
+#define SPHEREBATCH_H
+
+#include "rendyUtils.h"
+#include "renderStats.h"
+#include "bvh.h"
+#include "simd.h"
+#include "sphere.h"
+#include "surface.h"
+#include <vector>
+
+/*
+	The ray and the range of t being searched, unpacked into plain floats so that the
+	kernels below can broadcast them into SIMD registers.
+*/
+struct SphereBatchQuery {
+	float origin[3];
+	float direction[3];
+	// The squared length of the direction, and its reciprocal
+	float a;
+	float invA;
+	float tMin;
+	float tMax;
+};
+
+/*
+	Intersection kernels for a structure-of-arrays list of spheres. Each kernel tests
+	the ray against every sphere in [begin, end) and returns the index of the closest
+	one hit within (tMin, tMax), or -1. On a hit, tMax is updated to its distance.
+
+	The math is the same as Sphere::intersect, done for 4, 8 or 16 spheres at once.
+	Every lane keeps its own closest hit and sphere index, and one horizontal
+	reduction at the end picks the closest of those.
+*/
+namespace sphereKernels {
+	inline int closestHitScalar(
+		const float* cx, const float* cy, const float* cz, const float* radius,
+		int begin, int end, const SphereBatchQuery& q, float& tMax
+	) {
+		int bestIndex = -1;
+		for (int i = begin; i < end; i++) {
+			float ocx = q.origin[0] - cx[i];
+			float ocy = q.origin[1] - cy[i];
+			float ocz = q.origin[2] - cz[i];
+			float halfB = ocx * q.direction[0] + ocy * q.direction[1] + ocz * q.direction[2];
+			float c = ocx * ocx + ocy * ocy + ocz * ocz - radius[i] * radius[i];
+			float discriminant = halfB * halfB - q.a * c;
+			if (discriminant < 0) {
+				continue;
+			}
+			float sqrtD = std::sqrt(discriminant);
+			float root = (-halfB - sqrtD) * q.invA;
+			if (!(root > q.tMin && root < tMax)) {
+				root = (-halfB + sqrtD) * q.invA;
+				if (!(root > q.tMin && root < tMax)) {
+					continue;
+				}
+			}
+			tMax = root;
+			bestIndex = i;
+		}
+		return bestIndex;
+	}
+
+#ifdef RENDY_X86
+	// Picks the closest lane out of per-lane results that were stored to memory
+	inline int reduceLanes(const float* laneT, const int* laneIndex, int lanes, float& tMax) {
+		int bestIndex = -1;
+		for (int lane = 0; lane < lanes; lane++) {
+			if (laneIndex[lane] >= 0 && laneT[lane] < tMax) {
+				tMax = laneT[lane];
+				bestIndex = laneIndex[lane];
+			}
+		}
+		return bestIndex;
+	}
+
+	RENDY_TARGET("sse4.1")
+	inline int closestHitSSE(
+		const float* cx, const float* cy, const float* cz, const float* radius,
+		int begin, int end, const SphereBatchQuery& q, float& tMax
+	) {
+		const __m128 ox = _mm_set1_ps(q.origin[0]), oy = _mm_set1_ps(q.origin[1]), oz = _mm_set1_ps(q.origin[2]);
+		const __m128 dx = _mm_set1_ps(q.direction[0]), dy = _mm_set1_ps(q.direction[1]), dz = _mm_set1_ps(q.direction[2]);
+		const __m128 a = _mm_set1_ps(q.a), invA = _mm_set1_ps(q.invA);
+		const __m128 tMin = _mm_set1_ps(q.tMin);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 bestT = _mm_set1_ps(tMax);
+		__m128i bestIndex = _mm_set1_epi32(-1);
+		__m128i index = _mm_setr_epi32(begin, begin + 1, begin + 2, begin + 3);
+		const __m128i step = _mm_set1_epi32(4);
+
+		int i = begin;
+		for (; i + 4 <= end; i += 4) {
+			__m128 ocx = _mm_sub_ps(ox, _mm_loadu_ps(cx + i));
+			__m128 ocy = _mm_sub_ps(oy, _mm_loadu_ps(cy + i));
+			__m128 ocz = _mm_sub_ps(oz, _mm_loadu_ps(cz + i));
+			__m128 r = _mm_loadu_ps(radius + i);
+			__m128 halfB = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+			__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz)), _mm_mul_ps(r, r));
+			__m128 discriminant = _mm_sub_ps(_mm_mul_ps(halfB, halfB), _mm_mul_ps(a, c));
+			__m128 hit = _mm_cmpge_ps(discriminant, zero);
+			__m128 sqrtD = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+
+			// Prefer the near root, and fall back to the far root where the near one is out of range
+			__m128 nearRoot = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, halfB), sqrtD), invA);
+			__m128 farRoot = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, halfB), sqrtD), invA);
+			__m128 nearOk = _mm_and_ps(_mm_cmpgt_ps(nearRoot, tMin), _mm_cmplt_ps(nearRoot, bestT));
+			__m128 root = _mm_blendv_ps(farRoot, nearRoot, nearOk);
+			hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(root, tMin), _mm_cmplt_ps(root, bestT)));
+
+			bestT = _mm_blendv_ps(bestT, root, hit);
+			bestIndex = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(bestIndex), _mm_castsi128_ps(index), hit));
+			index = _mm_add_epi32(index, step);
+		}
+
+		alignas(16) float laneT[4];
+		alignas(16) int laneIndex[4];
+		_mm_store_ps(laneT, bestT);
+		_mm_store_si128(reinterpret_cast<__m128i*>(laneIndex), bestIndex);
+		int best = reduceLanes(laneT, laneIndex, 4, tMax);
+		int tail = closestHitScalar(cx, cy, cz, radius, i, end, q, tMax);
+		return tail >= 0 ? tail : best;
+	}
+
+	RENDY_TARGET("avx2,fma")
+	inline int closestHitAVX2(
+		const float* cx, const float* cy, const float* cz, const float* radius,
+		int begin, int end, const SphereBatchQuery& q, float& tMax
+	) {
+		const __m256 ox = _mm256_set1_ps(q.origin[0]), oy = _mm256_set1_ps(q.origin[1]), oz = _mm256_set1_ps(q.origin[2]);
+		const __m256 dx = _mm256_set1_ps(q.direction[0]), dy = _mm256_set1_ps(q.direction[1]), dz = _mm256_set1_ps(q.direction[2]);
+		const __m256 a = _mm256_set1_ps(q.a), invA = _mm256_set1_ps(q.invA);
+		const __m256 tMin = _mm256_set1_ps(q.tMin);
+		const __m256 zero = _mm256_setzero_ps();
+		__m256 bestT = _mm256_set1_ps(tMax);
+		__m256i bestIndex = _mm256_set1_epi32(-1);
+		__m256i index = _mm256_add_epi32(_mm256_set1_epi32(begin), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+		const __m256i step = _mm256_set1_epi32(8);
+
+		int i = begin;
+		for (; i + 8 <= end; i += 8) {
+			__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(cx + i));
+			__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(cy + i));
+			__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(cz + i));
+			__m256 r = _mm256_loadu_ps(radius + i);
+			__m256 halfB = _mm256_fmadd_ps(ocz, dz, _mm256_fmadd_ps(ocy, dy, _mm256_mul_ps(ocx, dx)));
+			__m256 c = _mm256_fnmadd_ps(r, r, _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx))));
+			__m256 discriminant = _mm256_fnmadd_ps(a, c, _mm256_mul_ps(halfB, halfB));
+			__m256 hit = _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ);
+			__m256 sqrtD = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+
+			__m256 nearRoot = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, halfB), sqrtD), invA);
+			__m256 farRoot = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, halfB), sqrtD), invA);
+			__m256 nearOk = _mm256_and_ps(_mm256_cmp_ps(nearRoot, tMin, _CMP_GT_OQ), _mm256_cmp_ps(nearRoot, bestT, _CMP_LT_OQ));
+			__m256 root = _mm256_blendv_ps(farRoot, nearRoot, nearOk);
+			hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(root, tMin, _CMP_GT_OQ), _mm256_cmp_ps(root, bestT, _CMP_LT_OQ)));
+
+			bestT = _mm256_blendv_ps(bestT, root, hit);
+			bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), hit));
+			index = _mm256_add_epi32(index, step);
+		}
+
+		alignas(32) float laneT[8];
+		alignas(32) int laneIndex[8];
+		_mm256_store_ps(laneT, bestT);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(laneIndex), bestIndex);
+		int best = reduceLanes(laneT, laneIndex, 8, tMax);
+		int tail = closestHitScalar(cx, cy, cz, radius, i, end, q, tMax);
+		return tail >= 0 ? tail : best;
+	}
+
+	RENDY_TARGET("avx512f")
+	inline int closestHitAVX512(
+		const float* cx, const float* cy, const float* cz, const float* radius,
+		int begin, int end, const SphereBatchQuery& q, float& tMax
+	) {
+		const __m512 ox = _mm512_set1_ps(q.origin[0]), oy = _mm512_set1_ps(q.origin[1]), oz = _mm512_set1_ps(q.origin[2]);
+		const __m512 dx = _mm512_set1_ps(q.direction[0]), dy = _mm512_set1_ps(q.direction[1]), dz = _mm512_set1_ps(q.direction[2]);
+		const __m512 a = _mm512_set1_ps(q.a), invA = _mm512_set1_ps(q.invA);
+		const __m512 tMin = _mm512_set1_ps(q.tMin);
+		const __m512 zero = _mm512_setzero_ps();
+		__m512 bestT = _mm512_set1_ps(tMax);
+		__m512i bestIndex = _mm512_set1_epi32(-1);
+		__m512i index = _mm512_add_epi32(_mm512_set1_epi32(begin), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+		const __m512i step = _mm512_set1_epi32(16);
+
+		int i = begin;
+		for (; i + 16 <= end; i += 16) {
+			__m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(cx + i));
+			__m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(cy + i));
+			__m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(cz + i));
+			__m512 r = _mm512_loadu_ps(radius + i);
+			__m512 halfB = _mm512_fmadd_ps(ocz, dz, _mm512_fmadd_ps(ocy, dy, _mm512_mul_ps(ocx, dx)));
+			__m512 c = _mm512_fnmadd_ps(r, r, _mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_mul_ps(ocx, ocx))));
+			__m512 discriminant = _mm512_fnmadd_ps(a, c, _mm512_mul_ps(halfB, halfB));
+			__mmask16 hit = _mm512_cmp_ps_mask(discriminant, zero, _CMP_GE_OQ);
+			__m512 sqrtD = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+
+			__m512 nearRoot = _mm512_mul_ps(_mm512_sub_ps(_mm512_sub_ps(zero, halfB), sqrtD), invA);
+			__m512 farRoot = _mm512_mul_ps(_mm512_add_ps(_mm512_sub_ps(zero, halfB), sqrtD), invA);
+			__mmask16 nearOk = _mm512_cmp_ps_mask(nearRoot, tMin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(nearRoot, bestT, _CMP_LT_OQ);
+			__m512 root = _mm512_mask_blend_ps(nearOk, farRoot, nearRoot);
+			hit &= _mm512_cmp_ps_mask(root, tMin, _CMP_GT_OQ) & _mm512_cmp_ps_mask(root, bestT, _CMP_LT_OQ);
+
+			bestT = _mm512_mask_blend_ps(hit, bestT, root);
+			bestIndex = _mm512_mask_blend_epi32(hit, bestIndex, index);
+			index = _mm512_add_epi32(index, step);
+		}
+
+		alignas(64) float laneT[16];
+		alignas(64) int laneIndex[16];
+		_mm512_store_ps(laneT, bestT);
+		_mm512_store_si512(laneIndex, bestIndex);
+		int best = reduceLanes(laneT, laneIndex, 16, tMax);
+		int tail = closestHitScalar(cx, cy, cz, radius, i, end, q, tMax);
+		return tail >= 0 ? tail : best;
+	}
+#endif
+}
+
+/*
+	A Surface holding many spheres as a structure of arrays: all the x coordinates of
+	the centers together, then all the y's, z's and radii. That layout lets one SIMD
+	instruction work on the same quantity for several spheres, so a ray is tested
+	against 4 (SSE), 8 (AVX2) or 16 (AVX-512) spheres at a time. The widest kernel the
+	CPU supports is picked at runtime, with a scalar loop as the fallback.
+*/
+class SphereBatch : public Surface {
+	public:
+		SphereBatch() : _level(supportedSimdLevel()) {}
+
+		void add(const Vec3& center, float radius) {
+			_cx.push_back(center.x());
+			_cy.push_back(center.y());
+			_cz.push_back(center.z());
+			_radius.push_back(radius);
+			_tree = BVHTree();
+		}
+
+		// Replace the spheres with count spheres copied from separate arrays of each component
+		void assign(const float* cx, const float* cy, const float* cz, const float* radius, size_t count) {
+			_cx.assign(cx, cx + count);
+			_cy.assign(cy, cy + count);
+			_cz.assign(cz, cz + count);
+			_radius.assign(radius, radius + count);
+			_tree = BVHTree();
+		}
+
+		void reserve(size_t count) {
+			_cx.reserve(count);
+			_cy.reserve(count);
+			_cz.reserve(count);
+			_radius.reserve(count);
+		}
+
+		void clear() {
+			_cx.clear();
+			_cy.clear();
+			_cz.clear();
+			_radius.clear();
+			_tree = BVHTree();
+		}
+
+		/*
+			Build a BVH over the spheres, for batches too large to test every sphere
+			against every ray. The spheres are reordered so that the spheres of each leaf
+			sit next to each other, and the SIMD kernels test a whole leaf at once. Adding
+			spheres afterwards drops the tree again.
+		*/
+		void buildBVH(int buildThreads = 0) {
+			std::vector<AABB> bounds(_radius.size());
+			for (int i = 0; i < size(); i++) {
+				bounds[i] = sphereBounds(i);
+			}
+			_tree.build(bounds, buildThreads);
+			bounds = std::vector<AABB>();
+
+			const std::vector<int>& order = _tree.primitives();
+			for (std::vector<float>* component : { &_cx, &_cy, &_cz, &_radius }) {
+				std::vector<float> sorted(order.size());
+				for (size_t i = 0; i < order.size(); i++) {
+					sorted[i] = (*component)[order[i]];
+				}
+				component->swap(sorted);
+			}
+		}
+
+		const int size() const { return static_cast<int>(_radius.size()); }
+		Vec3 center(int i) const { return Vec3(_cx[i], _cy[i], _cz[i]); }
+		const float radius(int i) const { return _radius[i]; }
+		const bool hasBVH() const { return !_tree.nodes().empty(); }
+		const BVHTree& tree() const { return _tree; }
+
+		// The kernel in use. Requests for levels the CPU can't run fall back to the widest one it can.
+		const SimdLevel simdLevel() const { return _level; }
+		void simdLevel(SimdLevel level) { _level = (std::min)(level, supportedSimdLevel()); }
+
+		static SimdLevel supportedSimdLevel() {
+			static const SimdLevel level = detectSimdLevel();
+			return level;
+		}
+
+		/*
+			Find the index of the closest sphere in [begin, end) hit by the ray inside
+			rayT, or -1 if there is none. On a hit, tHit holds its distance.
+		*/
+		int closestHit(const Ray& r, Interval rayT, int begin, int end, float& tHit) const {
+			RENDY_STAT_ADD(sphereTests, end - begin);
+			const Vec3 origin = r.origin();
+			const Vec3 direction = r.direction();
+			SphereBatchQuery q;
+			q.origin[0] = origin.x();
+			q.origin[1] = origin.y();
+			q.origin[2] = origin.z();
+			q.direction[0] = direction.x();
+			q.direction[1] = direction.y();
+			q.direction[2] = direction.z();
+			q.a = direction.lengthSquared();
+			q.invA = 1.0f / q.a;
+			q.tMin = rayT.min;
+			q.tMax = rayT.max;
+
+			tHit = rayT.max;
+			const float* cx = _cx.data();
+			const float* cy = _cy.data();
+			const float* cz = _cz.data();
+			const float* radius = _radius.data();
+			switch (_level) {
+#ifdef RENDY_X86
+				case SimdLevel::AVX512: return sphereKernels::closestHitAVX512(cx, cy, cz, radius, begin, end, q, tHit);
+				case SimdLevel::AVX2: return sphereKernels::closestHitAVX2(cx, cy, cz, radius, begin, end, q, tHit);
+				case SimdLevel::SSE: return sphereKernels::closestHitSSE(cx, cy, cz, radius, begin, end, q, tHit);
+#endif
+				default: return sphereKernels::closestHitScalar(cx, cy, cz, radius, begin, end, q, tHit);
+			}
+		}
+
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			float t;
+			int sphere = -1;
+			if (hasBVH()) {
+				// The spheres are in the tree's order, so every leaf is a range of them
+				_tree.traverseLeaves(r, rayT, [&](int begin, int end, Interval leafT, float& leafHitT) {
+					int leafHit = closestHit(r, leafT, begin, end, leafHitT);
+					if (leafHit < 0) {
+						return false;
+					}
+					sphere = leafHit;
+					t = leafHitT;
+					return true;
+				});
+			} else {
+				sphere = closestHit(r, rayT, 0, size(), t);
+			}
+			if (sphere < 0) {
+				return false;
+			}
+			RENDY_STAT(sphereHits);
+			hit.t = t;
+			hit.primitive = static_cast<uint32_t>(sphere);
+			hit.surface = this;
+			return true;
+		}
+
+		// Only the closest sphere needs its hit point and normal worked out
+		void hitAttributes(const Ray& r, const Hit& hit, Intersection& sect) const override {
+			sphereHitAttributes(center(hit.primitive), _radius[hit.primitive], r, hit.t, sect);
+		}
+
+		AABB boundingBox() const override {
+			if (hasBVH()) {
+				return _tree.bounds();
+			}
+			AABB bounds;
+			for (int i = 0; i < size(); i++) {
+				bounds.expand(sphereBounds(i));
+			}
+			return bounds;
+		}
+
+	private:
+		std::vector<float> _cx;
+		std::vector<float> _cy;
+		std::vector<float> _cz;
+		std::vector<float> _radius;
+		SimdLevel _level;
+		BVHTree _tree;
+
+		AABB sphereBounds(int i) const {
+			Vec3 extent = Vec3(_radius[i], _radius[i], _radius[i]);
+			return AABB(center(i) - extent, center(i) + extent);
+		}
+};
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef STOPTOKEN_H
+#define STOPTOKEN_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+
+/*
+	Cooperative cancellation, in the style of C++20's std::stop_source and
+	std::stop_token, which C++17 doesn't have yet.
+
+	Whoever starts some work keeps the StopSource and hands the work a StopToken.
+	Calling requestStop on the source doesn't interrupt anything by itself: the work
+	checks stopRequested at points where it can stop cleanly (the Camera checks before
+	every tile) and gives up from there. Tokens are cheap to copy and share the flag
+	of the source they came from, so it stays alive as long as any of them does.
+
+	A default constructed token belongs to no source, and a stop is never requested.
+*/
+class StopToken {
+	public:
+		StopToken() {}
+
+		// Getters
+		const bool stopRequested() const { return _stop && _stop->load(std::memory_order_relaxed); }
+		const bool stopPossible() const { return _stop != nullptr; }
+
+	private:
+		friend class StopSource;
+
+		std::shared_ptr<const std::atomic<bool>> _stop;
+
+		explicit StopToken(std::shared_ptr<const std::atomic<bool>> stop) : _stop(std::move(stop)) {}
+};
+
+class StopSource {
+	public:
+		StopSource() : _stop(std::make_shared<std::atomic<bool>>(false)) {}
+
+		// A token that sees the stops requested from this source
+		StopToken token() const { return StopToken(_stop); }
+
+		// Ask the work to stop. Returns true for the call that made the request, false if it was already made
+		bool requestStop() { return !_stop->exchange(true); }
+
+		// Getters
+		const bool stopRequested() const { return _stop->load(std::memory_order_relaxed); }
+
+	private:
+		std::shared_ptr<std::atomic<bool>> _stop;
+};
+
+#endif
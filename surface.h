@@ -1,8 +1,13 @@
 #pragma once
 #ifndef SURFACE_H
-#define SURCACE_H
+#define SURFACE_H
 
 #include "rendyUtils.h"
+#include "renderStats.h"
+#include "aabb.h"
+#include "rayPacket.h"
+#include <cassert>
+#include <cstdlib>
 #include <memory>
 #include <vector>
 
@@ -41,15 +46,100 @@ class Intersection {
 };
 
 
+class Surface;
+
+/*
+	The closest hit found so far while a ray searches the scene, kept down to where
+	along the ray it is and what it hit: surface is the Surface that can work out the
+	rest of the Intersection, and primitive is a number that surface gives meaning to,
+	such as which of its triangles or spheres it was. Only the final closest hit has
+	its point and normal worked out, by surface->hitAttributes.
+*/
+struct Hit {
+	float t;
+	uint32_t primitive;
+	const Surface* surface;
+};
+
+/*
+	The closest hit for each lane of a RayPacket. Only lanes whose bit is set in
+	hitMask hit anything; the other entries of closest and sect are left untouched.
+	sect is only filled in by Surface::intersectPacket, once the search is over.
+*/
+struct PacketIntersection {
+	Hit closest[RayPacket::size];
+	Intersection sect[RayPacket::size];
+	uint32_t hitMask = 0;
+
+	bool hit(int lane) const { return (hitMask >> lane) & 1u; }
+};
+
+
 /*
 	The Surface class is an abstract class that contains an intersect method that determines whether
 	this surface has been hit by a ray. Can be extended by all entities in a scene.
+
+	Finding the closest hit is split in two. closestHit searches for it keeping only
+	a Hit, the distance and what was hit, so the many candidates a ray passes on the
+	way don't each have their point and normal worked out and copied around, only to
+	be beaten by a closer one. hitAttributes then fills in the Intersection for the
+	one that won. intersect does both.
 */
 class Surface {
 	public:
 		virtual ~Surface() = default;
 
-		virtual bool intersect(const Ray& r, Interval rayT, Intersection& sect) const = 0;
+		/*
+			Find the closest hit inside rayT. On a hit, store it in hit and return true;
+			otherwise leave hit alone, so a caller can pass the closest hit it has so far
+			and narrow rayT to it.
+		*/
+		virtual bool closestHit(const Ray& r, Interval rayT, Hit& hit) const = 0;
+
+		/*
+			Work out the intersection of a hit this surface reported as its own. Surfaces
+			made of other surfaces pass their children's hits on as they are, so theirs is
+			never called, and aborts if it is rather than shade an Intersection it never
+			filled in.
+		*/
+		virtual void hitAttributes(const Ray& r, const Hit& hit, Intersection& sect) const = 0;
+
+		// The axis-aligned box that encloses the whole surface
+		virtual AABB boundingBox() const = 0;
+
+		/*
+			Find the closest hit of every active lane of the packet, each within its own
+			interval. Lanes that hit are added to hits.hitMask with their hit in
+			hits.closest. Surfaces that can share work between the lanes override this;
+			the default traces the lanes one by one.
+		*/
+		virtual void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const {
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				if (packet.active(lane) && closestHit(packet.ray(lane), packet.rayT(lane), hits.closest[lane])) {
+					hits.hitMask |= 1u << lane;
+				}
+			}
+		}
+
+		// The closest intersection inside rayT, with its point and normal
+		bool intersect(const Ray& r, Interval rayT, Intersection& sect) const {
+			Hit hit;
+			if (!closestHit(r, rayT, hit)) {
+				return false;
+			}
+			hit.surface->hitAttributes(r, hit, sect);
+			return true;
+		}
+
+		// The closest intersection of every active lane of the packet, in hits.sect
+		void intersectPacket(const RayPacket& packet, PacketIntersection& hits) const {
+			closestHitPacket(packet, hits);
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				if (hits.hit(lane)) {
+					hits.closest[lane].surface->hitAttributes(packet.ray(lane), hits.closest[lane], hits.sect[lane]);
+				}
+			}
+		}
 };
 
 class SurfaceList : public Surface {
@@ -71,20 +161,44 @@ class SurfaceList : public Surface {
 
 		void add(std::shared_ptr<Surface> object) { objects.push_back(object); }
 
-		bool intersect(const Ray& r, Interval rayT, Intersection& sect) const override {
-			Intersection tempSect;
-			bool intersectAnything = false;
-			float closest = rayT.max;
+		// Each object only overwrites hit when it finds one closer than the one already there
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			bool hitAnything = false;
+			for (const auto& object : objects) {
+				if (object->closestHit(r, rayT, hit)) {
+					hitAnything = true;
+					rayT.max = hit.t;
+				}
+			}
+			return hitAnything;
+		}
+
+		// The hits are the objects' own, so they are never this list's to finish
+		void hitAttributes(const Ray&, const Hit&, Intersection&) const override {
+			assert(false && "SurfaceList passes its objects' hits on");
+			std::abort();
+		}
 
+		// Test the whole packet against each object in turn, narrowing each lane's interval as it hits
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			RayPacket narrowed = packet;
 			for (const auto& object : objects) {
-				if (object->intersect(r, Interval(rayT.min, closest), tempSect)) {
-					intersectAnything = true;
-					closest = tempSect.t;
-					sect = tempSect;
+				object->closestHitPacket(narrowed, hits);
+				for (int lane = 0; lane < RayPacket::size; lane++) {
+					if (hits.hit(lane)) {
+						narrowed.tMax[lane] = hits.closest[lane].t;
+					}
 				}
 			}
+		}
 
-			return intersectAnything;
+		AABB boundingBox() const override {
+			AABB bounds;
+			for (const auto& object : objects) {
+				bounds.expand(object->boundingBox());
+			}
+			return bounds;
 		}
 };
 
@@ -0,0 +1,160 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+	A fixed-size pool of worker threads that runs batches of indexed tasks.
+
+	Each worker owns a queue of task indices. When a batch starts, the tasks are
+	split into contiguous runs, one run per worker, so neighbouring tiles stay on the
+	same thread. A worker pops from the front of its own queue, and once that is
+	empty it steals from the back of another worker's queue. This keeps every core
+	busy when some tasks are much more expensive than others, for example tiles that
+	cover the center sphere versus tiles that only see the sky.
+
+	The pool is meant to be driven from one thread at a time; parallelFor must not
+	be called from inside a task.
+*/
+class ThreadPool {
+	public:
+		using Task = std::function<void(int task, int worker)>;
+
+		// A threadCount of zero or less uses one thread per hardware thread
+		explicit ThreadPool(int threadCount = 0) {
+			if (threadCount <= 0) {
+				threadCount = (std::max)(1u, std::thread::hardware_concurrency());
+			}
+			for (int worker = 0; worker < threadCount; worker++) {
+				_queues.push_back(std::make_unique<WorkQueue>());
+			}
+			for (int worker = 0; worker < threadCount; worker++) {
+				_workers.emplace_back([this, worker] { workerLoop(worker); });
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stopping = true;
+			}
+			_wake.notify_all();
+			for (std::thread& worker : _workers) {
+				worker.join();
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		const int threadCount() const { return static_cast<int>(_workers.size()); }
+
+		/*
+			Run task(i, worker) for every i in [0, taskCount) and block until all of
+			them have finished. worker is the index of the thread running the task, which
+			callers can use to address per-thread scratch data.
+		*/
+		void parallelFor(int taskCount, const Task& task) {
+			if (taskCount <= 0) {
+				return;
+			}
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_task = &task;
+			_remaining = taskCount;
+
+			// Hand each worker a contiguous run of tasks
+			const int workers = threadCount();
+			for (int worker = 0; worker < workers; worker++) {
+				int begin = static_cast<int>(static_cast<long long>(taskCount) * worker / workers);
+				int end = static_cast<int>(static_cast<long long>(taskCount) * (worker + 1) / workers);
+				std::lock_guard<std::mutex> queueLock(_queues[worker]->mutex);
+				for (int i = begin; i < end; i++) {
+					_queues[worker]->tasks.push_back(i);
+				}
+			}
+
+			_generation++;
+			_wake.notify_all();
+			_done.wait(lock, [this] { return _remaining == 0; });
+			_task = nullptr;
+		}
+
+	private:
+		struct WorkQueue {
+			std::mutex mutex;
+			std::deque<int> tasks;
+		};
+
+		std::vector<std::thread> _workers;
+		std::vector<std::unique_ptr<WorkQueue>> _queues;
+
+		std::mutex _mutex;
+		std::condition_variable _wake;
+		std::condition_variable _done;
+		const Task* _task = nullptr;
+		std::atomic<int> _remaining{ 0 };
+		unsigned long long _generation = 0;
+		bool _stopping = false;
+
+		void workerLoop(int worker) {
+			unsigned long long seenGeneration = 0;
+			while (true) {
+				{
+					std::unique_lock<std::mutex> lock(_mutex);
+					_wake.wait(lock, [&] { return _stopping || _generation != seenGeneration; });
+					if (_stopping) {
+						return;
+					}
+					seenGeneration = _generation;
+				}
+
+				int task;
+				while (popLocal(worker, task) || steal(worker, task)) {
+					(*_task)(task, worker);
+					if (--_remaining == 0) {
+						// Take the lock so the notification can't slip in before parallelFor waits
+						std::lock_guard<std::mutex> lock(_mutex);
+						_done.notify_all();
+					}
+				}
+			}
+		}
+
+		bool popLocal(int worker, int& task) {
+			WorkQueue& queue = *_queues[worker];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.tasks.empty()) {
+				return false;
+			}
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			return true;
+		}
+
+		// Steal from the back of the other workers' queues, starting with our neighbour
+		bool steal(int worker, int& task) {
+			const int workers = threadCount();
+			for (int offset = 1; offset < workers; offset++) {
+				WorkQueue& victim = *_queues[(worker + offset) % workers];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				if (!victim.tasks.empty()) {
+					task = victim.tasks.back();
+					victim.tasks.pop_back();
+					return true;
+				}
+			}
+			return false;
+		}
+};
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef TONEMAPPER_H
+#define TONEMAPPER_H
+
+#include "rendyUtils.h"
+#include "vec3.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*
+	Turns the linear light the camera gathers into the 8-bit levels of the image.
+
+	The samples of a pixel are summed and averaged as linear floats, which is the
+	space light adds up in, and only the average goes through the tone mapper: scaled
+	by the exposure, raised to 1 / gamma (the square root for the default gamma of
+	2) and quantized to 0-255, clamping anything brighter than 1.
+
+	Doing that with pow for every channel of every pixel would cost more than the
+	rest of resolving the image, so the tone mapper looks the level up in a table
+	instead. The table is indexed by the bits of the float itself: its exponent and
+	the top mantissaBits of its mantissa. Each entry covers a range of values only
+	1 / 1024 of their size wide, at every brightness, and holds the level of the
+	value in its middle, truncated. Most values get the same level as computing it
+	exactly, but one close to where the level steps up can be one level off, if the
+	step falls inside its entry. Values below 2^-24 all come out as black, and the
+	table is 24 KB.
+*/
+class ToneMapper {
+	public:
+		ToneMapper(float exposure = 1.0f, float gamma = 2.0f) : _exposure(exposure), _gamma(gamma) {
+			_table.resize(static_cast<size_t>(exponents) << mantissaBits);
+			for (size_t entry = 0; entry < _table.size(); entry++) {
+				// The middle of the range of values the entry covers
+				const uint32_t bits = minimumBits + (static_cast<uint32_t>(entry) << (23 - mantissaBits)) + (1u << (22 - mantissaBits));
+				float value;
+				std::memcpy(&value, &bits, sizeof(value));
+				_table[entry] = static_cast<uint8_t>(255.999f * std::pow(value, 1.0f / gamma));
+			}
+		}
+
+		// Getters
+		const float exposure() const { return _exposure; }
+		const float gamma() const { return _gamma; }
+
+		// The 8-bit level of a linear value that has already been scaled by the exposure
+		uint32_t level(float exposed) const {
+			int32_t bits;
+			std::memcpy(&bits, &exposed, sizeof(bits));
+			// Negative values and NaNs with the sign bit set compare below too, as signed integers
+			if (bits < static_cast<int32_t>(minimumBits)) {
+				return 0;
+			}
+			if (bits >= static_cast<int32_t>(oneBits)) {
+				return 255;
+			}
+			return _table[static_cast<uint32_t>(bits - minimumBits) >> (23 - mantissaBits)];
+		}
+
+		// The levels a linear color shows up as, for measuring noise the way it looks
+		Vec3 levels(const Vec3& color) const {
+			const Vec3 exposed = color * _exposure;
+			return Vec3(
+				static_cast<float>(level(exposed.x())),
+				static_cast<float>(level(exposed.y())),
+				static_cast<float>(level(exposed.z()))
+			);
+		}
+
+		// A linear color as a 0x00RRGGBB framebuffer pixel
+		uint32_t pack(const Vec3& color) const {
+			const Vec3 exposed = color * _exposure;
+			return (level(exposed.x()) << 16) | (level(exposed.y()) << 8) | level(exposed.z());
+		}
+
+	private:
+		// How many of the top bits of the mantissa pick the entry, along with the exponent
+		static constexpr int mantissaBits = 10;
+		// The powers of two between 2^-24 and 1 that the table covers
+		static constexpr int exponents = 24;
+		static constexpr uint32_t oneBits = 0x3F800000u;
+		static constexpr uint32_t minimumBits = oneBits - (static_cast<uint32_t>(exponents) << 23);
+
+		float _exposure;
+		float _gamma;
+		std::vector<uint8_t> _table;
+};
+
+#endif
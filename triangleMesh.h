@@ -0,0 +1,325 @@
+#pragma once
+#ifndef TRIANGLEMESH_H
+#define TRIANGLEMESH_H
+
+#include "rendyUtils.h"
+#include "aabb.h"
+#include "bvh.h"
+#include "rayPacket.h"
+#include "renderStats.h"
+#include "surface.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+	A ray set up for the watertight ray-triangle test. The test works in a space where
+	the ray runs along +z from the origin, which takes a permutation of the axes and a
+	shear that only depend on the ray, so they are worked out once per ray rather
+	than once per triangle.
+*/
+struct TriangleRay {
+	Vec3 origin;
+	// The axis the ray travels furthest along becomes z
+	int kx, ky, kz;
+	// The shear that lines the ray up with z
+	float sx, sy, sz;
+
+	TriangleRay(const Vec3& rayOrigin, const Vec3& direction) : origin(rayOrigin) {
+		kz = 0;
+		if (std::fabs(direction[1]) > std::fabs(direction[kz])) {
+			kz = 1;
+		}
+		if (std::fabs(direction[2]) > std::fabs(direction[kz])) {
+			kz = 2;
+		}
+		kx = kz == 2 ? 0 : kz + 1;
+		ky = kx == 2 ? 0 : kx + 1;
+		// Swapping x and y keeps the winding of the triangles the same when the ray points down z
+		if (direction[kz] < 0) {
+			std::swap(kx, ky);
+		}
+		sz = 1.0f / direction[kz];
+		sx = direction[kx] * sz;
+		sy = direction[ky] * sz;
+	}
+};
+
+/*
+	Intersect the ray with the triangle p0 p1 p2, and on a hit inside rayT store the
+	distance along the ray in t.
+
+	This is the watertight test of Woop, Benthin and Wald. After moving the triangle
+	into the ray's space, the ray passes through the triangle if the three 2D edge
+	functions U, V and W all have the same sign. Neighbouring triangles work out the
+	edge function of a shared edge from the same two vertices in the same way, so a
+	ray that lands exactly on an edge or vertex can't slip between them: one side or
+	the other always counts it. Edge functions that come out exactly zero in float
+	are worked out again in double so the tie is decided consistently.
+
+	Both sides of the triangle count as hits.
+
+	See: Woop, Benthin, Wald, "Watertight Ray/Triangle Intersection" (JCGT 2013)
+*/
+inline bool intersectTriangle(const TriangleRay& ray, const Vec3& p0, const Vec3& p1, const Vec3& p2, Interval rayT, float& t) {
+	RENDY_STAT(triangleTests);
+	const Vec3 a = p0 - ray.origin;
+	const Vec3 b = p1 - ray.origin;
+	const Vec3 c = p2 - ray.origin;
+
+	// Shear the vertices so the ray runs along z, which leaves a 2D test in x and y
+	const float ax = a[ray.kx] - ray.sx * a[ray.kz];
+	const float ay = a[ray.ky] - ray.sy * a[ray.kz];
+	const float bx = b[ray.kx] - ray.sx * b[ray.kz];
+	const float by = b[ray.ky] - ray.sy * b[ray.kz];
+	const float cx = c[ray.kx] - ray.sx * c[ray.kz];
+	const float cy = c[ray.ky] - ray.sy * c[ray.kz];
+
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+
+	if (u == 0.0f || v == 0.0f || w == 0.0f) {
+		u = static_cast<float>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+		v = static_cast<float>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+		w = static_cast<float>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+	}
+
+	// Outside one of the edges
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+		return false;
+	}
+
+	const float determinant = u + v + w;
+	if (determinant == 0.0f) {
+		return false;
+	}
+
+	// The distance is the barycentric interpolation of the sheared z of the vertices
+	const float az = ray.sz * a[ray.kz];
+	const float bz = ray.sz * b[ray.kz];
+	const float cz = ray.sz * c[ray.kz];
+	const float root = (u * az + v * bz + w * cz) / determinant;
+	if (!rayT.surrounds(root)) {
+		return false;
+	}
+
+	t = root;
+	RENDY_STAT(triangleHits);
+	return true;
+}
+
+/*
+	A mesh of triangles that share their vertices: one array of vertex positions and
+	one array of indices into it, three per triangle. A million-triangle mesh costs its
+	vertex and index data and a BVH, not a million separate objects.
+
+	The mesh has its own BVH, built by build, so it is a single object to the scene
+	around it however many triangles it has. The build puts the triangles in the
+	order of the tree's leaves, so a leaf reads a run of the index array. Without a
+	tree, rays test every triangle in turn.
+
+	Triangles are flat shaded with their geometric normal.
+*/
+class TriangleMesh : public Surface {
+	public:
+		TriangleMesh() {}
+
+		void reserve(size_t vertexCount, size_t triangleCount) {
+			_vertices.reserve(vertexCount);
+			_indices.reserve(3 * triangleCount);
+		}
+
+		// Add a vertex, returning its index
+		uint32_t addVertex(const Vec3& position) {
+			_vertices.push_back(position);
+			_tree = BVHTree();
+			return static_cast<uint32_t>(_vertices.size() - 1);
+		}
+
+		// Add a triangle between three vertices that were already added
+		void addTriangle(uint32_t v0, uint32_t v1, uint32_t v2) {
+			_indices.push_back(v0);
+			_indices.push_back(v1);
+			_indices.push_back(v2);
+			_tree = BVHTree();
+		}
+
+		// Scale every vertex about the origin, then move it by offset
+		void transform(float scale, const Vec3& offset) {
+			for (Vec3& position : _vertices) {
+				position = position * scale + offset;
+			}
+			_tree = BVHTree();
+		}
+
+		// Give back the room reserved for vertices and triangles that never came
+		void shrinkToFit() {
+			_vertices.shrink_to_fit();
+			_indices.shrink_to_fit();
+		}
+
+		/*
+			Build the BVH over the triangles and put the triangles in the order of its
+			leaves. Adding vertices or triangles, or transforming the mesh, drops the tree again.
+		*/
+		void build(int buildThreads = 0) {
+			const size_t count = triangleCount();
+			std::vector<AABB> bounds(count);
+			for (size_t triangle = 0; triangle < count; triangle++) {
+				bounds[triangle] = triangleBounds(triangle);
+			}
+			_tree.build(bounds, buildThreads);
+			bounds = std::vector<AABB>();
+
+			std::vector<uint32_t> sorted(_indices.size());
+			const std::vector<int>& order = _tree.primitives();
+			for (size_t i = 0; i < order.size(); i++) {
+				for (int corner = 0; corner < 3; corner++) {
+					sorted[3 * i + corner] = _indices[3 * static_cast<size_t>(order[i]) + corner];
+				}
+			}
+			_indices.swap(sorted);
+			_tree.renumberPrimitives();
+		}
+
+		// Getters
+		const size_t vertexCount() const { return _vertices.size(); }
+		const size_t triangleCount() const { return _indices.size() / 3; }
+		const std::vector<Vec3>& vertices() const { return _vertices; }
+		const std::vector<uint32_t>& indices() const { return _indices; }
+		const Vec3& vertex(size_t triangle, int corner) const { return _vertices[_indices[3 * triangle + corner]]; }
+		const BVHTree& tree() const { return _tree; }
+		// The memory the vertices, indices and tree take
+		const size_t memoryBytes() const {
+			return _vertices.capacity() * sizeof(Vec3) + _indices.capacity() * sizeof(uint32_t)
+				+ _tree.nodes().capacity() * sizeof(BVHNode) + _tree.primitives().capacity() * sizeof(int);
+		}
+
+		/*
+			Only the distance and the triangle are kept while searching; the point and the
+			normal are worked out once, for the closest triangle, by hitAttributes.
+		*/
+		bool closestHit(const Ray& r, Interval rayT, Hit& hit) const override {
+			RENDY_STAT(intersectCalls);
+			const TriangleRay ray(r.origin(), r.direction());
+			float closest = rayT.max;
+			size_t hitTriangle = 0;
+			bool found;
+			if (_tree.nodes().empty()) {
+				found = intersectTriangles(ray, 0, triangleCount(), rayT, closest, hitTriangle);
+			} else {
+				// Each hit a leaf reports is closer than the last, so the last one is the closest
+				found = _tree.traverseLeaves(r, rayT, [&](int begin, int end, Interval leafT, float& t) {
+					if (intersectTriangles(ray, begin, end, leafT, t, hitTriangle)) {
+						closest = t;
+						return true;
+					}
+					return false;
+				});
+			}
+			if (!found) {
+				return false;
+			}
+			hit.t = closest;
+			hit.primitive = static_cast<uint32_t>(hitTriangle);
+			hit.surface = this;
+			return true;
+		}
+
+		void hitAttributes(const Ray& r, const Hit& hit, Intersection& sect) const override {
+			const Vec3& p0 = vertex(hit.primitive, 0);
+			sect.t = hit.t;
+			sect.point = r.at(hit.t);
+			sect.setFaceNormal(r, unit(cross(vertex(hit.primitive, 1) - p0, vertex(hit.primitive, 2) - p0)));
+		}
+
+		// The lanes that reach a leaf test its triangles each within their closest hit so far
+		void closestHitPacket(const RayPacket& packet, PacketIntersection& hits) const override {
+			if (_tree.nodes().empty()) {
+				Surface::closestHitPacket(packet, hits);
+				return;
+			}
+
+			float closest[RayPacket::size];
+			size_t hitTriangle[RayPacket::size];
+			uint32_t hitMask = 0;
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				closest[lane] = packet.tMax[lane];
+			}
+
+			_tree.traversePacket(packet, closest, [&](int triangle, uint32_t laneMask, float* laneClosest) {
+				for (int lane = 0; lane < RayPacket::size; lane++) {
+					if (!((laneMask >> lane) & 1u)) {
+						continue;
+					}
+					const Ray r = packet.ray(lane);
+					const TriangleRay ray(r.origin(), r.direction());
+					float t;
+					if (intersectTriangle(ray, vertex(triangle, 0), vertex(triangle, 1), vertex(triangle, 2), Interval(packet.tMin[lane], laneClosest[lane]), t)) {
+						laneClosest[lane] = t;
+						hitTriangle[lane] = triangle;
+						hitMask |= 1u << lane;
+					}
+				}
+			});
+
+			for (int lane = 0; lane < RayPacket::size; lane++) {
+				if ((hitMask >> lane) & 1u) {
+					Hit& hit = hits.closest[lane];
+					hit.t = closest[lane];
+					hit.primitive = static_cast<uint32_t>(hitTriangle[lane]);
+					hit.surface = this;
+					hits.hitMask |= 1u << lane;
+				}
+			}
+		}
+
+		AABB boundingBox() const override {
+			if (!_tree.nodes().empty()) {
+				return _tree.bounds();
+			}
+			AABB bounds;
+			for (size_t triangle = 0; triangle < triangleCount(); triangle++) {
+				bounds.expand(triangleBounds(triangle));
+			}
+			return bounds;
+		}
+
+	private:
+		std::vector<Vec3> _vertices;
+		// Three vertex indices per triangle
+		std::vector<uint32_t> _indices;
+		BVHTree _tree;
+
+		AABB triangleBounds(size_t triangle) const {
+			const Vec3& p0 = vertex(triangle, 0);
+			const Vec3& p1 = vertex(triangle, 1);
+			const Vec3& p2 = vertex(triangle, 2);
+			Vec3 low, high;
+			for (int axis = 0; axis < 3; axis++) {
+				low[axis] = (std::min)({ p0[axis], p1[axis], p2[axis] });
+				high[axis] = (std::max)({ p0[axis], p1[axis], p2[axis] });
+			}
+			return AABB(low, high);
+		}
+
+		// The closest of the triangles [begin, end) inside rayT, narrowing the interval as it finds hits
+		bool intersectTriangles(const TriangleRay& ray, size_t begin, size_t end, Interval rayT, float& t, size_t& hitTriangle) const {
+			bool hit = false;
+			for (size_t triangle = begin; triangle < end; triangle++) {
+				float triangleT;
+				if (intersectTriangle(ray, vertex(triangle, 0), vertex(triangle, 1), vertex(triangle, 2), rayT, triangleT)) {
+					hit = true;
+					rayT.max = triangleT;
+					t = triangleT;
+					hitTriangle = triangle;
+				}
+			}
+			return hit;
+		}
+};
+
+#endif
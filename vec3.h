@@ -4,7 +4,206 @@
 
 #include <cmath>
 #include <iostream>
+#include "renderStats.h"
 
+/*
+	Vec3 has two builds, picked at compile time.
+
+	Where SSE2 (every x86-64 CPU) or AArch64 NEON is available, a Vec3 is one 16-byte
+	aligned SIMD register: x, y and z in the first three lanes and a fourth lane that
+	is ignored. Adding, multiplying or dividing two vectors is then one
+	instruction rather than three, and a Vec3 is passed and returned in a register.
+	Otherwise, or when RENDY_SCALAR_VEC3 is defined (the CMake option of the same
+	name), Vec3 is three plain floats.
+
+	Both builds add up the lanes of dot and lengthSquared in the same order, x then y
+	then z, so on x86 they give bit-identical results and render the same image. The
+	exceptions are fastUnit and mulAdd, which trade that for speed (see below).
+*/
+#if !defined(RENDY_SCALAR_VEC3) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RENDY_VEC3_SSE 1
+#include <emmintrin.h>
+#if defined(__FMA__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#elif !defined(RENDY_SCALAR_VEC3) && (defined(__aarch64__) || defined(_M_ARM64))
+#define RENDY_VEC3_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(RENDY_VEC3_SSE) || defined(RENDY_VEC3_NEON)
+#define RENDY_SIMD_VEC3 1
+
+// The handful of four-lane operations the SIMD Vec3 is built from
+namespace vec4 {
+#ifdef RENDY_VEC3_SSE
+	typedef __m128 Lanes;
+
+	inline Lanes set(float x, float y, float z) { return _mm_set_ps(0.0f, z, y, x); }
+	inline Lanes splat(float t) { return _mm_set1_ps(t); }
+	inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+	inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+	inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+	inline Lanes div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+	inline Lanes negate(Lanes a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+	inline float first(Lanes a) { return _mm_cvtss_f32(a); }
+
+	// (x + y) + z, the same order the scalar build adds them in
+	inline float sum3(Lanes a) {
+		Lanes xy = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
+		return _mm_cvtss_f32(_mm_add_ss(xy, _mm_movehl_ps(a, a)));
+	}
+
+	// sum3 of a and of b, in the first two lanes
+	inline Lanes sum3x2(Lanes a, Lanes b) {
+		Lanes xy = _mm_unpacklo_ps(a, b);
+		Lanes zw = _mm_unpackhi_ps(a, b);
+		return _mm_add_ps(_mm_add_ps(xy, _mm_movehl_ps(xy, xy)), zw);
+	}
+	inline float second(Lanes a) { return _mm_cvtss_f32(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1))); }
+
+	// u.yzx * v.zxy - u.zxy * v.yzx
+	inline Lanes cross(Lanes u, Lanes v) {
+		Lanes uYZX = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1));
+		Lanes vYZX = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+		Lanes uZXY = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 1, 0, 2));
+		Lanes vZXY = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2));
+		return _mm_sub_ps(_mm_mul_ps(uYZX, vZXY), _mm_mul_ps(uZXY, vYZX));
+	}
+
+	inline Lanes mulAdd(Lanes a, Lanes b, Lanes c) {
+#if defined(__FMA__) || defined(__AVX2__)
+		return _mm_fmadd_ps(a, b, c);
+#else
+		return _mm_add_ps(_mm_mul_ps(a, b), c);
+#endif
+	}
+
+	// 1 / sqrt(x) from the hardware estimate and one Newton-Raphson step, to about 22 bits
+	inline float rsqrt(float x) {
+		__m128 lanes = _mm_set_ss(x);
+		__m128 estimate = _mm_rsqrt_ss(lanes);
+		__m128 halfX = _mm_mul_ss(lanes, _mm_set_ss(0.5f));
+		__m128 correction = _mm_sub_ss(_mm_set_ss(1.5f), _mm_mul_ss(halfX, _mm_mul_ss(estimate, estimate)));
+		return _mm_cvtss_f32(_mm_mul_ss(estimate, correction));
+	}
+#else
+	typedef float32x4_t Lanes;
+
+	inline Lanes set(float x, float y, float z) {
+		const float lanes[4] = { x, y, z, 0.0f };
+		return vld1q_f32(lanes);
+	}
+	inline Lanes splat(float t) { return vdupq_n_f32(t); }
+	inline Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+	inline Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+	inline Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+	inline Lanes div(Lanes a, Lanes b) { return vdivq_f32(a, b); }
+	inline Lanes negate(Lanes a) { return vnegq_f32(a); }
+	inline float first(Lanes a) { return vgetq_lane_f32(a, 0); }
+
+	inline float sum3(Lanes a) {
+		return (vgetq_lane_f32(a, 0) + vgetq_lane_f32(a, 1)) + vgetq_lane_f32(a, 2);
+	}
+
+	inline Lanes sum3x2(Lanes a, Lanes b) {
+		return set(sum3(a), sum3(b), 0.0f);
+	}
+	inline float second(Lanes a) { return vgetq_lane_f32(a, 1); }
+
+	inline Lanes cross(Lanes u, Lanes v) {
+		const float ux = vgetq_lane_f32(u, 0), uy = vgetq_lane_f32(u, 1), uz = vgetq_lane_f32(u, 2);
+		const float vx = vgetq_lane_f32(v, 0), vy = vgetq_lane_f32(v, 1), vz = vgetq_lane_f32(v, 2);
+		return set(uy * vz - uz * vy, uz * vx - ux * vz, ux * vy - uy * vx);
+	}
+
+	inline Lanes mulAdd(Lanes a, Lanes b, Lanes c) { return vfmaq_f32(c, a, b); }
+
+	// 1 / sqrt(x) from the hardware estimate and two Newton-Raphson steps
+	inline float rsqrt(float x) {
+		float32x2_t lanes = vdup_n_f32(x);
+		float32x2_t estimate = vrsqrte_f32(lanes);
+		estimate = vmul_f32(estimate, vrsqrts_f32(vmul_f32(lanes, estimate), estimate));
+		estimate = vmul_f32(estimate, vrsqrts_f32(vmul_f32(lanes, estimate), estimate));
+		return vget_lane_f32(estimate, 0);
+	}
+#endif
+}
+#endif
+
+// Which Vec3 this build has, for benchmark reports
+inline const char* vec3Backend() {
+#if defined(RENDY_VEC3_SSE)
+	return "sse";
+#elif defined(RENDY_VEC3_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+#ifdef RENDY_SIMD_VEC3
+class alignas(16) Vec3 {
+	private:
+		// x, y, z, and a fourth lane that no operation moves into the other three
+		vec4::Lanes v;
+	public:
+		// Constructors
+		Vec3() : v(vec4::splat(0.0f)) {}
+		Vec3(float e0, float e1, float e2) : v(vec4::set(e0, e1, e2)) {}
+		explicit Vec3(vec4::Lanes lanes) : v(lanes) {}
+
+		// Getters and Setters
+		const float x() const { return vec4::first(v); }
+		void x(float x) { (*this)[0] = x; }
+
+		const float y() const { return (*this)[1]; }
+		void y(float y) { (*this)[1] = y; }
+
+		const float z() const { return (*this)[2]; }
+		void z(float z) { (*this)[2] = z; }
+
+		const vec4::Lanes lanes() const { return v; }
+
+		// Operator Functions
+		Vec3 operator-() const { return Vec3(vec4::negate(v)); }
+		// The vector types of GCC, Clang and MSVC may all be read as arrays of their lanes
+		float operator[](int i) const { return reinterpret_cast<const float*>(&v)[i]; }
+		float& operator[](int i) { return reinterpret_cast<float*>(&v)[i]; }
+		Vec3& operator+=(const Vec3& u) {
+			v = vec4::add(v, u.v);
+			return *this;
+		}
+		Vec3& operator*=(const Vec3& u) {
+			v = vec4::mul(v, u.v);
+			return *this;
+		}
+		Vec3& operator/=(const Vec3& u) {
+			v = vec4::div(v, u.v);
+			return *this;
+		}
+		Vec3& operator-=(const Vec3& u) {
+			v = vec4::sub(v, u.v);
+			return *this;
+		}
+
+		// Length Helpers
+		float lengthSquared() const {
+			return vec4::sum3(vec4::mul(v, v));
+		}
+		float length() const {
+			return std::sqrt(lengthSquared());
+		}
+
+		// Random vector generators for diffuse (matte) materials
+		static Vec3 random() {
+			return Vec3(random_float(), random_float(), random_float());
+		}
+		static Vec3 random(float min, float max) {
+			return Vec3(random_float(min, max), random_float(min, max), random_float(min, max));
+		}
+};
+#else
 class Vec3 {
 	private:
 		float e[3];
@@ -72,11 +271,29 @@ class Vec3 {
 			return Vec3(random_float(min, max), random_float(min, max), random_float(min, max));
 		}
 };
+#endif
 
 // Vector Operator Helper Functions
 inline std::ostream &operator <<(std::ostream &out, const Vec3 &v) {
 	return out << v.x() << ' ' << v.y() << ' ' << v.z();
 }
+#ifdef RENDY_SIMD_VEC3
+inline Vec3 operator+(const Vec3 &u, const Vec3 &v) {
+	return Vec3(vec4::add(u.lanes(), v.lanes()));
+}
+inline Vec3 operator-(const Vec3 &u, const Vec3 &v) {
+	return Vec3(vec4::sub(u.lanes(), v.lanes()));
+}
+inline Vec3 operator*(const Vec3 &u, const Vec3 &v) {
+	return Vec3(vec4::mul(u.lanes(), v.lanes()));
+}
+inline Vec3 operator*(const Vec3 &u, float t) {
+	return Vec3(vec4::mul(u.lanes(), vec4::splat(t)));
+}
+inline Vec3 operator/(const Vec3 &u, float t) {
+	return Vec3(vec4::div(u.lanes(), vec4::splat(t)));
+}
+#else
 inline Vec3 operator+(const Vec3 &u, const Vec3 &v) {
 	return Vec3(u.x() + v.x(), u.y() + v.y(), u.z() + v.z());
 }
@@ -92,8 +309,17 @@ inline Vec3 operator*(const Vec3 &u, float t) {
 inline Vec3 operator/(const Vec3 &u, float t) {
 	return Vec3(u.x() / t, u.y() / t, u.z() / t);
 }
+#endif
 
 // Vector Math Helper Functions
+#ifdef RENDY_SIMD_VEC3
+inline float dot(const Vec3 &u, const Vec3 &v) {
+	return vec4::sum3(vec4::mul(u.lanes(), v.lanes()));
+}
+inline Vec3 cross(const Vec3 &u, const Vec3 &v) {
+	return Vec3(vec4::cross(u.lanes(), v.lanes()));
+}
+#else
 inline float dot(const Vec3 &u, const Vec3 &v) {
 	return u.x() * v.x()
 		+ u.y() * v.y()
@@ -106,11 +332,60 @@ inline Vec3 cross(const Vec3 &u, const Vec3 &v) {
 		u.x() * v.y() - u.y() * v.x()
 	);
 }
+#endif
+
+/*
+	dot(u, v) and dot(u, w) together. The SIMD build lines the two products up side
+	by side and adds up their lanes at once, rather than one after the other.
+*/
+inline void dot2(const Vec3& u, const Vec3& v, const Vec3& w, float& uDotV, float& uDotW) {
+#ifdef RENDY_SIMD_VEC3
+	vec4::Lanes sums = vec4::sum3x2(vec4::mul(u.lanes(), v.lanes()), vec4::mul(u.lanes(), w.lanes()));
+	uDotV = vec4::first(sums);
+	uDotW = vec4::second(sums);
+#else
+	uDotV = dot(u, v);
+	uDotW = dot(u, w);
+#endif
+}
+
 inline Vec3 unit(Vec3 u) {
 	return u / u.length();
 }
+
+/*
+	u * t + v. Where the CPU has fused multiply-add (NEON, or an FMA build on x86)
+	this is one instruction and rounds once, so the result can differ in the last
+	bit from the separate multiply and add.
+*/
+inline Vec3 mulAdd(const Vec3& u, float t, const Vec3& v) {
+#ifdef RENDY_SIMD_VEC3
+	return Vec3(vec4::mulAdd(u.lanes(), vec4::splat(t), v.lanes()));
+#else
+	return u * t + v;
+#endif
+}
+
+/*
+	unit with the square root and the division replaced by a multiply by 1 / sqrt,
+	which the SIMD build estimates in hardware (good to about 22 bits rather than
+	24). For directions that don't need to be exactly unit length, on CPUs where
+	division is slow: on recent x86 cores sqrt and divps are quick enough that
+	vec3_fast_unit and vec3_unit time the same, so the renderer sticks to unit and
+	the two builds keep rendering the same image.
+*/
+inline Vec3 fastUnit(Vec3 u) {
+#ifdef RENDY_SIMD_VEC3
+	return u * vec4::rsqrt(u.lengthSquared());
+#else
+	return u * (1.0f / std::sqrt(u.lengthSquared()));
+#endif
+}
+
 inline Vec3 randomInUnitSphere() {
+	RENDY_STAT(unitSphereCalls);
 	while (true) {
+		RENDY_STAT(unitSphereIterations);
 		Vec3 pointVector = Vec3::random(-1, 1);
 		if (pointVector.lengthSquared() < 1) {
 			return pointVector;
@@ -1,5 +1,6 @@
 #pragma once
 #include "vec3.h"
+#include <algorithm>
 
 /*
 	A note on the viewport mentioned below: the viewport is a virtual concept. In our case,
@@ -90,7 +91,7 @@ class Viewport {
 			/*
 				The height of the render must be at least 1 (meaning at least 1 pixel high)
 			*/
-			const int imageHeight = max(static_cast<int>(imageWidth / aspectRatio), 1);
+			const int imageHeight = (std::max)(static_cast<int>(imageWidth / aspectRatio), 1);
 
 			// Viewport dimension calculation
 			/*
@@ -0,0 +1,270 @@
+#pragma once
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rendyUtils.h"
+#include "rayPacket.h"
+#include "surface.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+	The paths of a wavefront render (see Camera::traceTileWavefront).
+
+	Following one path at a time, from the camera through all of its bounces, means
+	every bounce ray goes off in its own direction from wherever the last one landed,
+	so consecutive rays visit unrelated BVH nodes and spheres and there is nothing for
+	a RayPacket to share. A wavefront render instead makes a path for every sample
+	of a tile up front, and moves all of them along together a bounce at a time: find
+	what every path hits (extend), then work out where every one of them goes next
+	(shade). Each stage is one tight loop over the whole queue.
+
+	Between bounces the queue is sorted so that paths starting near each other and
+	heading the same way sit next to each other. The key is the octant the direction
+	points into, followed by the Morton code of the origin within the box around all
+	the origins. The extend stage then traces runs of similar rays one after the
+	other, which visit the same BVH nodes and spheres far more often than rays in
+	the order they were made, so more of what they read is still in the cache.
+
+	The paths are stored as a structure of arrays, and compacted as they end, so
+	each stage streams through only the paths that are still going. Which sample a
+	path belongs to is kept separately, in the order the samples were made, so the
+	light they bring back adds up in exactly the order it would one path at a time.
+
+	See: Laine, Karras and Aila, "Megakernels Considered Harmful: Wavefront Path
+	Tracing on GPUs" (HPG 2013)
+*/
+class Wavefront {
+	public:
+		// The most samples a wave holds; a tile with more is traced in several waves
+		static const int capacity = 1 << 16;
+
+		/*
+			One sample of a pixel of the tile, numbered pixel = j * tile width + i from the
+			tile's corner. radiance is the light its path brought back. ray is its camera
+			ray, and hit and sect what that ray hit, for the FeatureBuffer.
+		*/
+		struct Sample {
+			int pixel;
+			int sample;
+			Vec3 radiance;
+			Ray ray;
+			bool hit;
+			Intersection sect;
+		};
+
+		Wavefront() : _size(0) {
+			for (std::vector<float>* values : { &_ox, &_oy, &_oz, &_dx, &_dy, &_dz, &_tr, &_tg, &_tb, &_scratch }) {
+				values->resize(capacity);
+			}
+			_slots.resize(capacity);
+			_hits.resize(capacity);
+			_keys.resize(capacity);
+			_order.resize(capacity);
+			_sortedKeys.resize(capacity);
+			_sortedOrder.resize(capacity);
+			_samples.reserve(capacity);
+		}
+
+		// The wavefront of the calling thread, which keeps its memory from tile to tile
+		static Wavefront& local() {
+			static thread_local Wavefront wavefront;
+			return wavefront;
+		}
+
+		// Start a new wave with no samples and no paths
+		void clear() {
+			_samples.clear();
+			_size = 0;
+		}
+
+		// Add a sample whose path starts out along its camera ray with a throughput of 1
+		void addSample(int pixel, int sample, const Ray& r) {
+			Sample added;
+			added.pixel = pixel;
+			added.sample = sample;
+			added.ray = r;
+			added.hit = false;
+			_samples.push_back(added);
+			setPath(_size++, r, Vec3(1.0, 1.0, 1.0), static_cast<uint32_t>(_samples.size() - 1));
+		}
+
+		// Getters
+		const bool full() const { return _samples.size() >= static_cast<size_t>(capacity); }
+		const size_t sampleCount() const { return _samples.size(); }
+		const size_t pathCount() const { return _size; }
+
+		Sample& sample(uint32_t slot) { return _samples[slot]; }
+
+		Ray ray(size_t path) const {
+			return Ray(Vec3(_ox[path], _oy[path], _oz[path]), Vec3(_dx[path], _dy[path], _dz[path]));
+		}
+		Vec3 throughput(size_t path) const { return Vec3(_tr[path], _tg[path], _tb[path]); }
+		// The sample the path belongs to
+		uint32_t slot(size_t path) const { return _slots[path]; }
+		// What the path's ray hit in the last extend stage, with a null surface if it hit nothing
+		const Hit& hit(size_t path) const { return _hits[path]; }
+
+		/*
+			Store a path at position path. The shade stage writes the paths that carry on
+			back to the front of the queue this way, then shrinks the queue to them with
+			resize. path must not be past any path still to be read.
+		*/
+		void setPath(size_t path, const Ray& r, const Vec3& throughput, uint32_t slot) {
+			const Vec3 origin = r.origin();
+			const Vec3 direction = r.direction();
+			_ox[path] = origin.x();
+			_oy[path] = origin.y();
+			_oz[path] = origin.z();
+			_dx[path] = direction.x();
+			_dy[path] = direction.y();
+			_dz[path] = direction.z();
+			_tr[path] = throughput.x();
+			_tg[path] = throughput.y();
+			_tb[path] = throughput.z();
+			_slots[path] = slot;
+		}
+
+		void resize(size_t paths) { _size = paths; }
+
+		/*
+			The extend stage: find the closest hit of every path in the queue. With packets,
+			each run of RayPacket::size paths is traced as one packet, which only pays off
+			when the runs hold rays as close together as the camera rays of a few pixels.
+		*/
+		void extend(const Surface& sceneObjects, bool packets) {
+			const Interval rayT = Interval(0.001, infinity);
+			if (!packets) {
+				for (size_t path = 0; path < _size; path++) {
+					_hits[path].surface = nullptr;
+					sceneObjects.closestHit(ray(path), rayT, _hits[path]);
+				}
+				return;
+			}
+
+			for (size_t first = 0; first < _size; first += RayPacket::size) {
+				const int lanes = static_cast<int>((std::min)(_size - first, static_cast<size_t>(RayPacket::size)));
+				RayPacket packet;
+				for (int lane = 0; lane < lanes; lane++) {
+					packet.setRay(lane, ray(first + lane), rayT);
+				}
+				packet.prepare();
+
+				PacketIntersection hits;
+				sceneObjects.closestHitPacket(packet, hits);
+				for (int lane = 0; lane < lanes; lane++) {
+					_hits[first + lane] = hits.closest[lane];
+					if (!hits.hit(lane)) {
+						_hits[first + lane].surface = nullptr;
+					}
+				}
+			}
+		}
+
+		// Reorder the paths by direction octant and the Morton code of their origin
+		void sort() {
+			if (_size < 2) {
+				return;
+			}
+
+			float lower[3] = { _ox[0], _oy[0], _oz[0] };
+			float upper[3] = { _ox[0], _oy[0], _oz[0] };
+			const std::vector<float>* origins[3] = { &_ox, &_oy, &_oz };
+			for (int axis = 0; axis < 3; axis++) {
+				const std::vector<float>& values = *origins[axis];
+				for (size_t path = 1; path < _size; path++) {
+					lower[axis] = (std::min)(lower[axis], values[path]);
+					upper[axis] = (std::max)(upper[axis], values[path]);
+				}
+			}
+			float scale[3];
+			for (int axis = 0; axis < 3; axis++) {
+				const float extent = upper[axis] - lower[axis];
+				scale[axis] = extent > 0 ? cells / extent : 0.0f;
+			}
+
+			for (size_t path = 0; path < _size; path++) {
+				const uint32_t octant = (_dx[path] < 0 ? 4u : 0u) | (_dy[path] < 0 ? 2u : 0u) | (_dz[path] < 0 ? 1u : 0u);
+				const uint32_t x = cell((_ox[path] - lower[0]) * scale[0]);
+				const uint32_t y = cell((_oy[path] - lower[1]) * scale[1]);
+				const uint32_t z = cell((_oz[path] - lower[2]) * scale[2]);
+				_keys[path] = (octant << (3 * cellBits)) | (spreadBits(x) << 2) | (spreadBits(y) << 1) | spreadBits(z);
+				_order[path] = static_cast<uint32_t>(path);
+			}
+
+			// Least significant digit first radix sort, which keeps paths with equal keys in order
+			for (int shift = 0; shift < keyBits; shift += digitBits) {
+				uint32_t offsets[1 << digitBits] = {};
+				for (size_t path = 0; path < _size; path++) {
+					offsets[(_keys[path] >> shift) & digitMask]++;
+				}
+				uint32_t offset = 0;
+				for (uint32_t& count : offsets) {
+					const uint32_t bucket = count;
+					count = offset;
+					offset += bucket;
+				}
+				for (size_t path = 0; path < _size; path++) {
+					const uint32_t position = offsets[(_keys[path] >> shift) & digitMask]++;
+					_sortedKeys[position] = _keys[path];
+					_sortedOrder[position] = _order[path];
+				}
+				_keys.swap(_sortedKeys);
+				_order.swap(_sortedOrder);
+			}
+
+			for (std::vector<float>* values : { &_ox, &_oy, &_oz, &_dx, &_dy, &_dz, &_tr, &_tg, &_tb }) {
+				gather(*values, _scratch);
+			}
+			// The sorted keys are no longer needed, so their buffer holds the slots while they are gathered
+			gather(_slots, _sortedKeys);
+		}
+
+	private:
+		// The Morton code takes cellBits bits of each axis of the origin, below the 3 bits of the octant
+		static const int cellBits = 9;
+		static constexpr float cells = static_cast<float>((1 << cellBits) - 1);
+		static const int keyBits = 3 * cellBits + 3;
+		static const int digitBits = 10;
+		static const uint32_t digitMask = (1u << digitBits) - 1;
+
+		// The paths, as a structure of arrays: origin, direction, throughput, sample and hit
+		std::vector<float> _ox, _oy, _oz;
+		std::vector<float> _dx, _dy, _dz;
+		std::vector<float> _tr, _tg, _tb;
+		std::vector<uint32_t> _slots;
+		std::vector<Hit> _hits;
+		size_t _size;
+
+		std::vector<Sample> _samples;
+
+		// Sorting keys and the order they put the paths in, with the buffers the sort fills
+		std::vector<uint32_t> _keys, _order;
+		std::vector<uint32_t> _sortedKeys, _sortedOrder;
+		std::vector<float> _scratch;
+
+		static uint32_t cell(float position) {
+			return static_cast<uint32_t>((std::min)((std::max)(position, 0.0f), cells));
+		}
+
+		// Put two zero bits after each of the low 10 bits of x, to interleave three of them
+		static uint32_t spreadBits(uint32_t x) {
+			x = (x | (x << 16)) & 0x030000FFu;
+			x = (x | (x << 8)) & 0x0300F00Fu;
+			x = (x | (x << 4)) & 0x030C30C3u;
+			x = (x | (x << 2)) & 0x09249249u;
+			return x;
+		}
+
+		// Put values in the sorted order of the paths, using scratch as the buffer to gather into
+		template <typename T>
+		void gather(std::vector<T>& values, std::vector<T>& scratch) {
+			for (size_t path = 0; path < _size; path++) {
+				scratch[path] = values[_order[path]];
+			}
+			values.swap(scratch);
+		}
+};
+
+#endif